@@ -0,0 +1,195 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Combo matching over the packed row masks against a walk over the keys
+ * of each combo, with up to a few hundred random combos. Both must agree
+ * on every set of pressed keys. kb_combos_match() only runs on the press
+ * of a combo key, the scans and the other keys only pay for
+ * kb_combos_has_key(), whatever the number of combos.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "kb_test.h"
+#include "combo.h"
+
+#define NR_QUERIES 20000
+
+/**
+ * A combo as a list of keys, the layout of combotbl
+ */
+typedef struct {
+  int nr_keys;
+  uint8_t keys[KB_COMBO_MAX_KEYS];
+} key_list_t;
+
+static key_list_t lists[KB_MAX_COMBOS];
+static kb_combos_t combos;
+static uint32_t queries[NR_QUERIES][KB_NR_COLS];
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+static bool is_key_in(const key_list_t *list, int col, int row)
+{
+  for (int i = 0; i < list->nr_keys; i++) {
+    if (list->keys[i] == COMBO_KEY(col, row)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * kb_combos_match() walking the keys of each combo
+ */
+static int linear_match(int nr_combos, const uint32_t pressed[KB_NR_COLS],
+  bool *is_partial)
+{
+  int match = -1;
+
+  *is_partial = false;
+  for (int i = 0; i < nr_combos; i++) {
+    const key_list_t *list = &lists[i];
+    bool is_extra = false;
+    int nr_pressed = 0;
+    for (int col = 0; col < KB_NR_COLS && !is_extra; col++) {
+      for (uint32_t rows = pressed[col]; rows != 0; rows &= rows - 1) {
+        if (!is_key_in(list, col, __builtin_ctz(rows))) {
+          is_extra = true;
+          break;
+        }
+        nr_pressed++;
+      }
+    }
+    if (is_extra) {
+      continue;
+    }
+    if (nr_pressed < list->nr_keys) {
+      *is_partial = true;
+    } else if (match < 0) {
+      match = i;
+    }
+  }
+  return match;
+}
+
+/**
+ * Random combos of 2 ~ KB_COMBO_MAX_KEYS distinct keys, also as masks
+ */
+static void build_combos(int nr_combos)
+{
+  memset(&combos, 0, sizeof(combos));
+  for (int i = 0; i < nr_combos; i++) {
+    key_list_t *list = &lists[i];
+    kb_combo_t *combo = &combos.combo[i];
+    list->nr_keys = 0;
+    int nr_keys = 2 + rand() % (KB_COMBO_MAX_KEYS - 1);
+    while (list->nr_keys < nr_keys) {
+      int col = rand() % KB_NR_COLS, row = rand() % KB_NR_ROWS;
+      if (!is_key_in(list, col, row)) {
+        list->keys[list->nr_keys++] = COMBO_KEY(col, row);
+        combo->mask[col] |= 1u << row;
+        combos.keys[col] |= 1u << row;
+      }
+    }
+    combo->action = ACT_KEY(KEY_A + i % 26);
+  }
+  combos.nr_combos = nr_combos;
+}
+
+/**
+ * Sets of pressed keys as the reporter hands them: part of a combo, a
+ * whole one, or one with another key
+ */
+static void build_queries(int nr_combos)
+{
+  for (int n = 0; n < NR_QUERIES; n++) {
+    const key_list_t *list = &lists[rand() % nr_combos];
+    int nr_keys = 1 + rand() % list->nr_keys;
+    memset(queries[n], 0, sizeof(queries[n]));
+    for (int i = 0; i < nr_keys; i++) {
+      queries[n][COMBO_KEY_COL(list->keys[i])] |= 1u << COMBO_KEY_ROW(list->keys[i]);
+    }
+    if (rand() % 4 == 0) {
+      queries[n][rand() % KB_NR_COLS] |= 1u << (rand() % KB_NR_ROWS);
+    }
+  }
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+int main(void)
+{
+  static const int sizes[] = {8, 32, 128, 256, 512};
+  int sum = 0;
+
+  srand(15);
+  printf("%d queries per size, ns per query\n", NR_QUERIES);
+  printf("  combos  masks  key walk  has_key\n");
+  for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    int nr_combos = sizes[s];
+    if (nr_combos > KB_MAX_COMBOS) {
+      break;
+    }
+    build_combos(nr_combos);
+    build_queries(nr_combos);
+
+    for (int n = 0; n < NR_QUERIES; n++) {
+      bool is_partial, is_linear_partial;
+      int match = kb_combos_match(&combos, queries[n], &is_partial);
+      CHECK(match == linear_match(nr_combos, queries[n], &is_linear_partial));
+      CHECK(is_partial == is_linear_partial);
+    }
+
+    uint64_t start = kb_bench_now_ns();
+    for (int n = 0; n < NR_QUERIES; n++) {
+      bool is_partial;
+      sum += kb_combos_match(&combos, queries[n], &is_partial) + is_partial;
+    }
+    double ns_masks = (double)(kb_bench_now_ns() - start) / NR_QUERIES;
+
+    start = kb_bench_now_ns();
+    for (int n = 0; n < NR_QUERIES; n++) {
+      bool is_partial;
+      sum -= linear_match(nr_combos, queries[n], &is_partial) + is_partial;
+    }
+    double ns_linear = (double)(kb_bench_now_ns() - start) / NR_QUERIES;
+
+    start = kb_bench_now_ns();
+    for (int n = 0; n < NR_QUERIES; n++) {
+      sum += kb_combos_has_key(&combos, n % KB_NR_COLS, n % KB_NR_ROWS);
+    }
+    double ns_has_key = (double)(kb_bench_now_ns() - start) / NR_QUERIES;
+
+    printf("  %6d %6.0f %9.0f %8.2f\n", nr_combos, ns_masks, ns_linear, ns_has_key);
+  }
+  // keep the loops
+  CHECK(sum != 0x7fffffff);
+  return KB_TEST_RESULT();
+}
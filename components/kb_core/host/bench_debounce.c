@@ -0,0 +1,294 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Debounce algorithms over bounce traces of one key, sampled at the scan
+ * periods of the PM states with a few scan phases. Reports the keystrokes
+ * missed, the extra presses (chatter), the press and release latency and
+ * the cost of one update with the clock read around it. Fails on chatter at
+ * scan periods below the debounce time, and on a keystroke missed at a scan
+ * period where it is surely sampled after its bounce. At the slower periods
+ * one sample is taken as is, so an open spike that a sample lands on reads
+ * as a release and the chatter is only reported.
+ *
+ * Without arguments the traces are synthetic: bursts of contact bounce of
+ * up to 3 ms on press and release, and short open spikes while held. A
+ * recorded trace can be given as a file of "<time_us> <level>" lines, one
+ * per transition, starting released:
+ *
+ *   bench_debounce capture1.txt capture2.txt
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "kb_test.h"
+#include "debounce.h"
+
+#define DEBOUNCE_US 5000
+
+#define MAX_EDGES 4096
+#define MAX_KEYSTROKES 512
+
+// key under test
+#define COL 5
+#define ROW 12
+
+typedef struct {
+  uint32_t time_us;
+  bool is_pressed;
+} edge_t;
+
+typedef struct {
+  edge_t edges[MAX_EDGES];
+  int nr_edges;
+  uint32_t press_us[MAX_KEYSTROKES];    // start of each keystroke
+  uint32_t release_us[MAX_KEYSTROKES];  // start of its release
+  int nr_keystrokes;
+  uint32_t min_hold_us;                 // shortest level between keystrokes
+} trace_t;
+
+typedef struct {
+  int nr_missed;
+  int nr_chatter;
+  uint64_t press_latency_us;
+  int nr_presses;
+  uint64_t release_latency_us;
+  int nr_releases;
+  uint64_t update_ns;
+  uint64_t nr_updates;
+} result_t;
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+static void add_edge(trace_t *tr, uint32_t time_us, bool is_pressed)
+{
+  if (tr->nr_edges < MAX_EDGES) {
+    tr->edges[tr->nr_edges].time_us = time_us;
+    tr->edges[tr->nr_edges].is_pressed = is_pressed;
+    tr->nr_edges++;
+  }
+}
+
+/**
+ * Bounce between the levels for up to 3 ms from t_us, ending at is_pressed
+ */
+static uint32_t add_bounce(trace_t *tr, uint32_t t_us, bool is_pressed)
+{
+  int nr = rand() % 6;
+  for (int i = 0; i < nr; i++) {
+    add_edge(tr, t_us, is_pressed);
+    t_us += 50 + rand() % 250;
+    add_edge(tr, t_us, !is_pressed);
+    t_us += 50 + rand() % 200;
+  }
+  add_edge(tr, t_us, is_pressed);
+  return t_us;
+}
+
+/**
+ * Typing at 40 ~ 240 ms per level with bounce on every transition
+ */
+static void make_trace(trace_t *tr, unsigned seed, int nr_keystrokes)
+{
+  uint32_t t_us = 100000;
+
+  memset(tr, 0, sizeof(*tr));
+  srand(seed);
+  tr->min_hold_us = 40000;
+  for (int n = 0; n < nr_keystrokes && n < MAX_KEYSTROKES; n++) {
+    uint32_t hold_us = 40000 + rand() % 200000;
+    tr->press_us[n] = t_us;
+    uint32_t end_us = add_bounce(tr, t_us, true);
+    // the contact opens for a moment now and then
+    if (rand() % 4 == 0) {
+      uint32_t spike_us = end_us + 5000 + rand() % 20000;
+      add_edge(tr, spike_us, false);
+      add_edge(tr, spike_us + 50 + rand() % 250, true);
+    }
+    t_us += hold_us;
+    tr->release_us[n] = t_us;
+    add_bounce(tr, t_us, false);
+    t_us += 40000 + rand() % 200000;
+    tr->nr_keystrokes++;
+  }
+}
+
+/**
+ * Read a recorded trace, the keystrokes are its rising transitions after
+ * a stable release
+ */
+static bool load_trace(trace_t *tr, const char *path)
+{
+  FILE *fp = fopen(path, "r");
+  unsigned long time_us;
+  int level;
+  bool is_pressed = false;
+  uint32_t last_us = 0;
+
+  if (fp == NULL) {
+    return false;
+  }
+  memset(tr, 0, sizeof(*tr));
+  tr->min_hold_us = UINT32_MAX;
+  while (fscanf(fp, "%lu %d", &time_us, &level) == 2) {
+    if ((level != 0) == is_pressed) {
+      continue;
+    }
+    // a level held for the debounce time starts a keystroke or its release
+    if (time_us - last_us >= DEBOUNCE_US || tr->nr_edges == 0) {
+      if (level != 0 && tr->nr_keystrokes < MAX_KEYSTROKES) {
+        tr->press_us[tr->nr_keystrokes++] = time_us;
+      } else if (level == 0 && tr->nr_keystrokes > 0) {
+        tr->release_us[tr->nr_keystrokes - 1] = time_us;
+      }
+      if (tr->nr_edges != 0 && time_us - last_us < tr->min_hold_us) {
+        tr->min_hold_us = time_us - last_us;
+      }
+    }
+    is_pressed = level != 0;
+    last_us = time_us;
+    add_edge(tr, time_us, is_pressed);
+  }
+  fclose(fp);
+  return true;
+}
+
+/**
+ * Sample the trace every period_us from phase_us on
+ */
+static void run(const trace_t *tr, debounce_algo_t algo, uint32_t period_us,
+  uint32_t phase_us, result_t *res)
+{
+  debounce_t db;
+  int e = 0;
+  bool raw = false, state = false;
+  int keystroke = -1;
+  int nr_presses = 0;     // debounced presses within the current keystroke
+  uint32_t end_us = tr->edges[tr->nr_edges - 1].time_us + 2 * DEBOUNCE_US + 2 * period_us;
+
+  debounce_init(&db, algo, DEBOUNCE_US, 0);
+  for (uint32_t t_us = phase_us; t_us < end_us; t_us += period_us) {
+    while (e < tr->nr_edges && tr->edges[e].time_us <= t_us) {
+      raw = tr->edges[e++].is_pressed;
+    }
+    while (keystroke + 1 < tr->nr_keystrokes && tr->press_us[keystroke + 1] <= t_us) {
+      res->nr_missed += nr_presses == 0 && keystroke >= 0;
+      keystroke++;
+      nr_presses = 0;
+    }
+
+    uint32_t rows[KB_NR_COLS] = {0};
+    rows[COL] = raw ? 1u << ROW : 0;
+    uint64_t start_ns = kb_bench_now_ns();
+    debounce_update(&db, rows, t_us);
+    res->update_ns += kb_bench_now_ns() - start_ns;
+    res->nr_updates++;
+
+    bool is_pressed = (rows[COL] >> ROW) & 1;
+    if (is_pressed == state) {
+      continue;
+    }
+    state = is_pressed;
+    if (is_pressed) {
+      nr_presses++;
+      if (nr_presses > 1 || keystroke < 0) {
+        res->nr_chatter++;
+      } else {
+        res->press_latency_us += t_us - tr->press_us[keystroke];
+        res->nr_presses++;
+      }
+    } else if (keystroke >= 0 && nr_presses == 1 && t_us >= tr->release_us[keystroke]) {
+      res->release_latency_us += t_us - tr->release_us[keystroke];
+      res->nr_releases++;
+    }
+  }
+  res->nr_missed += nr_presses == 0 && keystroke >= 0;
+}
+
+static void bench(const char *name, const trace_t *tr)
+{
+  static const debounce_algo_t algos[] = {
+    DEBOUNCE_EAGER_PRESS, DEBOUNCE_DEFER_SYM, DEBOUNCE_COUNTER,
+  };
+  static const char *const algo_names[] = { "eager", "defer", "counter" };
+  static const uint32_t periods_us[] = { 1000, 2000, 16000, 40000, 160000 };
+  const int nr_phases = 7;
+
+  printf("%s: %d keystrokes, %d transitions\n", name, tr->nr_keystrokes, tr->nr_edges);
+  printf("  algo     period  missed  chatter  press lat  release lat  update\n");
+  for (size_t i = 0; i < sizeof(algos) / sizeof(algos[0]); i++) {
+    for (size_t k = 0; k < sizeof(periods_us) / sizeof(periods_us[0]); k++) {
+      result_t res = {0};
+      for (int p = 0; p < nr_phases; p++) {
+        run(tr, algos[i], periods_us[k], periods_us[k] * p / nr_phases, &res);
+      }
+      int nr_presses = res.nr_presses != 0 ? res.nr_presses : 1;
+      int nr_releases = res.nr_releases != 0 ? res.nr_releases : 1;
+      printf("  %-7s %6u us %6d %8d %8.2f ms %10.2f ms %5.1f ns\n",
+        algo_names[i], periods_us[k], res.nr_missed, res.nr_chatter,
+        res.press_latency_us / 1000.0 / nr_presses,
+        res.release_latency_us / 1000.0 / nr_releases,
+        (double)res.update_ns / res.nr_updates);
+
+      if (periods_us[k] < DEBOUNCE_US) {
+        CHECK(res.nr_chatter == 0);
+      }
+      // the shortest level outlasts its bounce, the debounce time and one
+      // period, so it is sampled long enough once the bounce is over
+      if (periods_us[k] + 2 * DEBOUNCE_US <= tr->min_hold_us) {
+        CHECK(res.nr_missed == 0);
+      }
+    }
+  }
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+int main(int argc, char *argv[])
+{
+  static trace_t tr;
+
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      if (!load_trace(&tr, argv[i]) || tr.nr_edges == 0) {
+        fprintf(stderr, "%s: no trace\n", argv[i]);
+        return 1;
+      }
+      bench(argv[i], &tr);
+    }
+    return KB_TEST_RESULT();
+  }
+
+  for (unsigned seed = 1; seed <= 3; seed++) {
+    char name[32];
+    snprintf(name, sizeof(name), "synthetic trace %u", seed);
+    make_trace(&tr, seed, 200);
+    bench(name, &tr);
+  }
+  return KB_TEST_RESULT();
+}
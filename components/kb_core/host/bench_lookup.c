@@ -0,0 +1,119 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Scan-code lookup: the dense planes against the linear search over the
+ * sparse tables they replaced, under heavy rollover, i.e. every scan looks
+ * up each key of the keymap. Both must agree on every scan code.
+ */
+
+#include "kb_test.h"
+#include "keymap.h"
+
+#define NR_SCANS 20000
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+/**
+ * The former search_hid_key()
+ */
+static int linear_hid_key(const kb_keymap_model_t *model, unsigned scan1, unsigned scan2)
+{
+  for (int i = 0; i < model->nr_keys; i++) {
+    if (model->kbtbl[i].scan1 == scan1 && model->kbtbl[i].scan2 == scan2) {
+      return model->kbtbl[i].hidcode;
+    }
+  }
+  return -1;
+}
+
+/**
+ * The former search_fn()
+ */
+static const fn_keytable_t *linear_fn(const kb_keymap_model_t *model, unsigned scan1, unsigned scan2)
+{
+  for (int i = 0; i < model->nr_fn_keys; i++) {
+    if (model->fntbl[i].scan1 == scan1 && model->fntbl[i].scan2 == scan2) {
+      return &model->fntbl[i];
+    }
+  }
+  return 0;
+}
+
+/**
+ * Look up every key of the keymap in each scan
+ * @return ns per lookup
+ */
+static double bench(const kb_keymap_model_t *model, bool is_dense, uint32_t *sum)
+{
+  uint64_t start = kb_bench_now_ns();
+
+  for (int n = 0; n < NR_SCANS; n++) {
+    for (int i = 0; i < model->nr_keys; i++) {
+      // the last keys of the table are the worst case of the linear search
+      const keytable_t *item = &model->kbtbl[model->nr_keys - 1 - i];
+      int hidkey = is_dense
+        ? search_hid_key(item->scan1, item->scan2)
+        : linear_hid_key(model, item->scan1, item->scan2);
+      const fn_keytable_t *fn = is_dense
+        ? search_fn(item->scan1, item->scan2)
+        : linear_fn(model, item->scan1, item->scan2);
+      *sum += hidkey + (fn != 0 ? fn->hidcode : 0);
+    }
+  }
+  return (double)(kb_bench_now_ns() - start) / ((double)NR_SCANS * model->nr_keys);
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+int main(void)
+{
+  const kb_keymap_model_t *model = keymap_get_model();
+
+  for (unsigned i = 0; i < KB_NR_COLS + 1; i++) {
+    for (unsigned j = 0; j < KB_NR_ROWS + 1; j++) {
+      CHECK(search_hid_key(i, j) == linear_hid_key(model, i, j));
+      const fn_keytable_t *dense = search_fn(i, j);
+      const fn_keytable_t *linear = linear_fn(model, i, j);
+      CHECK((dense == 0) == (linear == 0));
+      if (dense != 0 && linear != 0) {
+        CHECK(dense->hidcode == linear->hidcode && dense->fncode == linear->fncode);
+      }
+    }
+  }
+
+  uint32_t sum_linear = 0, sum_dense = 0;
+  double ns_linear = bench(model, false, &sum_linear);
+  double ns_dense = bench(model, true, &sum_dense);
+  CHECK(sum_linear == sum_dense);
+
+  printf("%s, %d keys pressed per scan, %d scans\n", model->name, model->nr_keys, NR_SCANS);
+  printf("  linear search: %7.2f ns per key\n", ns_linear);
+  printf("  dense planes:  %7.2f ns per key\n", ns_dense);
+  return KB_TEST_RESULT();
+}
@@ -0,0 +1,184 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "kb_hal_sim.h"
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+/**
+ * Sample the diode-less matrix: two columns that share a pressed row are
+ * connected, and read the rows of each other.
+ */
+static void sim_read_matrix(void *ctx, uint32_t col_rows[KB_NR_COLS])
+{
+  kb_sim_t *sim = ctx;
+  bool is_changed = true;
+
+  memcpy(col_rows, sim->keys, sizeof(sim->keys));
+  while (is_changed) {
+    is_changed = false;
+    for (int i = 0; i < KB_NR_COLS; i++) {
+      for (int k = 0; k < KB_NR_COLS; k++) {
+        if (i != k && (col_rows[i] & col_rows[k]) && (col_rows[k] & ~col_rows[i])) {
+          col_rows[i] |= col_rows[k];
+          is_changed = true;
+        }
+      }
+    }
+  }
+  if (sim->is_fn_pressed) {
+    col_rows[0] |= KB_FN_MASK;
+  }
+}
+
+static uint32_t sim_now_us(void *ctx)
+{
+  kb_sim_t *sim = ctx;
+  return sim->now_us;
+}
+
+static void sim_delay_ms(void *ctx, uint32_t ms)
+{
+  kb_sim_advance_us(ctx, ms * 1000);
+}
+
+static int sim_ps2_read(void *ctx, uint8_t *buf, int len, uint32_t timeout_ms)
+{
+  kb_sim_t *sim = ctx;
+  (void)timeout_ms;
+
+  int nrrd = 0;
+  while (nrrd < len && sim->ps2_pos < sim->ps2_len) {
+    buf[nrrd++] = sim->ps2_bytes[sim->ps2_pos++];
+  }
+  return nrrd;
+}
+
+static void sim_ps2_flush(void *ctx)
+{
+  kb_sim_t *sim = ctx;
+  sim->ps2_pos = sim->ps2_len;
+}
+
+static bool sim_is_nkro(void *ctx)
+{
+  kb_sim_t *sim = ctx;
+  return sim->is_nkro;
+}
+
+static bool sim_is_keyboard_ready(void *ctx)
+{
+  kb_sim_t *sim = ctx;
+  return !sim->is_keyboard_busy;
+}
+
+static void sim_send_keyboard(void *ctx, bool is_nkro, uint8_t *report)
+{
+  kb_sim_t *sim = ctx;
+  memset(sim->last_keyboard, 0, sizeof(sim->last_keyboard));
+  memcpy(sim->last_keyboard, report, is_nkro ? KB_NKRO_REPORT_LEN : 8);
+  sim->last_is_nkro = is_nkro;
+  if (sim->nr_keyboard_reports < KB_SIM_LOG_SIZE) {
+    memcpy(sim->keyboard_log[sim->nr_keyboard_reports], sim->last_keyboard,
+      KB_NKRO_REPORT_LEN);
+  }
+  sim->nr_keyboard_reports++;
+}
+
+static void sim_send_consumer(void *ctx, uint16_t usage)
+{
+  kb_sim_t *sim = ctx;
+  sim->last_consumer = usage;
+  if (sim->nr_consumer_reports < KB_SIM_LOG_SIZE) {
+    sim->consumer_log[sim->nr_consumer_reports] = usage;
+  }
+  sim->nr_consumer_reports++;
+}
+
+static void sim_send_mouse(void *ctx, uint8_t buttons, int8_t dx, int8_t dy,
+  int8_t vert, int8_t hori)
+{
+  kb_sim_t *sim = ctx;
+  sim->last_mouse_buttons = buttons;
+  sim->last_mouse_dx = dx;
+  sim->last_mouse_dy = dy;
+  sim->last_mouse_vert = vert;
+  sim->last_mouse_hori = hori;
+  sim->nr_mouse_reports++;
+}
+
+static void sim_lock_key(void *ctx, uint8_t hidkey)
+{
+  kb_sim_t *sim = ctx;
+  sim->last_lock_key = hidkey;
+}
+
+static void sim_do_fnfunc(void *ctx, fn_function_t fncode)
+{
+  kb_sim_t *sim = ctx;
+  sim->last_fnfunc = fncode;
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+void kb_sim_init(kb_sim_t *sim, kb_hal_t *hal)
+{
+  memset(sim, 0, sizeof(*sim));
+  sim->last_fnfunc = FN_NOP;
+
+  *hal = (kb_hal_t) {
+    .ctx = sim,
+    .read_matrix = sim_read_matrix,
+    .now_us = sim_now_us,
+    .delay_ms = sim_delay_ms,
+    .ps2_read = sim_ps2_read,
+    .ps2_flush = sim_ps2_flush,
+    .is_nkro = sim_is_nkro,
+    .is_keyboard_ready = sim_is_keyboard_ready,
+    .send_keyboard = sim_send_keyboard,
+    .send_consumer = sim_send_consumer,
+    .send_mouse = sim_send_mouse,
+    .lock_key = sim_lock_key,
+    .do_fnfunc = sim_do_fnfunc,
+  };
+}
+
+void kb_sim_set_key(kb_sim_t *sim, int col, int row, bool is_press)
+{
+  if (is_press) {
+    sim->keys[col] |= 1u << row;
+  } else {
+    sim->keys[col] &= ~(1u << row);
+  }
+}
+
+void kb_sim_advance_us(kb_sim_t *sim, uint32_t us)
+{
+  sim->now_us += us;
+}
@@ -0,0 +1,91 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Simulated hardware for the native kb_core build
+ *
+ * The matrix is diode-less like the real one: a sampled column reads every
+ * row connected to it through any path of pressed keys, so ghosting shows
+ * up as on the keyboard. The clock only moves when told to, and every
+ * report is recorded.
+ */
+#ifndef MY_KB_HAL_SIM_H
+#define MY_KB_HAL_SIM_H
+
+#include <stddef.h>
+#include "kb_core.h"
+
+// reports kept in the logs
+#define KB_SIM_LOG_SIZE 256
+
+typedef struct {
+  // inputs
+  uint32_t keys[KB_NR_COLS];        // pressed keys, rows of each column
+  bool is_fn_pressed;
+  bool is_nkro;                     // host accepts the NKRO report
+  bool is_keyboard_busy;            // host takes no keyboard report now
+  const uint8_t *ps2_bytes;         // PS/2 byte stream to deliver
+  size_t ps2_len;
+  size_t ps2_pos;
+
+  // simulated clock
+  uint32_t now_us;
+
+  // recorded outputs
+  uint32_t nr_keyboard_reports;
+  bool last_is_nkro;
+  uint8_t last_keyboard[KB_NKRO_REPORT_LEN];
+  uint32_t nr_consumer_reports;
+  uint16_t last_consumer;
+  // the first KB_SIM_LOG_SIZE reports, in the order sent
+  uint8_t keyboard_log[KB_SIM_LOG_SIZE][KB_NKRO_REPORT_LEN];
+  uint16_t consumer_log[KB_SIM_LOG_SIZE];
+  uint32_t nr_mouse_reports;
+  uint8_t last_mouse_buttons;
+  int8_t last_mouse_dx, last_mouse_dy;
+  int8_t last_mouse_vert, last_mouse_hori;
+  uint8_t last_lock_key;
+  fn_function_t last_fnfunc;
+} kb_sim_t;
+
+/**
+ * Reset the simulation and bind a HAL to it
+ * @param sim simulation
+ * @param hal output, callbacks on sim
+ */
+void kb_sim_init(kb_sim_t *sim, kb_hal_t *hal);
+
+/**
+ * Press or release a key
+ * @param sim simulation
+ * @param col scan code 1
+ * @param row scan code 2
+ * @param is_press press or release
+ */
+void kb_sim_set_key(kb_sim_t *sim, int col, int row, bool is_press);
+
+/**
+ * Advance the simulated clock
+ * @param sim simulation
+ * @param us time to advance
+ */
+void kb_sim_advance_us(kb_sim_t *sim, uint32_t us);
+
+#endif
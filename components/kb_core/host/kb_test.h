@@ -0,0 +1,57 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Checks and timing for the host tests and benchmarks
+ *
+ * Every test_*.c and bench_*.c is one executable run by ctest. A failed
+ * CHECK prints where and goes on, and the test fails at the end with
+ * KB_TEST_RESULT().
+ */
+#ifndef MY_KB_TEST_H
+#define MY_KB_TEST_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+static int kb_test_nr_failed;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      kb_test_nr_failed++; \
+    } \
+  } while (0)
+
+#define KB_TEST_RESULT() (kb_test_nr_failed != 0)
+
+/**
+ * Monotonic time for the benchmarks
+ */
+static inline uint64_t kb_bench_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+#endif
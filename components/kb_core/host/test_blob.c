@@ -0,0 +1,146 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Keymap blob checks: a blob is only taken whole, unaltered, made for this
+ * matrix and, through kb_keymap_blob_is_for_model(), for the model in use.
+ */
+
+#include <string.h>
+#include "kb_test.h"
+#include "kb_hal_sim.h"
+#include "keymap_blob.h"
+
+/****************************************************************
+ * 
+ *  Private Varibles
+ * 
+ ****************************************************************/
+
+static kb_keymap_t km;
+
+// aligned for kb_keymap_blob_check()
+static uint32_t blob_buf[(KB_KEYMAP_BLOB_SIZE + 3) / 4];
+static uint8_t *const blob = (uint8_t *)blob_buf;
+static kb_keymap_blob_hdr_t *const hdr = (kb_keymap_blob_hdr_t *)blob_buf;
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+static void build_blob(const char *name)
+{
+  CHECK(kb_keymap_blob_build(&km, name, blob, KB_KEYMAP_BLOB_SIZE) == KB_KEYMAP_BLOB_SIZE);
+}
+
+static void test_good(void)
+{
+  build_blob("E580");
+  const kb_keymap_t *planes = kb_keymap_blob_check(blob, KB_KEYMAP_BLOB_SIZE);
+  CHECK(planes == (const kb_keymap_t *)(hdr + 1));
+  CHECK(planes != NULL && memcmp(planes, &km, sizeof(km)) == 0);
+  // the buffer may be longer than the blob
+  static uint32_t longer[(KB_KEYMAP_BLOB_SIZE + 64) / 4];
+  memcpy(longer, blob, KB_KEYMAP_BLOB_SIZE);
+  CHECK(kb_keymap_blob_check(longer, sizeof(longer)) != NULL);
+  // and the buffer for the blob too small
+  CHECK(kb_keymap_blob_build(&km, "E580", longer, KB_KEYMAP_BLOB_SIZE - 1) == 0);
+}
+
+static void test_bad_header(void)
+{
+  build_blob("E580");
+  hdr->magic ^= 1;
+  CHECK(kb_keymap_blob_check(blob, KB_KEYMAP_BLOB_SIZE) == NULL);
+
+  build_blob("E580");
+  hdr->version++;
+  CHECK(kb_keymap_blob_check(blob, KB_KEYMAP_BLOB_SIZE) == NULL);
+
+  // made for another matrix
+  build_blob("E580");
+  hdr->nr_layers--;
+  CHECK(kb_keymap_blob_check(blob, KB_KEYMAP_BLOB_SIZE) == NULL);
+  build_blob("E580");
+  hdr->nr_cols--;
+  CHECK(kb_keymap_blob_check(blob, KB_KEYMAP_BLOB_SIZE) == NULL);
+  build_blob("E580");
+  hdr->nr_rows--;
+  CHECK(kb_keymap_blob_check(blob, KB_KEYMAP_BLOB_SIZE) == NULL);
+}
+
+static void test_crc_mismatch(void)
+{
+  // any byte of the planes
+  for (size_t i = sizeof(*hdr); i < KB_KEYMAP_BLOB_SIZE; i += 97) {
+    build_blob("E580");
+    blob[i] ^= 0x10;
+    CHECK(kb_keymap_blob_check(blob, KB_KEYMAP_BLOB_SIZE) == NULL);
+  }
+  // or the CRC itself
+  build_blob("E580");
+  hdr->crc32 ^= 0x80000000u;
+  CHECK(kb_keymap_blob_check(blob, KB_KEYMAP_BLOB_SIZE) == NULL);
+}
+
+static void test_truncated(void)
+{
+  build_blob("E580");
+  CHECK(kb_keymap_blob_check(blob, KB_KEYMAP_BLOB_SIZE - 1) == NULL);
+  CHECK(kb_keymap_blob_check(blob, sizeof(*hdr)) == NULL);
+  CHECK(kb_keymap_blob_check(blob, 0) == NULL);
+  CHECK(kb_keymap_blob_check(NULL, KB_KEYMAP_BLOB_SIZE) == NULL);
+}
+
+static void test_model_name(void)
+{
+  build_blob("e580");
+  CHECK(kb_keymap_blob_is_for_model(blob, "E580"));
+  CHECK(kb_keymap_blob_is_for_model(blob, "e580"));
+  CHECK(!kb_keymap_blob_is_for_model(blob, "E530"));
+  CHECK(!kb_keymap_blob_is_for_model(blob, "E58"));
+  CHECK(!kb_keymap_blob_is_for_model(blob, "E5800"));
+  CHECK(!kb_keymap_blob_is_for_model(blob, ""));
+
+  // a name filling the header has no room for its NUL
+  build_blob("0123456789abcdef");
+  CHECK(!kb_keymap_blob_is_for_model(blob, "0123456789abcdef"));
+  build_blob("0123456789abcde");
+  CHECK(kb_keymap_blob_is_for_model(blob, "0123456789abcde"));
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+int main(void)
+{
+  kb_keymap_build(&km);
+  test_good();
+  test_bad_header();
+  test_crc_mismatch();
+  test_truncated();
+  test_model_name();
+  return KB_TEST_RESULT();
+}
@@ -0,0 +1,259 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Combos: PgUp + PgDn of the e580 keymap is Play/Pause, and J + K, J + K + L
+ * are added. Keys that make no combo come out as themselves and in the
+ * order pressed, a larger combo is waited for within the combo term, and
+ * a combo goes up with the first of its keys.
+ */
+
+#include <string.h>
+#include "kb_test.h"
+#include "kb_hal_sim.h"
+
+#define TERM_US 50000
+
+#define PGUP 7, 15
+#define PGDN 5, 15
+#define J    4, 2
+#define K    4, 8
+#define L    4, 6
+#define M    3, 2
+
+static kb_sim_t sim;
+static kb_hal_t hal;
+static kb_keymap_t keymap;
+static kb_combos_t combos;
+static kb_reporter_t rp;
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+static void add_combo(kb_action_t act, int nr_keys, const uint8_t *keys)
+{
+  kb_combo_t *combo = &combos.combo[combos.nr_combos++];
+
+  memset(combo, 0, sizeof(*combo));
+  for (int i = 0; i < nr_keys; i++) {
+    combo->mask[keys[i] >> 5] |= 1u << (keys[i] & 0x1f);
+    combos.keys[keys[i] >> 5] |= 1u << (keys[i] & 0x1f);
+  }
+  combo->action = act;
+}
+
+/**
+ * The combos of the keymap, and J + K = Esc, J + K + L = Tab
+ */
+static void setup(void)
+{
+  static const uint8_t jk[] = {COMBO_KEY(4, 2), COMBO_KEY(4, 8)};
+  static const uint8_t jkl[] = {COMBO_KEY(4, 2), COMBO_KEY(4, 8), COMBO_KEY(4, 6)};
+
+  kb_sim_init(&sim, &hal);
+  kb_keymap_build(&keymap);
+  kb_reporter_init(&rp, &hal, &keymap);
+  kb_combos_build(&combos);
+  add_combo(ACT_KEY(KEY_ESC), 2, jk);
+  add_combo(ACT_KEY(KEY_TAB), 3, jkl);
+  kb_reporter_set_combos(&rp, &combos, TERM_US);
+}
+
+static void key(int col, int row, bool is_press, uint32_t time_us)
+{
+  kb_event_t ev = {
+    .time_us = time_us,
+    .col = col,
+    .row = row,
+    .is_press = is_press,
+  };
+  kb_reporter_apply(&rp, &ev);
+}
+
+/**
+ * Whether the n-th 6KRO report holds these keys, in either order
+ */
+static bool is_report(uint32_t n, uint8_t key1, uint8_t key2)
+{
+  uint8_t expected[KB_NKRO_REPORT_LEN] = {0, 0, key1, key2};
+  uint8_t swapped[KB_NKRO_REPORT_LEN] = {0, 0, key2, key1};
+  if (key2 == 0) {
+    swapped[2] = key1;
+    swapped[3] = 0;
+  }
+  return n < sim.nr_keyboard_reports
+    && (memcmp(sim.keyboard_log[n], expected, KB_NKRO_REPORT_LEN) == 0
+      || memcmp(sim.keyboard_log[n], swapped, KB_NKRO_REPORT_LEN) == 0);
+}
+
+static void test_keymap_combo(void)
+{
+  setup();
+  CHECK(combos.nr_combos == 3);
+  key(PGUP, true, 0);
+  CHECK(sim.nr_keyboard_reports == 0 && sim.nr_consumer_reports == 0);
+  key(PGDN, true, TERM_US - 1);
+  CHECK(sim.nr_consumer_reports == 1);
+  CHECK(sim.consumer_log[0] == KEY_CONSUMER_PLAY_PAUSE);
+
+  // up with the first of its keys, whichever it is
+  key(PGDN, false, TERM_US + 10000);
+  CHECK(sim.nr_consumer_reports == 2);
+  CHECK(sim.consumer_log[1] == 0);
+  key(PGUP, false, TERM_US + 20000);
+  CHECK(sim.nr_consumer_reports == 2);
+  CHECK(sim.nr_keyboard_reports == 0);
+}
+
+static void test_term(void)
+{
+  // the second key comes too late
+  setup();
+  key(PGUP, true, 0);
+  key(PGDN, true, TERM_US);
+  CHECK(sim.nr_keyboard_reports == 1);
+  CHECK(is_report(0, KEY_PAGEUP, 0));
+  // and may start a combo of its own
+  kb_reporter_tick(&rp, TERM_US * 2);
+  CHECK(sim.nr_consumer_reports == 0);
+  CHECK(sim.nr_keyboard_reports == 2);
+  CHECK(is_report(1, KEY_PAGEUP, KEY_PAGEDOWN));
+
+  // or never, and the tick lets the first one out
+  setup();
+  key(PGUP, true, 0);
+  kb_reporter_tick(&rp, TERM_US - 1);
+  CHECK(sim.nr_keyboard_reports == 0);
+  kb_reporter_tick(&rp, TERM_US);
+  CHECK(sim.nr_keyboard_reports == 1);
+  CHECK(is_report(0, KEY_PAGEUP, 0));
+}
+
+static void test_no_combo(void)
+{
+  // a key of no combo with them lets the keys held back out first
+  setup();
+  key(PGUP, true, 0);
+  key(M, true, 10000);
+  CHECK(sim.nr_keyboard_reports == 2);
+  CHECK(is_report(0, KEY_PAGEUP, 0));
+  CHECK(is_report(1, KEY_PAGEUP, KEY_M));
+
+  // and so does a release before the combo is complete
+  setup();
+  key(PGUP, true, 0);
+  key(PGUP, false, 10000);
+  CHECK(sim.nr_keyboard_reports == 2);
+  CHECK(is_report(0, KEY_PAGEUP, 0));
+  CHECK(is_report(1, 0, 0));
+
+  // J + PgDn is no combo, J goes out as itself before PgDn
+  setup();
+  key(J, true, 0);
+  key(PGDN, true, 10000);
+  CHECK(is_report(0, KEY_J, 0));
+  kb_reporter_tick(&rp, 10000 + TERM_US);
+  CHECK(is_report(1, KEY_J, KEY_PAGEDOWN));
+}
+
+static void test_overlap(void)
+{
+  // J + K waits for L within the term...
+  setup();
+  key(J, true, 0);
+  key(K, true, 10000);
+  CHECK(sim.nr_keyboard_reports == 0);
+  key(L, true, 20000);
+  CHECK(sim.nr_keyboard_reports == 1);
+  CHECK(is_report(0, KEY_TAB, 0));
+  key(K, false, 30000);
+  CHECK(is_report(1, 0, 0));
+  key(J, false, 40000);
+  key(L, false, 50000);
+  CHECK(sim.nr_keyboard_reports == 2);
+
+  // ...and is Esc once it runs out
+  setup();
+  key(J, true, 0);
+  key(K, true, 10000);
+  kb_reporter_tick(&rp, TERM_US);
+  CHECK(sim.nr_keyboard_reports == 1);
+  CHECK(is_report(0, KEY_ESC, 0));
+
+  // two combos held at once, released crosswise
+  setup();
+  key(J, true, 0);
+  key(K, true, 10000);
+  kb_reporter_tick(&rp, TERM_US);
+  key(PGUP, true, TERM_US + 10000);
+  key(PGDN, true, TERM_US + 20000);
+  CHECK(sim.nr_consumer_reports == 1);
+  CHECK(sim.consumer_log[0] == KEY_CONSUMER_PLAY_PAUSE);
+  key(J, false, TERM_US + 30000);
+  CHECK(sim.nr_keyboard_reports == 2);
+  CHECK(is_report(1, 0, 0));
+  CHECK(sim.nr_consumer_reports == 1);
+  key(PGDN, false, TERM_US + 40000);
+  CHECK(sim.nr_consumer_reports == 2);
+  CHECK(sim.consumer_log[1] == 0);
+  key(K, false, TERM_US + 50000);
+  key(PGUP, false, TERM_US + 60000);
+  CHECK(sim.nr_keyboard_reports == 2);
+  CHECK(sim.nr_consumer_reports == 2);
+}
+
+static void test_other_key_under_combo(void)
+{
+  // a key of no combo typed while a combo is held goes out at once, and
+  // the combo goes up with the first of its keys
+  setup();
+  key(J, true, 0);
+  key(K, true, 10000);
+  kb_reporter_tick(&rp, TERM_US);
+  key(M, true, TERM_US + 10000);
+  CHECK(sim.nr_keyboard_reports == 2);
+  CHECK(is_report(0, KEY_ESC, 0));
+  CHECK(is_report(1, KEY_ESC, KEY_M));
+  key(K, false, TERM_US + 20000);
+  CHECK(is_report(2, KEY_M, 0));
+  key(M, false, TERM_US + 30000);
+  key(J, false, TERM_US + 40000);
+  CHECK(sim.nr_keyboard_reports == 4);
+  CHECK(is_report(3, 0, 0));
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+int main(void)
+{
+  test_keymap_combo();
+  test_term();
+  test_no_combo();
+  test_overlap();
+  test_other_key_under_combo();
+  return KB_TEST_RESULT();
+}
@@ -0,0 +1,207 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Debounce algorithms at fast and slow scan rates, one key or several
+ */
+
+#include <string.h>
+#include "kb_test.h"
+#include "debounce.h"
+
+#define DEBOUNCE_US 5000
+
+// key under test
+#define COL 3
+#define ROW 9
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+/**
+ * Feed one sample with only the key under test at the given level
+ * @return debounced level of the key
+ */
+static bool sample(debounce_t *db, bool is_pressed, uint32_t now_us)
+{
+  uint32_t rows[KB_NR_COLS] = {0};
+  rows[COL] = is_pressed ? 1u << ROW : 0;
+  debounce_update(db, rows, now_us);
+  return (rows[COL] >> ROW) & 1;
+}
+
+/**
+ * Hold the key at one level from t_us on for nr samples every period_us
+ * @return time of the first sample that reads the level debounced, or
+ *   UINT32_MAX if none
+ */
+static uint32_t hold(debounce_t *db, bool is_pressed, uint32_t *t_us,
+  uint32_t period_us, int nr)
+{
+  uint32_t start_us = *t_us;
+  uint32_t done_us = UINT32_MAX;
+  for (int n = 0; n < nr; n++) {
+    if (sample(db, is_pressed, *t_us) == is_pressed && done_us == UINT32_MAX) {
+      done_us = *t_us - start_us;
+    }
+    *t_us += period_us;
+  }
+  return done_us;
+}
+
+/**
+ * One sample of glitch within a steady level never gets through, as long
+ * as the scans are faster than the debounce time
+ */
+static void test_glitch(debounce_algo_t algo, uint32_t period_us)
+{
+  debounce_t db;
+  uint32_t t_us = 1000;
+
+  debounce_init(&db, algo, DEBOUNCE_US, 0);
+  hold(&db, false, &t_us, period_us, 4);
+  if (algo != DEBOUNCE_EAGER_PRESS) {
+    // a press glitch
+    CHECK(!sample(&db, true, t_us));
+    t_us += period_us;
+    CHECK(!sample(&db, false, t_us));
+    t_us += period_us;
+  }
+
+  // a release glitch while held
+  hold(&db, true, &t_us, period_us, DEBOUNCE_US / period_us + 4);
+  CHECK(sample(&db, false, t_us));
+  t_us += period_us;
+  CHECK(sample(&db, true, t_us));
+}
+
+/**
+ * A steady change goes through after the debounce time, or on its first
+ * sample when the scans are slower than that
+ */
+static void test_latency(debounce_algo_t algo, uint32_t period_us)
+{
+  debounce_t db;
+  uint32_t t_us = period_us;
+  uint32_t min_us = DEBOUNCE_US - DEBOUNCE_US / 3;
+  uint32_t max_us = DEBOUNCE_US + period_us;
+  if (period_us >= DEBOUNCE_US) {
+    min_us = max_us = 0;
+  }
+
+  debounce_init(&db, algo, DEBOUNCE_US, 0);
+  uint32_t press_us = hold(&db, true, &t_us, period_us, DEBOUNCE_US / period_us + 4);
+  uint32_t release_us = hold(&db, false, &t_us, period_us, DEBOUNCE_US / period_us + 4);
+
+  if (algo == DEBOUNCE_EAGER_PRESS) {
+    CHECK(press_us == 0);
+  } else {
+    CHECK(press_us >= min_us && press_us <= max_us);
+  }
+  CHECK(release_us >= min_us && release_us <= max_us);
+}
+
+/**
+ * Slower than the debounce time, a keystroke of one sample still gets
+ * through, and a glitch of one sample too
+ */
+static void test_slow_single(debounce_algo_t algo, uint32_t period_us)
+{
+  debounce_t db;
+  uint32_t t_us = period_us;
+
+  debounce_init(&db, algo, DEBOUNCE_US, 0);
+  CHECK(sample(&db, true, t_us));
+  t_us += period_us;
+  CHECK(!sample(&db, false, t_us));
+
+  // not so once the samples come within the debounce time
+  t_us += DEBOUNCE_US / 5;
+  CHECK(!sample(&db, false, t_us));
+  t_us += DEBOUNCE_US / 5;
+  CHECK(sample(&db, true, t_us) == (algo == DEBOUNCE_EAGER_PRESS));
+}
+
+/**
+ * The keys are debounced each on its own
+ */
+static void test_independent(void)
+{
+  debounce_t db;
+  uint32_t rows[KB_NR_COLS] = {0};
+
+  debounce_init(&db, DEBOUNCE_DEFER_SYM, DEBOUNCE_US, 0);
+  // key A steady from 0, key B from 4 ms
+  for (uint32_t t_us = 0; t_us <= 10000; t_us += 1000) {
+    memset(rows, 0, sizeof(rows));
+    rows[0] = 1u << 2;
+    rows[7] = t_us >= 4000 ? 1u << 17 : 0;
+    debounce_update(&db, rows, t_us);
+    if (t_us == 6000) {
+      CHECK(rows[0] == 1u << 2 && rows[7] == 0);
+    }
+  }
+  CHECK(rows[0] == 1u << 2 && rows[7] == 1u << 17);
+}
+
+/**
+ * The clock of the samples wraps around
+ */
+static void test_wrap(void)
+{
+  debounce_t db;
+  uint32_t t_us = UINT32_MAX - 2500;
+
+  debounce_init(&db, DEBOUNCE_DEFER_SYM, DEBOUNCE_US, t_us);
+  uint32_t press_us = hold(&db, true, &t_us, 1000, 10);
+  CHECK(press_us >= DEBOUNCE_US - DEBOUNCE_US / 3 && press_us <= DEBOUNCE_US + 1000);
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+int main(void)
+{
+  static const debounce_algo_t algos[] = {
+    DEBOUNCE_EAGER_PRESS, DEBOUNCE_DEFER_SYM, DEBOUNCE_COUNTER,
+  };
+  // from faster than the debounce time to the scan periods of the PM states
+  static const uint32_t periods_us[] = { 250, 1000, 2000, 16000, 40000, 160000 };
+
+  for (size_t i = 0; i < sizeof(algos) / sizeof(algos[0]); i++) {
+    for (size_t k = 0; k < sizeof(periods_us) / sizeof(periods_us[0]); k++) {
+      if (periods_us[k] < DEBOUNCE_US) {
+        test_glitch(algos[i], periods_us[k]);
+      } else {
+        test_slow_single(algos[i], periods_us[k]);
+      }
+      test_latency(algos[i], periods_us[k]);
+    }
+  }
+  test_independent();
+  test_wrap();
+  return KB_TEST_RESULT();
+}
@@ -0,0 +1,152 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Ghost key properties over random press sets on the simulated diode-less
+ * matrix:
+ * - every pressed key reads as pressed, and a key that is not ambiguous
+ *   reads as it is,
+ * - a ghost key is always ambiguous,
+ * - through the scanner, a press is never reported for a key that is not
+ *   pressed, and every key is reported as it is once nothing is ambiguous.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "kb_test.h"
+#include "kb_hal_sim.h"
+#include "ghost.h"
+
+#define NR_SETS 20000
+#define NR_WALK_STEPS 20000
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+static void press_random(kb_sim_t *sim, int nr_keys)
+{
+  memset(sim->keys, 0, sizeof(sim->keys));
+  for (int n = 0; n < nr_keys; n++) {
+    kb_sim_set_key(sim, rand() % KB_NR_COLS, rand() % KB_NR_ROWS, true);
+  }
+}
+
+static void test_random_sets(void)
+{
+  kb_sim_t sim;
+  kb_hal_t hal;
+  uint32_t rows[KB_NR_COLS], amb[KB_NR_COLS];
+  int nr_ghosted = 0;
+
+  kb_sim_init(&sim, &hal);
+  for (int n = 0; n < NR_SETS; n++) {
+    press_random(&sim, 1 + rand() % 10);
+    hal.read_matrix(hal.ctx, rows);
+    bool is_amb = ghost_find(rows, amb);
+
+    bool is_ghost = false;
+    uint32_t any_amb = 0;
+    for (int i = 0; i < KB_NR_COLS; i++) {
+      uint32_t ghosts = rows[i] & ~sim.keys[i];
+      CHECK((sim.keys[i] & ~rows[i]) == 0);
+      CHECK((ghosts & ~amb[i]) == 0);
+      CHECK((amb[i] & ~rows[i]) == 0);
+      is_ghost |= ghosts != 0;
+      any_amb |= amb[i];
+    }
+    CHECK(is_amb == (any_amb != 0));
+    nr_ghosted += is_ghost;
+
+    // the resolved scan is exact but for the ambiguous keys
+    uint32_t prev[KB_NR_COLS];
+    for (int i = 0; i < KB_NR_COLS; i++) {
+      prev[i] = rand() & KB_ROW_MASK;
+    }
+    ghost_resolve(rows, prev);
+    for (int i = 0; i < KB_NR_COLS; i++) {
+      CHECK((rows[i] & ~amb[i]) == (sim.keys[i] & ~amb[i]));
+      CHECK((rows[i] & amb[i]) == (prev[i] & amb[i]));
+    }
+  }
+  // the sets are large enough to ghost now and then
+  CHECK(nr_ghosted > NR_SETS / 20);
+}
+
+/**
+ * Random presses and releases through the scanner, up to ten keys down
+ */
+static void test_random_walk(void)
+{
+  kb_sim_t sim;
+  kb_hal_t hal;
+  kb_scanner_t sc;
+  static kb_event_ring_t ring;
+  uint32_t reported[KB_NR_COLS] = {0};
+  int nr_down = 0;
+  kb_event_t ev;
+
+  kb_sim_init(&sim, &hal);
+  memset(&ring, 0, sizeof(ring));
+  kb_scanner_init(&sc, &hal, &ring, DEBOUNCE_EAGER_PRESS, 5000);
+
+  for (int n = 0; n < NR_WALK_STEPS; n++) {
+    int col = rand() % KB_NR_COLS;
+    int row = rand() % KB_NR_ROWS;
+    bool is_down = (sim.keys[col] >> row) & 1;
+    if (!is_down && nr_down >= 10) {
+      continue;
+    }
+    kb_sim_set_key(&sim, col, row, !is_down);
+    nr_down += is_down ? -1 : 1;
+
+    // a few scans past the debounce time
+    for (int k = 0; k < 4; k++) {
+      kb_sim_advance_us(&sim, 2000);
+      kb_scanner_scan(&sc);
+      while (kb_event_pop(&ring, &ev)) {
+        CHECK(!ev.is_press || ((sim.keys[ev.col] >> ev.row) & 1));
+        reported[ev.col] ^= 1u << ev.row;
+      }
+    }
+
+    uint32_t rows[KB_NR_COLS], amb[KB_NR_COLS];
+    hal.read_matrix(hal.ctx, rows);
+    if (!ghost_find(rows, amb)) {
+      CHECK(memcmp(reported, sim.keys, sizeof(reported)) == 0);
+    }
+  }
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+int main(void)
+{
+  srand(8);
+  test_random_sets();
+  test_random_walk();
+  return KB_TEST_RESULT();
+}
@@ -0,0 +1,197 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Keymap hot swap under load: one thread swaps the keymap thousands of
+ * times the way kb_set_keymap() does, between two buffers, while another
+ * types on it the way the report task does. Every report holds only keys
+ * of the keymap in use, so the buffer being rewritten is never read, and
+ * no key is left down once the typing stops.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include "kb_test.h"
+#include "kb_hal_sim.h"
+
+#define NR_SWAPS  5000
+#define NR_KEYS   8
+#define MAX_HELD  4     // within the 6KRO report
+
+static const uint8_t key_pos[NR_KEYS][2] = {
+  {2, 0}, {3, 0}, {4, 0}, {5, 0}, {2, 1}, {3, 1}, {4, 1}, {5, 1},
+};
+
+static kb_sim_t sim;
+static kb_hal_t hal;
+static kb_hal_t sim_hal;
+static kb_keymap_t keymap_a;    // the keys type KEY_A ~ KEY_H
+static kb_keymap_t keymap_b;    // the keys type KEY_1 ~ KEY_8
+static kb_keymap_t keymaps[2];  // what is swapped in, as kb_keymaps[]
+static kb_reporter_t rp;
+static bool is_held[NR_KEYS];
+static int nr_swaps;
+static bool is_swapping;
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+/**
+ * Whether the keymap in use types the usage on a key held
+ */
+static bool is_held_usage(uint8_t usage)
+{
+  for (int i = 0; i < NR_KEYS; i++) {
+    if (is_held[i]
+        && rp.layers.keymap->plane[KB_LAYER_BASE][key_pos[i][0]][key_pos[i][1]] == ACT_KEY(usage)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void check_keyboard(void *ctx, bool is_nkro, uint8_t *report)
+{
+  CHECK(!is_nkro);
+  for (int i = 2; i < 8; i++) {
+    if (report[i] != 0) {
+      CHECK(is_held_usage(report[i]));
+    }
+  }
+  sim_hal.send_keyboard(ctx, is_nkro, report);
+}
+
+static void build_keymaps(void)
+{
+  kb_keymap_build(&keymap_a);
+  keymap_b = keymap_a;
+  for (int i = 0; i < NR_KEYS; i++) {
+    keymap_a.plane[KB_LAYER_BASE][key_pos[i][0]][key_pos[i][1]] = ACT_KEY(KEY_A + i);
+    keymap_b.plane[KB_LAYER_BASE][key_pos[i][0]][key_pos[i][1]] = ACT_KEY(KEY_1 + i);
+  }
+  keymaps[0] = keymap_a;
+}
+
+/**
+ * The console side: kb_set_keymap() without the task notification,
+ * waiting out each pending swap
+ */
+static void *swap_thread(void *arg)
+{
+  (void)arg;
+
+  for (int i = 0; i < NR_SWAPS; i++) {
+    while (kb_reporter_is_swap_pending(&rp)) {
+      sched_yield();
+    }
+    kb_keymap_t *next = rp.layers.keymap == &keymaps[0] ? &keymaps[1] : &keymaps[0];
+    memcpy(next, i % 2 == 0 ? &keymap_b : &keymap_a, sizeof(*next));
+    CHECK(kb_reporter_swap_keymap(&rp, next, i % 4 == 3));
+    __atomic_store_n(&nr_swaps, i + 1, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&is_swapping, false, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+static void key(int i, bool is_press, uint32_t time_us)
+{
+  kb_event_t ev = {
+    .time_us = time_us,
+    .col = key_pos[i][0],
+    .row = key_pos[i][1],
+    .is_press = is_press,
+  };
+
+  if (is_press) {
+    is_held[i] = true;
+  }
+  kb_reporter_apply(&rp, &ev);
+  is_held[i] = is_press;
+}
+
+/**
+ * The report task side: random presses and releases until every swap
+ * is done, then everything released
+ */
+static uint32_t type_until_swapped(unsigned seed)
+{
+  uint32_t time_us = 0;
+  uint32_t nr_events = 0;
+  int nr_held = 0;
+
+  while (__atomic_load_n(&is_swapping, __ATOMIC_ACQUIRE) || kb_reporter_is_swap_pending(&rp)) {
+    int i = rand_r(&seed) % NR_KEYS;
+    if (is_held[i] || nr_held < MAX_HELD) {
+      nr_held += is_held[i] ? -1 : 1;
+      time_us += 1000;
+      key(i, !is_held[i], time_us);
+      nr_events++;
+    }
+    kb_reporter_tick(&rp, time_us);
+    // the report task sleeps until the next event
+    sched_yield();
+  }
+  for (int i = 0; i < NR_KEYS; i++) {
+    if (is_held[i]) {
+      time_us += 1000;
+      key(i, false, time_us);
+    }
+  }
+  kb_reporter_tick(&rp, time_us + 1000);
+  return nr_events;
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+int main(void)
+{
+  kb_sim_init(&sim, &hal);
+  sim_hal = hal;
+  hal.send_keyboard = check_keyboard;
+  build_keymaps();
+  kb_reporter_init(&rp, &hal, &keymaps[0]);
+  is_swapping = true;
+
+  pthread_t swapper;
+  CHECK(pthread_create(&swapper, NULL, swap_thread, NULL) == 0);
+  uint32_t nr_events = type_until_swapped(1);
+  pthread_join(swapper, NULL);
+
+  static const uint8_t none[8];
+  CHECK(nr_swaps == NR_SWAPS);
+  CHECK(!kb_reporter_is_swap_pending(&rp));
+  CHECK(memcmp(rp.layers.keymap, &keymap_a, sizeof(keymap_a)) == 0);
+  CHECK(sim.nr_keyboard_reports > 0);
+  CHECK(memcmp(sim.last_keyboard, none, sizeof(none)) == 0);
+  CHECK(rp.nr_queued == 0);
+
+  printf("%d swaps during %u key events, %u reports\n", nr_swaps, nr_events,
+    sim.nr_keyboard_reports);
+  return KB_TEST_RESULT();
+}
@@ -0,0 +1,195 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Layer resolution on a keymap of its own: momentary and toggled layers,
+ * transparent entries falling through to the layers below, and a key
+ * released on another layer than the one it was pressed on, which must
+ * release what its press sent.
+ */
+
+#include <string.h>
+#include "kb_test.h"
+#include "kb_hal_sim.h"
+
+#define A    2, 0     // KEY_A, KEY_1 on USER0, KEY_2 on USER1
+#define B    2, 1     // KEY_B, transparent on USER0, NONE on USER1
+#define MO   3, 0     // MO(USER0)
+#define TG   3, 1     // TG(USER1)
+
+static kb_keymap_t keymap;
+static kb_sim_t sim;
+static kb_hal_t hal;
+static kb_reporter_t rp;
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+static void build_keymap(void)
+{
+  memset(&keymap, 0, sizeof(keymap));
+  keymap.plane[KB_LAYER_BASE][2][0] = ACT_KEY(KEY_A);
+  keymap.plane[KB_LAYER_BASE][2][1] = ACT_KEY(KEY_B);
+  keymap.plane[KB_LAYER_BASE][3][0] = ACT_MO(KB_LAYER_USER0);
+  keymap.plane[KB_LAYER_BASE][3][1] = ACT_TG(KB_LAYER_USER1);
+  keymap.plane[KB_LAYER_USER0][2][0] = ACT_KEY(KEY_1);
+  keymap.plane[KB_LAYER_USER1][2][0] = ACT_KEY(KEY_2);
+  keymap.plane[KB_LAYER_USER1][2][1] = ACT_NONE;
+}
+
+static void key(int col, int row, bool is_press)
+{
+  kb_event_t ev = {
+    .time_us = sim.now_us,
+    .col = col,
+    .row = row,
+    .is_press = is_press,
+  };
+  kb_reporter_apply(&rp, &ev);
+  kb_sim_advance_us(&sim, 10000);
+}
+
+/**
+ * Whether the last 6KRO report holds the one key, 0 for none
+ */
+static bool is_last_report(uint8_t hidkey)
+{
+  uint8_t expected[KB_NKRO_REPORT_LEN] = {0, 0, hidkey};
+  return sim.nr_keyboard_reports > 0
+    && memcmp(sim.last_keyboard, expected, KB_NKRO_REPORT_LEN) == 0;
+}
+
+static void test_momentary(void)
+{
+  kb_layers_t ly;
+
+  kb_layers_init(&ly, &keymap);
+  CHECK(kb_layers_resolve(&ly, A) == ACT_KEY(KEY_A));
+  kb_layers_hold(&ly, KB_LAYER_USER0, true);
+  CHECK(kb_layers_is_on(&ly, KB_LAYER_USER0));
+  CHECK(kb_layers_resolve(&ly, A) == ACT_KEY(KEY_1));
+
+  // two keys hold the layer, it stays until both are released
+  kb_layers_hold(&ly, KB_LAYER_USER0, true);
+  kb_layers_hold(&ly, KB_LAYER_USER0, false);
+  CHECK(kb_layers_resolve(&ly, A) == ACT_KEY(KEY_1));
+  kb_layers_hold(&ly, KB_LAYER_USER0, false);
+  CHECK(kb_layers_resolve(&ly, A) == ACT_KEY(KEY_A));
+
+  // an extra release does not go negative
+  kb_layers_hold(&ly, KB_LAYER_USER0, false);
+  kb_layers_hold(&ly, KB_LAYER_USER0, true);
+  CHECK(kb_layers_resolve(&ly, A) == ACT_KEY(KEY_1));
+}
+
+static void test_toggle(void)
+{
+  kb_layers_t ly;
+
+  kb_layers_init(&ly, &keymap);
+  kb_layers_toggle(&ly, KB_LAYER_USER1);
+  CHECK(kb_layers_resolve(&ly, A) == ACT_KEY(KEY_2));
+  // a momentary layer below a toggled one does not show through it
+  kb_layers_hold(&ly, KB_LAYER_USER0, true);
+  CHECK(kb_layers_resolve(&ly, A) == ACT_KEY(KEY_2));
+  kb_layers_hold(&ly, KB_LAYER_USER0, false);
+
+  // release_all leaves the toggled layers
+  kb_layers_release_all(&ly);
+  CHECK(kb_layers_resolve(&ly, A) == ACT_KEY(KEY_2));
+  kb_layers_toggle(&ly, KB_LAYER_USER1);
+  CHECK(!kb_layers_is_on(&ly, KB_LAYER_USER1));
+  CHECK(kb_layers_resolve(&ly, A) == ACT_KEY(KEY_A));
+}
+
+static void test_transparent(void)
+{
+  kb_layers_t ly;
+
+  kb_layers_init(&ly, &keymap);
+  // transparent on USER0 falls through to the base layer
+  kb_layers_hold(&ly, KB_LAYER_USER0, true);
+  CHECK(kb_layers_resolve(&ly, B) == ACT_KEY(KEY_B));
+  // NONE on USER1 stops it
+  kb_layers_toggle(&ly, KB_LAYER_USER1);
+  CHECK(kb_layers_resolve(&ly, B) == ACT_NONE);
+  // transparent everywhere is nothing
+  CHECK(kb_layers_resolve(&ly, 0, 0) == ACT_NONE);
+  // outside the matrix too
+  CHECK(kb_layers_resolve(&ly, KB_NR_COLS, 0) == ACT_NONE);
+  CHECK(kb_layers_resolve(&ly, 0, KB_NR_ROWS) == ACT_NONE);
+}
+
+static void test_release_on_other_layer(void)
+{
+  kb_sim_init(&sim, &hal);
+  kb_reporter_init(&rp, &hal, &keymap);
+
+  // pressed on USER0, released on the base layer: KEY_1 goes up
+  key(MO, true);
+  key(A, true);
+  CHECK(is_last_report(KEY_1));
+  key(MO, false);
+  CHECK(is_last_report(KEY_1));
+  key(A, false);
+  CHECK(is_last_report(0));
+
+  // pressed on the base layer, released on USER0: KEY_A goes up
+  uint32_t nr_reports = sim.nr_keyboard_reports;
+  key(A, true);
+  CHECK(is_last_report(KEY_A));
+  key(MO, true);
+  key(A, false);
+  CHECK(is_last_report(0));
+  key(MO, false);
+  CHECK(sim.nr_keyboard_reports == nr_reports + 2);
+
+  // the same across a toggle
+  key(A, true);
+  key(TG, true);
+  key(TG, false);
+  key(A, false);
+  CHECK(is_last_report(0));
+  key(A, true);
+  CHECK(is_last_report(KEY_2));
+  key(TG, true);
+  key(TG, false);
+  key(A, false);
+  CHECK(is_last_report(0));
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+int main(void)
+{
+  build_keymap();
+  test_momentary();
+  test_toggle();
+  test_transparent();
+  test_release_on_other_layer();
+  return KB_TEST_RESULT();
+}
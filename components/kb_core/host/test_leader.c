@@ -0,0 +1,200 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Leader sequences: Fn + RightCtrl of the e580 keymap is the leader key,
+ * then B L toggles the backlight and M mutes. The keys of a sequence are
+ * swallowed; a key that no sequence goes on with, or no next key within
+ * the timeout, ends it, and the keys after it type as usual.
+ */
+
+#include <string.h>
+#include "kb_test.h"
+#include "kb_hal_sim.h"
+
+#define TIMEOUT_US 1000000
+
+#define FN     0, KB_FN_ROW
+#define RCTRL  3, 9
+#define B      2, 5
+#define L      4, 6
+#define M      3, 2
+#define J      4, 2
+#define K      4, 8
+
+static kb_sim_t sim;
+static kb_hal_t hal;
+static kb_keymap_t keymap;
+static kb_leader_t leader;
+static kb_reporter_t rp;
+static uint32_t now_us;
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+static void setup(void)
+{
+  kb_sim_init(&sim, &hal);
+  kb_keymap_build(&keymap);
+  kb_reporter_init(&rp, &hal, &keymap);
+  CHECK(kb_leader_init(&leader));
+  kb_reporter_set_leader(&rp, &leader, TIMEOUT_US);
+  now_us = 0;
+}
+
+static void key(int col, int row, bool is_press)
+{
+  now_us += 10000;
+  kb_event_t ev = {
+    .time_us = now_us,
+    .col = col,
+    .row = row,
+    .is_press = is_press,
+  };
+  kb_reporter_apply(&rp, &ev);
+}
+
+static void tap(int col, int row)
+{
+  key(col, row, true);
+  key(col, row, false);
+}
+
+static void lead(void)
+{
+  key(FN, true);
+  tap(RCTRL);
+  key(FN, false);
+}
+
+/**
+ * Whether J typed now comes out as itself
+ */
+static bool is_j_typed(void)
+{
+  uint32_t n = sim.nr_keyboard_reports;
+  tap(J);
+  return sim.nr_keyboard_reports == n + 2 && sim.keyboard_log[n][2] == KEY_J
+    && sim.keyboard_log[n + 1][2] == 0;
+}
+
+static void test_match(void)
+{
+  setup();
+  lead();
+  tap(B);
+  CHECK(sim.last_fnfunc == FN_NOP);
+  tap(L);
+  CHECK(sim.last_fnfunc == FN_BACKLIGHT);
+  CHECK(sim.nr_keyboard_reports == 0);
+  CHECK(is_j_typed());
+
+  // a sequence of one key, tapping a consumer usage
+  setup();
+  lead();
+  tap(M);
+  CHECK(sim.nr_consumer_reports == 2);
+  CHECK(sim.consumer_log[0] == KEY_CONSUMER_MUTE);
+  CHECK(sim.consumer_log[1] == 0);
+  CHECK(sim.nr_keyboard_reports == 0);
+}
+
+static void test_mismatch(void)
+{
+  // no sequence begins with K, which is swallowed with the sequence
+  setup();
+  lead();
+  tap(K);
+  CHECK(sim.nr_keyboard_reports == 0);
+  CHECK(sim.nr_consumer_reports == 0);
+  CHECK(is_j_typed());
+
+  // nor goes on with B K
+  setup();
+  lead();
+  tap(B);
+  tap(K);
+  CHECK(sim.nr_keyboard_reports == 0);
+  CHECK(sim.last_fnfunc == FN_NOP);
+  CHECK(is_j_typed());
+
+  // a key held down from before the leader goes up as usual
+  setup();
+  key(J, true);
+  lead();
+  key(J, false);
+  CHECK(sim.nr_keyboard_reports == 2);
+  CHECK(sim.keyboard_log[1][2] == 0);
+  tap(M);
+  CHECK(sim.consumer_log[0] == KEY_CONSUMER_MUTE);
+}
+
+static void test_timeout(void)
+{
+  // B alone is no sequence, and the tick ends it after the timeout
+  setup();
+  lead();
+  key(B, true);
+  uint32_t b_us = now_us;
+  key(B, false);
+  kb_reporter_tick(&rp, b_us + TIMEOUT_US - 1);
+  CHECK(rp.leader.is_active);
+  now_us = b_us + TIMEOUT_US;
+  kb_reporter_tick(&rp, now_us);
+  CHECK(!rp.leader.is_active);
+  CHECK(sim.last_fnfunc == FN_NOP);
+  CHECK(is_j_typed());
+
+  // without a tick, the next key past the timeout ends it and types
+  setup();
+  lead();
+  tap(B);
+  now_us += TIMEOUT_US;
+  tap(L);
+  CHECK(sim.last_fnfunc == FN_NOP);
+  CHECK(sim.nr_keyboard_reports == 2);
+  CHECK(sim.keyboard_log[0][2] == KEY_L);
+
+  // the timeout runs from the last key, not the leader
+  setup();
+  lead();
+  now_us += TIMEOUT_US / 2;
+  tap(B);
+  now_us += TIMEOUT_US / 2;
+  tap(L);
+  CHECK(sim.last_fnfunc == FN_BACKLIGHT);
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+int main(void)
+{
+  test_match();
+  test_mismatch();
+  test_timeout();
+  return KB_TEST_RESULT();
+}
@@ -0,0 +1,121 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * NKRO report bounds: the usages past the modifiers have no bit in the
+ * bitmap, and keymaps with usages past 8 bits are rejected
+ */
+
+#include <string.h>
+#include "kb_test.h"
+#include "kb_core.h"
+#include "keymap_blob.h"
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+/**
+ * Build the report of one key pressed at (0, 0) with its action
+ */
+static void build_one(kb_action_t act, kb_report_t *report)
+{
+  static uint32_t key_rows[KB_NR_COLS];
+  static kb_action_t actions[KB_NR_COLS][KB_NR_ROWS];
+
+  memset(report, 0x5a, sizeof(*report));
+  key_rows[0] = 1;
+  actions[0][0] = act;
+  kb_build_report(key_rows, (const kb_action_t (*)[KB_NR_ROWS])actions, report);
+}
+
+static void test_report_bounds(void)
+{
+  kb_report_t report;
+  uint8_t empty[KB_NKRO_REPORT_LEN] = {0};
+
+  // the last usage of the bitmap
+  build_one(ACT_KEY(0xdf), &report);
+  CHECK(report.nkro[KB_NKRO_REPORT_LEN - 1] == 0x80);
+  CHECK(report.hotkey == 0);
+
+  // a modifier goes to the modifier byte
+  build_one(ACT_KEY(KEY_RIGHTMETA), &report);
+  CHECK(report.nkro[0] == KEY_MOD_RMETA);
+  CHECK(memcmp(&report.nkro[1], &empty[1], KB_NKRO_REPORT_LEN - 1) == 0);
+
+  // the media keys are only in the 6KRO report
+  build_one(ACT_KEY(KEY_MEDIA_CALC), &report);
+  CHECK(memcmp(report.nkro, empty, KB_NKRO_REPORT_LEN) == 0);
+  CHECK(((uint8_t*)&report.hid)[2] == KEY_MEDIA_CALC);
+  CHECK(report.hotkey == 0);
+
+  // and a usage past 8 bits, which no valid keymap holds, writes nothing
+  build_one(ACT_KEY(0xfff), &report);
+  CHECK(memcmp(report.nkro, empty, KB_NKRO_REPORT_LEN) == 0);
+  CHECK(report.hotkey == 0);
+}
+
+static void test_action_valid(void)
+{
+  CHECK(kb_action_is_valid(ACT_TRNS));
+  CHECK(kb_action_is_valid(ACT_NONE));
+  CHECK(kb_action_is_valid(ACT_KEY(KEY_MEDIA_CALC)));
+  CHECK(!kb_action_is_valid(ACT_KEY(0x100)));
+  CHECK(!kb_action_is_valid(ACT_KEY(0xfff)));
+  CHECK(kb_action_is_valid(ACT_MO(KB_NR_LAYERS - 1)));
+  CHECK(!kb_action_is_valid(ACT_TG(KB_NR_LAYERS)));
+  CHECK(kb_action_is_valid(ACT_MT(7, KEY_A)));
+  CHECK(!kb_action_is_valid(ACT_MT(8, KEY_A)));
+  CHECK(!kb_action_is_valid(ACT_LT(KB_NR_LAYERS, KEY_A)));
+  CHECK(!kb_action_is_valid(0xc000));
+}
+
+static void test_blob_reject(void)
+{
+  static kb_keymap_t km;
+  static uint8_t blob[KB_KEYMAP_BLOB_SIZE];
+
+  kb_keymap_build(&km);
+  CHECK(kb_keymap_is_valid(&km));
+  CHECK(kb_keymap_blob_build(&km, "test", blob, sizeof(blob)) == KB_KEYMAP_BLOB_SIZE);
+  CHECK(kb_keymap_blob_check(blob, sizeof(blob)) != NULL);
+
+  // with a good CRC over a bad action
+  km.plane[KB_LAYER_BASE][0][0] = ACT_KEY(0x1ff);
+  CHECK(kb_keymap_blob_build(&km, "test", blob, sizeof(blob)) == KB_KEYMAP_BLOB_SIZE);
+  CHECK(kb_keymap_blob_check(blob, sizeof(blob)) == NULL);
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+int main(void)
+{
+  test_report_bounds();
+  test_action_valid();
+  test_blob_reject();
+  return KB_TEST_RESULT();
+}
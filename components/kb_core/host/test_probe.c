@@ -0,0 +1,189 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Idle probe state machine driven by synthetic row edges: the edge of a
+ * press only comes while its column is selected, as on the 74HC138, and
+ * the sweep after each dwell catches the others.
+ */
+
+#include <stdlib.h>
+#include "kb_test.h"
+#include "kb_hal_sim.h"
+
+// about the interval of PM_IDLE_LONG_TIME
+#define DWELL_US 20000
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+/**
+ * Whether the selected column reads a pressed row, i.e. the level
+ * triggered row interrupt fires
+ */
+static bool is_row_edge(const kb_hal_t *hal, int col)
+{
+  uint32_t col_rows[KB_NR_COLS];
+  hal->read_matrix(hal->ctx, col_rows);
+  return (col_rows[col] & KB_ROW_MASK) != 0;
+}
+
+/**
+ * Probe from time 0 with one key pressed at press_us
+ * @return time from the press to the end of the probe
+ */
+static uint32_t probe_latency(int col, int row, uint32_t press_us)
+{
+  kb_sim_t sim;
+  kb_hal_t hal;
+  kb_probe_t pb;
+
+  kb_sim_init(&sim, &hal);
+  kb_probe_init(&pb);
+  CHECK(kb_probe_start(&pb, true, false));
+
+  bool is_probing = true;
+  while (is_probing) {
+    int sel = kb_probe_next_col(&pb);
+    // the dwell ends early on the edge
+    uint32_t end_us = sim.now_us + DWELL_US;
+    bool is_edge = false;
+    if (press_us < end_us) {
+      if (press_us > sim.now_us) {
+        kb_sim_advance_us(&sim, press_us - sim.now_us);
+      }
+      kb_sim_set_key(&sim, col, row, true);
+      is_edge = is_row_edge(&hal, sel);
+    }
+    if (!is_edge) {
+      kb_sim_advance_us(&sim, end_us - sim.now_us);
+      is_edge = kb_probe_sweep(&hal);
+    }
+    is_probing = kb_probe_step(&pb, is_edge, true);
+  }
+  CHECK(pb.is_woken);
+  return sim.now_us - press_us;
+}
+
+static void test_start(void)
+{
+  kb_probe_t pb;
+
+  kb_probe_init(&pb);
+  CHECK(!pb.is_probing);
+  // not while a key is pressed, or the power state wants scans
+  CHECK(!kb_probe_start(&pb, true, true));
+  CHECK(!kb_probe_start(&pb, false, false));
+  CHECK(!pb.is_probing);
+  CHECK(kb_probe_start(&pb, true, false));
+  CHECK(pb.is_probing && !pb.is_woken);
+}
+
+static void test_columns(void)
+{
+  kb_probe_t pb;
+
+  kb_probe_init(&pb);
+  kb_probe_start(&pb, true, false);
+  for (int i = 0; i < 3 * KB_NR_COLS; i++) {
+    CHECK(kb_probe_next_col(&pb) == i % KB_NR_COLS);
+    CHECK(kb_probe_step(&pb, false, true));
+  }
+}
+
+static void test_leave(void)
+{
+  kb_probe_t pb;
+
+  // the power state leaves the idle probe without an edge
+  kb_probe_init(&pb);
+  kb_probe_start(&pb, true, false);
+  kb_probe_next_col(&pb);
+  CHECK(!kb_probe_step(&pb, false, false));
+  CHECK(!pb.is_probing && !pb.is_woken);
+
+  // an edge wakes up the scan even if the power state changed too
+  kb_probe_start(&pb, true, false);
+  kb_probe_next_col(&pb);
+  CHECK(!kb_probe_step(&pb, true, false));
+  CHECK(pb.is_woken);
+
+  // and the next probe starts afresh
+  CHECK(kb_probe_start(&pb, true, false));
+  CHECK(!pb.is_woken);
+}
+
+static void test_sweep(void)
+{
+  kb_sim_t sim;
+  kb_hal_t hal;
+
+  kb_sim_init(&sim, &hal);
+  CHECK(!kb_probe_sweep(&hal));
+  // on any column, and Fn
+  for (int col = 0; col < KB_NR_COLS; col++) {
+    kb_sim_set_key(&sim, col, 3, true);
+    CHECK(kb_probe_sweep(&hal));
+    kb_sim_set_key(&sim, col, 3, false);
+    CHECK(!kb_probe_sweep(&hal));
+  }
+  sim.is_fn_pressed = true;
+  CHECK(kb_probe_sweep(&hal));
+}
+
+/**
+ * A press anywhere, at any time, ends the probe within one dwell
+ */
+static void test_latency(void)
+{
+  uint32_t max_us = 0;
+
+  srand(3);
+  for (int n = 0; n < 2000; n++) {
+    int col = rand() % KB_NR_COLS;
+    int row = rand() % KB_NR_ROWS;
+    uint32_t press_us = rand() % (4 * KB_NR_COLS * DWELL_US);
+    uint32_t latency_us = probe_latency(col, row, press_us);
+    if (latency_us > max_us) {
+      max_us = latency_us;
+    }
+  }
+  CHECK(max_us <= DWELL_US);
+  printf("first-key latency %u us at most, %u us dwell\n", max_us, DWELL_US);
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+int main(void)
+{
+  test_start();
+  test_columns();
+  test_leave();
+  test_sweep();
+  test_latency();
+  return KB_TEST_RESULT();
+}
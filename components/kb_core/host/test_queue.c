@@ -0,0 +1,235 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Report queue: while the host stalls, every press and release still goes
+ * out as a report of its own and in order, consumer reports included, and
+ * a full queue holds the latest key state back instead of writing it over
+ * a queued report.
+ */
+
+#include <string.h>
+#include "kb_test.h"
+#include "kb_hal_sim.h"
+
+#define J     4, 2
+#define K     4, 8
+#define VOLUP 1, 3    // with Fn
+#define FN    0, KB_FN_ROW
+
+#define NR_TRACE 512
+
+/**
+ * One report as the host sees it
+ */
+typedef struct {
+  bool is_consumer;
+  uint16_t usage;     // consumer usage, or the first key of the 6KRO report
+} trace_t;
+
+static kb_sim_t sim;
+static kb_hal_t hal;
+static kb_hal_t sim_hal;        // the sink the trace hands the reports to
+static kb_keymap_t keymap;
+static kb_reporter_t rp;
+static trace_t trace[NR_TRACE];
+static int nr_trace;
+static bool is_one_per_ready;   // the host takes one report at a time
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+static void trace_keyboard(void *ctx, bool is_nkro, uint8_t *report)
+{
+  if (nr_trace < NR_TRACE) {
+    trace[nr_trace++] = (trace_t) {false, report[2]};
+  }
+  sim.is_keyboard_busy = is_one_per_ready;
+  sim_hal.send_keyboard(ctx, is_nkro, report);
+}
+
+static void trace_consumer(void *ctx, uint16_t usage)
+{
+  if (nr_trace < NR_TRACE) {
+    trace[nr_trace++] = (trace_t) {true, usage};
+  }
+  sim.is_keyboard_busy = is_one_per_ready;
+  sim_hal.send_consumer(ctx, usage);
+}
+
+static void setup(void)
+{
+  kb_sim_init(&sim, &hal);
+  sim_hal = hal;
+  hal.send_keyboard = trace_keyboard;
+  hal.send_consumer = trace_consumer;
+  kb_keymap_build(&keymap);
+  kb_reporter_init(&rp, &hal, &keymap);
+  nr_trace = 0;
+  is_one_per_ready = false;
+}
+
+static void key(int col, int row, bool is_press, uint32_t time_us)
+{
+  kb_event_t ev = {
+    .time_us = time_us,
+    .col = col,
+    .row = row,
+    .is_press = is_press,
+  };
+  kb_reporter_apply(&rp, &ev);
+}
+
+static bool is_trace(int n, bool is_consumer, uint16_t usage)
+{
+  return n < nr_trace && trace[n].is_consumer == is_consumer
+    && trace[n].usage == usage;
+}
+
+/**
+ * Whether the trace from n on alternates between the key and no key
+ */
+static bool is_taps(int n, int nr, uint16_t hidkey)
+{
+  for (int i = 0; i < nr; i++) {
+    if (!is_trace(n + i, false, i % 2 == 0 ? hidkey : 0)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void test_stall_in_order(void)
+{
+  // the host takes one report every third event, and the events wait in
+  // the ring while the queue is past half full
+  enum { NR_TAPS = 200 };
+  kb_event_t events[NR_TAPS * 2];
+  for (int i = 0; i < NR_TAPS * 2; i++) {
+    events[i] = (kb_event_t) {
+      .time_us = i * 1000,
+      .col = 4,
+      .row = (i / 2) % 2 == 0 ? 2 : 8,
+      .is_press = i % 2 == 0,
+    };
+  }
+
+  setup();
+  is_one_per_ready = true;
+  sim.is_keyboard_busy = true;
+  int nr_applied = 0;
+  for (int step = 0; nr_applied < NR_TAPS * 2 || rp.nr_queued > 0; step++) {
+    if (nr_applied < NR_TAPS * 2 && kb_reporter_is_ready(&rp)) {
+      kb_reporter_apply(&rp, &events[nr_applied++]);
+    }
+    CHECK(rp.nr_queued <= KB_REPORT_QUEUE_SIZE / 2 + 1);
+    if (step % 3 == 2) {
+      sim.is_keyboard_busy = false;
+      kb_reporter_flush(&rp);
+    }
+  }
+
+  CHECK(nr_trace == NR_TAPS * 2);
+  for (int i = 0; i < NR_TAPS; i++) {
+    CHECK(is_taps(i * 2, 2, i % 2 == 0 ? KEY_J : KEY_K));
+  }
+}
+
+static void test_overflow(void)
+{
+  // taps past the size of the queue, with the host stalled throughout
+  enum { NR_TAPS = KB_REPORT_QUEUE_SIZE };
+  setup();
+  sim.is_keyboard_busy = true;
+  for (int i = 0; i < NR_TAPS; i++) {
+    key(J, true, i * 2000);
+    key(J, false, i * 2000 + 1000);
+  }
+  // the last one pressed finds the queue full
+  key(J, true, NR_TAPS * 2000);
+  CHECK(rp.nr_queued == KB_REPORT_QUEUE_SIZE);
+  CHECK(rp.is_state_held);
+
+  sim.is_keyboard_busy = false;
+  kb_reporter_flush(&rp);
+  // no queued release is written over by the press after it
+  CHECK(nr_trace == KB_REPORT_QUEUE_SIZE + 1);
+  CHECK(is_taps(0, nr_trace, KEY_J));
+  CHECK(!rp.is_state_held);
+
+  key(J, false, NR_TAPS * 2000 + 1000);
+  CHECK(is_trace(nr_trace - 1, false, 0));
+}
+
+static void test_consumer_in_order(void)
+{
+  setup();
+  sim.is_keyboard_busy = true;
+  key(J, true, 0);
+  key(J, false, 1000);
+  key(FN, true, 2000);
+  key(VOLUP, true, 3000);
+  key(VOLUP, false, 4000);
+  key(FN, false, 5000);
+  key(K, true, 6000);
+  key(K, false, 7000);
+  CHECK(nr_trace == 0);
+
+  sim.is_keyboard_busy = false;
+  kb_reporter_flush(&rp);
+  CHECK(nr_trace == 6);
+  CHECK(is_trace(0, false, KEY_J));
+  CHECK(is_trace(1, false, 0));
+  CHECK(is_trace(2, true, KEY_CONSUMER_VOLUME_INCREMENT));
+  CHECK(is_trace(3, true, 0));
+  CHECK(is_trace(4, false, KEY_K));
+  CHECK(is_trace(5, false, 0));
+}
+
+static void test_consumer_release_all(void)
+{
+  // a keymap swap that releases the keys held releases the consumer key
+  setup();
+  key(FN, true, 0);
+  key(VOLUP, true, 1000);
+  CHECK(kb_reporter_swap_keymap(&rp, &keymap, true));
+  kb_reporter_tick(&rp, 2000);
+  CHECK(nr_trace == 2);
+  CHECK(is_trace(0, true, KEY_CONSUMER_VOLUME_INCREMENT));
+  CHECK(is_trace(1, true, 0));
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+int main(void)
+{
+  test_stall_in_order();
+  test_overflow();
+  test_consumer_in_order();
+  test_consumer_release_all();
+  return KB_TEST_RESULT();
+}
@@ -0,0 +1,174 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Event ring: empty and full, the index wrapping around both the buffer
+ * and the 32-bit counters, and one producer thread against one consumer
+ * thread keeping every event once and in order.
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "kb_test.h"
+#include "keyevent.h"
+
+#define NR_THREADED 200000
+
+static kb_event_ring_t ring;
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+static kb_event_t event(uint32_t n)
+{
+  return (kb_event_t) {
+    .time_us = n,
+    .col = n % 16,
+    .row = (n / 16) % 8,
+    .is_press = n % 2 == 0,
+  };
+}
+
+static bool is_event(const kb_event_t *ev, uint32_t n)
+{
+  kb_event_t expected = event(n);
+  return ev->time_us == expected.time_us && ev->col == expected.col
+    && ev->row == expected.row && ev->is_press == expected.is_press;
+}
+
+static bool push(uint32_t n)
+{
+  kb_event_t ev = event(n);
+  return kb_event_push(&ring, &ev);
+}
+
+/**
+ * Start the ring empty at the given index
+ */
+static void setup(uint32_t index)
+{
+  memset(&ring, 0, sizeof(ring));
+  ring.head = index;
+  ring.tail = index;
+}
+
+static void test_empty_full(void)
+{
+  kb_event_t ev;
+  setup(0);
+  CHECK(!kb_event_pop(&ring, &ev));
+
+  for (uint32_t n = 0; n < KB_EVENT_RING_SIZE; n++) {
+    CHECK(push(n));
+  }
+  // a full ring refuses the event and keeps the ones it holds
+  CHECK(!push(KB_EVENT_RING_SIZE));
+  for (uint32_t n = 0; n < KB_EVENT_RING_SIZE; n++) {
+    CHECK(kb_event_pop(&ring, &ev) && is_event(&ev, n));
+  }
+  CHECK(!kb_event_pop(&ring, &ev));
+
+  // one slot freed is one event more
+  for (uint32_t n = 0; n < KB_EVENT_RING_SIZE; n++) {
+    CHECK(push(n));
+  }
+  CHECK(kb_event_pop(&ring, &ev) && is_event(&ev, 0));
+  CHECK(push(KB_EVENT_RING_SIZE));
+  CHECK(!push(KB_EVENT_RING_SIZE + 1));
+}
+
+static void test_wraparound(void)
+{
+  // the counters wrap past UINT32_MAX in the middle of a full ring, and
+  // the slots wrap past the end of the buffer every KB_EVENT_RING_SIZE
+  kb_event_t ev;
+  setup(UINT32_MAX - KB_EVENT_RING_SIZE / 2);
+
+  uint32_t nr_pushed = 0;
+  uint32_t nr_popped = 0;
+  for (int round = 0; round < 4; round++) {
+    while (push(nr_pushed)) {
+      nr_pushed++;
+    }
+    CHECK(nr_pushed - nr_popped == KB_EVENT_RING_SIZE);
+    // drain part of it so the next round starts on another slot
+    for (int i = 0; i < KB_EVENT_RING_SIZE / 2 + round; i++) {
+      CHECK(kb_event_pop(&ring, &ev) && is_event(&ev, nr_popped));
+      nr_popped++;
+    }
+  }
+  while (kb_event_pop(&ring, &ev)) {
+    CHECK(is_event(&ev, nr_popped));
+    nr_popped++;
+  }
+  CHECK(nr_popped == nr_pushed);
+  CHECK(ring.head < KB_EVENT_RING_SIZE * 4);
+}
+
+static void *producer(void *arg)
+{
+  (void)arg;
+  for (uint32_t n = 0; n < NR_THREADED; n++) {
+    while (!push(n)) {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+static void test_threaded(void)
+{
+  pthread_t thread;
+  kb_event_t ev;
+  uint32_t nr_popped = 0;
+  uint32_t nr_wrong = 0;
+
+  setup(UINT32_MAX - 1000);
+  pthread_create(&thread, NULL, producer, NULL);
+  while (nr_popped < NR_THREADED) {
+    if (kb_event_pop(&ring, &ev)) {
+      nr_wrong += !is_event(&ev, nr_popped);
+      nr_popped++;
+    } else {
+      sched_yield();
+    }
+  }
+  pthread_join(thread, NULL);
+  CHECK(nr_wrong == 0);
+  CHECK(!kb_event_pop(&ring, &ev));
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+int main(void)
+{
+  test_empty_full();
+  test_wraparound();
+  test_threaded();
+  return KB_TEST_RESULT();
+}
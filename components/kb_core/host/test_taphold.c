@@ -0,0 +1,207 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Tap-hold keys: CapsLock of the e580 keymap is Ctrl when held. A tap
+ * within the tapping term types CapsLock, holding it for the term or
+ * tapping another key under it makes it Ctrl, and the events after it
+ * come out in order once it is decided.
+ */
+
+#include <string.h>
+#include "kb_test.h"
+#include "kb_hal_sim.h"
+
+#define TERM_US 200000
+
+#define CAPS 1, 4
+#define J    4, 2
+#define K    4, 8
+
+static kb_sim_t sim;
+static kb_hal_t hal;
+static kb_keymap_t keymap;
+static kb_reporter_t rp;
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+static void setup(bool is_permissive_hold, bool is_hold_on_other_key_press)
+{
+  kb_taphold_cfg_t cfg = {
+    .tapping_term_us = TERM_US,
+    .is_permissive_hold = is_permissive_hold,
+    .is_hold_on_other_key_press = is_hold_on_other_key_press,
+  };
+
+  kb_sim_init(&sim, &hal);
+  kb_keymap_build(&keymap);
+  kb_reporter_init(&rp, &hal, &keymap);
+  kb_reporter_set_taphold(&rp, &cfg);
+}
+
+static void key(int col, int row, bool is_press, uint32_t time_us)
+{
+  kb_event_t ev = {
+    .time_us = time_us,
+    .col = col,
+    .row = row,
+    .is_press = is_press,
+  };
+  kb_reporter_apply(&rp, &ev);
+}
+
+/**
+ * Whether the n-th 6KRO report holds the modifiers and the one key
+ */
+static bool is_report(uint32_t n, uint8_t mods, uint8_t hidkey)
+{
+  uint8_t expected[KB_NKRO_REPORT_LEN] = {mods, 0, hidkey};
+  return n < sim.nr_keyboard_reports
+    && memcmp(sim.keyboard_log[n], expected, KB_NKRO_REPORT_LEN) == 0;
+}
+
+static void test_tap(void)
+{
+  setup(true, false);
+  key(CAPS, true, 0);
+  CHECK(sim.nr_keyboard_reports == 0);
+  key(CAPS, false, TERM_US - 1);
+  CHECK(sim.nr_keyboard_reports == 2);
+  CHECK(is_report(0, 0, KEY_CAPSLOCK));
+  CHECK(is_report(1, 0, 0));
+  CHECK(sim.last_lock_key == KEY_CAPSLOCK);
+}
+
+static void test_hold_by_tick(void)
+{
+  setup(true, false);
+  key(CAPS, true, 1000);
+  kb_reporter_tick(&rp, 1000 + TERM_US - 1);
+  CHECK(sim.nr_keyboard_reports == 0);
+  kb_reporter_tick(&rp, 1000 + TERM_US);
+  CHECK(sim.nr_keyboard_reports == 1);
+  CHECK(is_report(0, KEY_MOD_LCTRL, 0));
+
+  key(J, true, 1000 + TERM_US + 10000);
+  key(J, false, 1000 + TERM_US + 20000);
+  key(CAPS, false, 1000 + TERM_US + 30000);
+  CHECK(sim.nr_keyboard_reports == 4);
+  CHECK(is_report(1, KEY_MOD_LCTRL, KEY_J));
+  CHECK(is_report(2, KEY_MOD_LCTRL, 0));
+  CHECK(is_report(3, 0, 0));
+  CHECK(sim.last_lock_key == 0);
+}
+
+static void test_hold_by_event(void)
+{
+  // no tick: the next event past the term decides it
+  setup(true, false);
+  key(CAPS, true, 0);
+  key(J, true, TERM_US);
+  CHECK(sim.nr_keyboard_reports == 2);
+  CHECK(is_report(0, KEY_MOD_LCTRL, 0));
+  CHECK(is_report(1, KEY_MOD_LCTRL, KEY_J));
+}
+
+static void test_permissive_hold(void)
+{
+  // J tapped under CapsLock within the term is Ctrl+J...
+  setup(true, false);
+  key(CAPS, true, 0);
+  key(J, true, 50000);
+  key(J, false, 80000);
+  key(CAPS, false, 120000);
+  CHECK(sim.nr_keyboard_reports == 4);
+  CHECK(is_report(0, KEY_MOD_LCTRL, 0));
+  CHECK(is_report(1, KEY_MOD_LCTRL, KEY_J));
+  CHECK(is_report(2, KEY_MOD_LCTRL, 0));
+  CHECK(is_report(3, 0, 0));
+
+  // ...while J pressed under it and released after it is a tap
+  setup(true, false);
+  key(CAPS, true, 0);
+  key(J, true, 50000);
+  key(CAPS, false, 80000);
+  key(J, false, 120000);
+  CHECK(sim.nr_keyboard_reports == 4);
+  CHECK(is_report(0, 0, KEY_CAPSLOCK));
+  CHECK(is_report(1, 0, 0));
+  CHECK(is_report(2, 0, KEY_J));
+  CHECK(is_report(3, 0, 0));
+
+  // and without permissive hold, so is a J tapped under it
+  setup(false, false);
+  key(CAPS, true, 0);
+  key(J, true, 50000);
+  key(J, false, 80000);
+  CHECK(sim.nr_keyboard_reports == 0);
+  key(CAPS, false, 120000);
+  CHECK(sim.nr_keyboard_reports == 4);
+  CHECK(is_report(0, 0, KEY_CAPSLOCK));
+  CHECK(is_report(1, 0, 0));
+  CHECK(is_report(2, 0, KEY_J));
+  CHECK(is_report(3, 0, 0));
+}
+
+static void test_hold_on_other_key_press(void)
+{
+  setup(false, true);
+  key(CAPS, true, 0);
+  key(J, true, 30000);
+  CHECK(sim.nr_keyboard_reports == 2);
+  CHECK(is_report(0, KEY_MOD_LCTRL, 0));
+  CHECK(is_report(1, KEY_MOD_LCTRL, KEY_J));
+}
+
+static void test_rollover(void)
+{
+  // K pressed before CapsLock goes up while it is undecided, unaffected
+  setup(true, false);
+  key(K, true, 0);
+  key(CAPS, true, 10000);
+  key(K, false, 20000);
+  CHECK(sim.nr_keyboard_reports == 2);
+  CHECK(is_report(0, 0, KEY_K));
+  CHECK(is_report(1, 0, 0));
+  key(CAPS, false, 30000);
+  CHECK(is_report(2, 0, KEY_CAPSLOCK));
+  CHECK(is_report(3, 0, 0));
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+int main(void)
+{
+  test_tap();
+  test_hold_by_tick();
+  test_hold_by_event();
+  test_permissive_hold();
+  test_hold_on_other_key_press();
+  test_rollover();
+  return KB_TEST_RESULT();
+}
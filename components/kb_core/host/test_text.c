@@ -0,0 +1,223 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Texts: the leader sequence S H of the e580 keymap types a shrug. The
+ * reports are decoded back into codepoints as IBus does with Ctrl+Shift+U,
+ * with the host taking every report at once or one at a time.
+ */
+
+#include <string.h>
+#include "kb_test.h"
+#include "kb_hal_sim.h"
+
+#define RCTRL  3, 9
+#define S      4, 4
+#define H      0, 2
+
+#define MAX_TEXT 32
+
+static const uint32_t shrug[] = {0xaf, '\\', '_', '(', 0x30c4, ')', '_', '/', 0xaf};
+
+static kb_sim_t sim;
+static kb_hal_t hal;
+static kb_hal_t sim_hal;
+static kb_keymap_t keymap;
+static kb_leader_t leader;
+static kb_reporter_t rp;
+static uint32_t now_us;
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+/**
+ * A host that takes one report, then is busy until told otherwise
+ */
+static void send_one_keyboard(void *ctx, bool is_nkro, uint8_t *report)
+{
+  sim_hal.send_keyboard(ctx, is_nkro, report);
+  sim.is_keyboard_busy = true;
+}
+
+static void setup(void)
+{
+  kb_sim_init(&sim, &hal);
+  sim_hal = hal;
+  kb_keymap_build(&keymap);
+  kb_reporter_init(&rp, &hal, &keymap);
+  CHECK(kb_leader_init(&leader));
+  kb_reporter_set_leader(&rp, &leader, 0);
+  kb_reporter_set_unicode(&rp, UNICODE_LINUX);
+  now_us = 0;
+}
+
+static void tap(int col, int row)
+{
+  for (int i = 0; i < 2; i++) {
+    now_us += 10000;
+    kb_event_t ev = {
+      .time_us = now_us,
+      .col = col,
+      .row = row,
+      .is_press = i == 0,
+    };
+    kb_reporter_apply(&rp, &ev);
+  }
+}
+
+static void type_shrug(void)
+{
+  kb_event_t fn = {.col = 0, .row = KB_FN_ROW, .is_press = true};
+  kb_reporter_apply(&rp, &fn);
+  tap(RCTRL);
+  fn.is_press = false;
+  kb_reporter_apply(&rp, &fn);
+  tap(S);
+  tap(H);
+}
+
+static int hex_digit(uint8_t hidkey)
+{
+  if (hidkey >= KEY_A && hidkey <= KEY_F) {
+    return hidkey - KEY_A + 10;
+  } else if (hidkey >= KEY_1 && hidkey <= KEY_9) {
+    return hidkey - KEY_1 + 1;
+  }
+  return hidkey == KEY_0 ? 0 : -1;
+}
+
+/**
+ * Decode the logged 6KRO reports into codepoints, as IBus does: Ctrl+Shift+U,
+ * hex digits, space
+ * @return number of codepoints, -1 if the reports are not well-formed
+ */
+static int decode(uint32_t *text)
+{
+  uint8_t last[6] = {0};
+  bool is_hex = false;
+  uint32_t cp = 0;
+  int nr_text = 0;
+
+  CHECK(sim.nr_keyboard_reports <= KB_SIM_LOG_SIZE);
+  for (uint32_t n = 0; n < sim.nr_keyboard_reports && n < KB_SIM_LOG_SIZE; n++) {
+    const uint8_t *report = sim.keyboard_log[n];
+    for (int i = 2; i < 8; i++) {
+      uint8_t hidkey = report[i];
+      if (hidkey == 0 || memchr(last, hidkey, sizeof(last)) != NULL) {
+        continue;
+      }
+      // a key pressed in this report
+      uint8_t mods = report[0];
+      if (hidkey == KEY_U && mods == (KEY_MOD_LCTRL | KEY_MOD_LSHIFT)) {
+        if (is_hex) {
+          return -1;
+        }
+        is_hex = true;
+        cp = 0;
+      } else if (is_hex && hidkey == KEY_SPACE) {
+        is_hex = false;
+        if (nr_text < MAX_TEXT) {
+          text[nr_text++] = cp;
+        }
+      } else if (is_hex && mods == 0 && hex_digit(hidkey) >= 0) {
+        cp = cp << 4 | hex_digit(hidkey);
+      } else {
+        return -1;
+      }
+    }
+    memcpy(last, &report[2], sizeof(last));
+  }
+  return is_hex ? -1 : nr_text;
+}
+
+static bool is_shrug_typed(void)
+{
+  uint32_t text[MAX_TEXT];
+  int nr_text = decode(text);
+  int nr_shrug = sizeof(shrug) / sizeof(shrug[0]);
+  const uint8_t *last = sim.keyboard_log[sim.nr_keyboard_reports - 1];
+  uint8_t empty[KB_NKRO_REPORT_LEN] = {0};
+
+  return nr_text == nr_shrug
+    && memcmp(text, shrug, sizeof(shrug)) == 0
+    && sim.nr_keyboard_reports <= KB_SIM_LOG_SIZE
+    && memcmp(last, empty, KB_NKRO_REPORT_LEN) == 0;
+}
+
+static void test_typed(void)
+{
+  setup();
+  type_shrug();
+  CHECK(is_shrug_typed());
+  CHECK(rp.macro.text == NULL && rp.macro.step == NULL);
+}
+
+static void test_stalled(void)
+{
+  // the host takes one report per tick, the text is expanded as it drains
+  setup();
+  hal.send_keyboard = send_one_keyboard;
+  sim.is_keyboard_busy = true;
+  type_shrug();
+  CHECK(sim.nr_keyboard_reports == 0);
+  CHECK(rp.nr_queued <= KB_REPORT_QUEUE_SIZE / 2);
+  for (int i = 0; i < 1000 && rp.nr_queued > 0; i++) {
+    uint32_t n = sim.nr_keyboard_reports;
+    sim.is_keyboard_busy = false;
+    kb_reporter_tick(&rp, now_us);
+    CHECK(sim.nr_keyboard_reports == n + 1);
+    CHECK(rp.nr_queued <= KB_REPORT_QUEUE_SIZE / 2);
+  }
+  CHECK(is_shrug_typed());
+}
+
+static void test_twice(void)
+{
+  // typed again while the first one is played, the second one waits
+  setup();
+  sim.is_keyboard_busy = true;
+  type_shrug();
+  type_shrug();
+  sim.is_keyboard_busy = false;
+  kb_reporter_flush(&rp);
+
+  uint32_t text[MAX_TEXT];
+  int nr_shrug = sizeof(shrug) / sizeof(shrug[0]);
+  CHECK(decode(text) == nr_shrug * 2);
+  CHECK(memcmp(text, shrug, sizeof(shrug)) == 0);
+  CHECK(memcmp(&text[nr_shrug], shrug, sizeof(shrug)) == 0);
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+int main(void)
+{
+  test_typed();
+  test_stalled();
+  test_twice();
+  return KB_TEST_RESULT();
+}
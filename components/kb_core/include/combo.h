@@ -0,0 +1,82 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Combos: keys pressed together that act as another key
+ *
+ * Each combo is a bitmask of its keys in the packed row masks of each
+ * column, so a set of pressed keys is checked against a combo with a few
+ * word-wide AND-NOTs instead of walking its keys.
+ */
+#ifndef MY_COMBO_H
+#define MY_COMBO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "keymap.h"
+
+// combos kept in RAM, the rest of combotbl is ignored
+#ifndef KB_MAX_COMBOS
+#define KB_MAX_COMBOS 64
+#endif
+
+/**
+ * One combo
+ */
+typedef struct {
+  uint32_t mask[KB_NR_COLS];  // its keys, rows of each column
+  kb_action_t action;
+} kb_combo_t;
+
+/**
+ * All the combos, and the keys used by any of them
+ */
+typedef struct {
+  kb_combo_t combo[KB_MAX_COMBOS];
+  int nr_combos;
+  uint32_t keys[KB_NR_COLS];
+} kb_combos_t;
+
+/**
+ * Build the combo masks from the combotbl of the keymap model in use
+ * @param cs output
+ */
+void kb_combos_build(kb_combos_t *cs);
+
+/**
+ * Whether a key is part of any combo
+ * @param cs combos
+ * @param col column
+ * @param row row
+ */
+bool kb_combos_has_key(const kb_combos_t *cs, int col, int row);
+
+/**
+ * Match a set of pressed keys against the combos
+ * @param cs combos
+ * @param pressed pressed keys, rows of each column
+ * @param is_partial output, true if the keys are a strict subset of a combo,
+ *   i.e. more keys may still complete a larger one
+ * @return index of the combo made of exactly these keys, -1 if none
+ */
+int kb_combos_match(const kb_combos_t *cs, const uint32_t pressed[KB_NR_COLS],
+  bool *is_partial);
+
+#endif
@@ -0,0 +1,75 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Per-key debounce over the packed row masks of each column
+ *
+ * Every key owns a 2-bit integrator. The integrators are bit-sliced: bit j
+ * of cnt0[i]/cnt1[i] is the low/high bit of the integrator of (col i, row j),
+ * so one column is updated with a few word operations. The integrators
+ * advance by elapsed time quanta, not by scans, hence the filter does not
+ * depend on the scan period. A key only integrates the time between two
+ * samples that read it at the same level, i.e. from its first differing
+ * sample on, unless the debounce time has passed since the last sample:
+ * then the bounce is over and a change goes through on its first sample,
+ * at the cost of letting a glitch through if that sample lands on it.
+ */
+#ifndef MY_DEBOUNCE_H
+#define MY_DEBOUNCE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "keymap.h"
+
+typedef enum {
+  DEBOUNCE_EAGER_PRESS,   // Report a press at once, defer the release
+  DEBOUNCE_DEFER_SYM,     // Defer both press and release until stable
+  DEBOUNCE_COUNTER,       // Integrate up when pressed, down when released
+} debounce_algo_t;
+
+typedef struct {
+  debounce_algo_t algo;
+  uint32_t quantum_us;            // debounce time / 3, one integrator step
+  uint32_t last_us;               // time of the last integrator step
+  uint32_t state[KB_NR_COLS];     // debounced rows
+  uint32_t last_raw[KB_NR_COLS];  // raw rows of the last sample
+  uint32_t cnt0[KB_NR_COLS];      // integrator bit 0
+  uint32_t cnt1[KB_NR_COLS];      // integrator bit 1
+} debounce_t;
+
+/**
+ * Reset the debouncer, all keys released
+ * @param db debouncer
+ * @param algo algorithm
+ * @param debounce_us time a key must be stable before it changes
+ * @param now_us current time
+ */
+void debounce_init(debounce_t *db, debounce_algo_t algo,
+  uint32_t debounce_us, uint32_t now_us);
+
+/**
+ * Feed one scan of raw row masks and replace them with the debounced ones
+ * @param db debouncer
+ * @param rows raw rows of each column, overwritten with debounced rows
+ * @param now_us time of the scan, may wrap around
+ */
+void debounce_update(debounce_t *db, uint32_t rows[KB_NR_COLS], uint32_t now_us);
+
+#endif
@@ -0,0 +1,53 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Ghost key resolution over the packed row masks of each column
+ *
+ * Without diodes, three pressed corners of a rectangle in the matrix make
+ * the fourth corner read as pressed too. A key can be a ghost only if it
+ * is a corner of a rectangle whose four corners all read as pressed, i.e.
+ * its column shares at least two rows with another column. Those corners
+ * are ambiguous and keep their previous state; every other key is exact.
+ */
+#ifndef MY_GHOST_H
+#define MY_GHOST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "keymap.h"
+
+/**
+ * Find the ambiguous keys of a scan
+ * @param rows row masks of each column
+ * @param amb output, ambiguous rows of each column
+ * @return true if any key is ambiguous
+ */
+bool ghost_find(const uint32_t rows[KB_NR_COLS], uint32_t amb[KB_NR_COLS]);
+
+/**
+ * Replace the ambiguous keys of a scan with their previous state
+ * @param rows row masks of each column, resolved in place
+ * @param prev previously accepted row masks of each column
+ * @return true if any key is ambiguous
+ */
+bool ghost_resolve(uint32_t rows[KB_NR_COLS], const uint32_t prev[KB_NR_COLS]);
+
+#endif
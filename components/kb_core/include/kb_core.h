@@ -0,0 +1,396 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Portable keyboard core
+ *
+ * Matrix scan processing (debounce, ghost keys, key events), keyboard and
+ * consumer report generation, and trackpoint packet handling. No FreeRTOS
+ * or ESP-IDF here: the hardware is reached through kb_hal_t, and the
+ * callers own the tasks and the event ring between them.
+ */
+#ifndef MY_KB_CORE_H
+#define MY_KB_CORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "kb_hal.h"
+#include "keymap.h"
+#include "debounce.h"
+#include "keyevent.h"
+#include "layer.h"
+#include "combo.h"
+#include "leader.h"
+#include "unicode.h"
+#include "probe.h"
+
+// NKRO report: modifier byte + bitmap of usages 0x00-0xDF
+#define KB_NKRO_REPORT_LEN 29
+
+// key events held back while a tap-hold key is undecided
+#define KB_TAPHOLD_BUF_SIZE 8
+
+// key events held back while a combo may still complete
+#define KB_COMBO_BUF_SIZE KB_COMBO_MAX_KEYS
+
+// combos held down at the same time
+#define KB_COMBO_MAX_ACTIVE 4
+
+// keyboard and consumer reports waiting for the sink, macros fill up to
+// half of them
+#define KB_REPORT_QUEUE_SIZE 32
+
+// macros and texts waiting for the one being played
+#define KB_MACRO_QUEUE_SIZE 4
+
+/****************************************************************
+ * 
+ *  Typedefs
+ * 
+ ****************************************************************/
+
+/**
+ * Matrix scanner, the producer of the key events
+ */
+typedef struct {
+  const kb_hal_t *hal;
+  kb_event_ring_t *events;
+  debounce_t debounce;
+  uint32_t reported_rows[KB_NR_COLS];   // key state handed out so far
+} kb_scanner_t;
+
+/**
+ * Reports for one key state
+ */
+typedef struct {
+  uint64_t hid;                         // 6KRO keyboard report
+  uint8_t nkro[KB_NKRO_REPORT_LEN];     // NKRO keyboard report
+  uint16_t hotkey;                      // consumer usage
+} kb_report_t;
+
+/**
+ * Tap-hold timing. A tap-hold key is a hold once it is held for the
+ * tapping term; before that:
+ * - releasing it makes it a tap,
+ * - with is_permissive_hold, a key pressed and released within it makes
+ *   it a hold,
+ * - with is_hold_on_other_key_press, any other key press makes it a hold.
+ */
+typedef struct {
+  uint32_t tapping_term_us;
+  bool is_permissive_hold;
+  bool is_hold_on_other_key_press;
+} kb_taphold_cfg_t;
+
+/**
+ * Tap-hold key being decided, and the events that came after it
+ */
+typedef struct {
+  kb_taphold_cfg_t cfg;
+  bool is_pending;
+  kb_event_t key;                       // press of the tap-hold key
+  kb_action_t act;                      // its tap-hold action
+  kb_event_t buf[KB_TAPHOLD_BUF_SIZE];
+  int nr_buf;
+} kb_taphold_t;
+
+/**
+ * Combo held down: its action is latched on the first of its keys, and
+ * released with the first of them to go up
+ */
+typedef struct {
+  bool is_used;
+  bool is_down;                         // the action is still pressed
+  kb_event_t carrier;                   // press the action is latched on
+  uint32_t keys[KB_NR_COLS];            // its keys not released yet
+} kb_active_combo_t;
+
+/**
+ * Combo being decided, and the combos held down. Presses of combo keys
+ * are held back until they make a combo, or are replayed as themselves
+ * when they cannot or the combo term runs out.
+ */
+typedef struct {
+  const kb_combos_t *combos;            // NULL if none
+  uint32_t term_us;
+  bool is_pending;
+  uint32_t pressed[KB_NR_COLS];         // keys held back, rows of each column
+  kb_event_t buf[KB_COMBO_BUF_SIZE];    // their presses, buf[0] started it
+  int nr_buf;
+  kb_active_combo_t active[KB_COMBO_MAX_ACTIVE];
+} kb_combo_state_t;
+
+/**
+ * Leader sequence being typed. The leader key and the keys of the
+ * sequence are swallowed, press and release, and the action of the
+ * sequence is tapped on its last key.
+ */
+typedef struct {
+  kb_leader_t *match;                   // NULL if none
+  uint32_t timeout_us;
+  bool is_active;
+  kb_event_t last;                      // press of the leader or last key
+  uint32_t swallowed[KB_NR_COLS];       // keys whose release is swallowed
+} kb_leader_state_t;
+
+/**
+ * Keyboard or consumer report waiting for the sink
+ */
+typedef struct {
+  bool is_consumer;                     // consumer usage in hotkey
+  bool is_nkro;
+  uint16_t hotkey;
+  uint8_t buf[KB_NKRO_REPORT_LEN];      // NKRO report, or the 8-byte 6KRO one
+} kb_queued_report_t;
+
+/**
+ * Macro being played, and the ones pressed after it. A text is played
+ * as the macro steps of one codepoint after another.
+ */
+typedef struct {
+  const kb_macro_step_t *step;          // next step, NULL if none is played
+  const uint32_t *text;                 // next codepoint, NULL if none is typed
+  kb_macro_step_t text_steps[KB_UNICODE_MAX_STEPS];
+  uint8_t held[KB_NKRO_REPORT_LEN];     // keys held by the macro, NKRO layout
+  kb_action_t pending[KB_MACRO_QUEUE_SIZE];  // ACT_MACRO or ACT_TEXT
+  int nr_pending;
+} kb_macro_t;
+
+/**
+ * Report generator, the consumer of the key events
+ */
+typedef struct {
+  const kb_hal_t *hal;
+  kb_layers_t layers;
+  kb_combo_state_t combo;
+  kb_taphold_t taphold;
+  kb_leader_state_t leader;
+  const kb_keymap_t *next_keymap;       // keymap to swap in, NULL if none
+  bool is_swap_release_all;             // swap it without waiting
+  kb_macro_t macro;
+  kb_unicode_mode_t unicode_mode;
+  uint32_t key_rows[KB_NR_COLS];
+  kb_action_t actions[KB_NR_COLS][KB_NR_ROWS];  // resolved on press
+  kb_report_t report;                   // reports of the pressed keys
+  kb_queued_report_t queue[KB_REPORT_QUEUE_SIZE];
+  int queue_head;
+  int nr_queued;
+  bool is_state_held;                   // the key state found the queue full
+  uint64_t lasthid;                     // last queued 6KRO report
+  uint8_t lastnkro[KB_NKRO_REPORT_LEN]; // last queued NKRO report
+  bool last_is_nkro;
+  uint16_t lasthotkey;                  // last queued consumer usage
+} kb_reporter_t;
+
+/**
+ * One trackpoint packet: buttons, dx, dy
+ */
+typedef struct {
+  char data[3];
+} ps2_packet_t;
+
+/**
+ * Trackpoint state across reports
+ */
+typedef struct {
+  const kb_hal_t *hal;
+  bool is_midkey;
+  bool is_pan;
+} kb_mouse_t;
+
+/****************************************************************
+ * 
+ *  Public interface
+ * 
+ ****************************************************************/
+
+/**
+ * Initialize the scanner, all keys released
+ * @param sc scanner
+ * @param hal hardware
+ * @param events ring to push the key events to
+ * @param algo debounce algorithm
+ * @param debounce_us debounce time
+ */
+void kb_scanner_init(kb_scanner_t *sc, const kb_hal_t *hal,
+  kb_event_ring_t *events, debounce_algo_t algo, uint32_t debounce_us);
+
+/**
+ * Sample the matrix once and push its key events. A transition that does
+ * not fit in the ring is retried on the next scan.
+ * @param sc scanner
+ * @return true if any key is pressed, ambiguous ones included
+ */
+bool kb_scanner_scan(kb_scanner_t *sc);
+
+/**
+ * Build the keyboard & consumer reports from the key state. The 6KRO and
+ * NKRO keyboard reports are built together so either can be sent.
+ * @param key_rows pressed keys, rows of each column
+ * @param actions action of each pressed key
+ * @param report output
+ */
+void kb_build_report(const uint32_t key_rows[KB_NR_COLS],
+  const kb_action_t actions[KB_NR_COLS][KB_NR_ROWS], kb_report_t *report);
+
+/**
+ * Initialize the report generator, all keys released
+ * @param rp report generator
+ * @param hal hardware
+ * @param km keymap
+ */
+void kb_reporter_init(kb_reporter_t *rp, const kb_hal_t *hal,
+  const kb_keymap_t *km);
+
+/**
+ * Set the tap-hold timing, the defaults are a 200 ms tapping term with
+ * permissive hold
+ * @param rp report generator
+ * @param cfg tap-hold timing
+ */
+void kb_reporter_set_taphold(kb_reporter_t *rp, const kb_taphold_cfg_t *cfg);
+
+/**
+ * Enable the combos
+ * @param rp report generator
+ * @param cs combos, NULL to disable them
+ * @param term_us time for all the keys of a combo to go down, 0 for the
+ *   default of 50 ms
+ */
+void kb_reporter_set_combos(kb_reporter_t *rp, const kb_combos_t *cs,
+  uint32_t term_us);
+
+/**
+ * Set the Unicode input method of the host for ACT_TEXT, UNICODE_LINUX
+ * by default
+ * @param rp report generator
+ * @param mode input method
+ */
+void kb_reporter_set_unicode(kb_reporter_t *rp, kb_unicode_mode_t mode);
+
+/**
+ * Enable the leader sequences
+ * @param rp report generator
+ * @param ld sequence matcher, NULL to disable them
+ * @param timeout_us time for the next key of a sequence, 0 for the
+ *   default of 1 s
+ */
+void kb_reporter_set_leader(kb_reporter_t *rp, kb_leader_t *ld,
+  uint32_t timeout_us);
+
+/**
+ * Swap the keymap between two key events. The swap waits until no key is
+ * held, so that a key never goes down with one keymap and up with the
+ * other, or with is_release_all it releases the keys held instead.
+ * Takes no lock: call it from one task at a time, and keep the keymap in
+ * use untouched until kb_reporter_is_swap_pending() turns false.
+ * @param rp report generator
+ * @param km keymap
+ * @param is_release_all release the keys held rather than wait
+ * @return false if the previous swap is still pending
+ */
+bool kb_reporter_swap_keymap(kb_reporter_t *rp, const kb_keymap_t *km,
+  bool is_release_all);
+
+/**
+ * Whether a keymap swap is still pending
+ * @param rp report generator
+ */
+bool kb_reporter_is_swap_pending(const kb_reporter_t *rp);
+
+/**
+ * Apply one key event and send the reports that change. A key is resolved
+ * through the layers when pressed and keeps that action until released.
+ * The Fn button holds KB_LAYER_FN. Events after an undecided tap-hold key
+ * are held back until it is decided, and so are the presses that may
+ * still make a combo. The keys after the leader key are swallowed until
+ * they make a sequence or none. The keyboard and consumer reports go
+ * through the report queue, see kb_reporter_flush.
+ * @param rp report generator
+ * @param ev key event
+ */
+void kb_reporter_apply(kb_reporter_t *rp, const kb_event_t *ev);
+
+/**
+ * Let time pass without key events, so that the keys of an incomplete
+ * combo go out as themselves after the combo term, a tap-hold key held
+ * for the tapping term becomes a hold, a leader sequence without a next
+ * key ends, a pending keymap swap is done if it can be, and the report
+ * queue is flushed
+ * @param rp report generator
+ * @param now_us current time, on the clock of the key events
+ */
+void kb_reporter_tick(kb_reporter_t *rp, uint32_t now_us);
+
+/**
+ * Send the queued keyboard and consumer reports in order while the sink
+ * is ready, one report per key state so that no press or release is
+ * merged away. The macro or text being played is expanded into the queue
+ * as it drains. Call it again whenever the sink becomes ready.
+ * @param rp report generator
+ */
+void kb_reporter_flush(kb_reporter_t *rp);
+
+/**
+ * Whether the report queue has room for the reports of another key
+ * event: half of it, which macros never fill. Check it before taking each
+ * event, so that a stalled sink holds the events back instead. Past a
+ * full queue the latest key state waits for a free entry, and the states
+ * in between are merged.
+ * @param rp report generator
+ */
+bool kb_reporter_is_ready(const kb_reporter_t *rp);
+
+/**
+ * Send the last keyboard report again, which changes nothing on the host,
+ * as a keepalive. Only done when every queued report has been sent.
+ * @param rp report generator
+ * @return true if the report was sent
+ */
+bool kb_reporter_resend(kb_reporter_t *rp);
+
+/**
+ * Read one trackpoint packet from the PS/2 byte source
+ * @param hal hardware
+ * @param pkt output
+ * @return false if nothing is pending or the bytes are out of frame, in
+ *   which case the input is flushed
+ */
+bool kb_ps2_read_packet(const kb_hal_t *hal, ps2_packet_t *pkt);
+
+/**
+ * Initialize the trackpoint state
+ * @param m trackpoint state
+ * @param hal hardware
+ */
+void kb_mouse_init(kb_mouse_t *m, const kb_hal_t *hal);
+
+/**
+ * Send the merged trackpoint packets as one mouse report
+ * @param m trackpoint state
+ * @param buttons buttons of all the merged packets
+ * @param dx summed x motion
+ * @param dy summed y motion, downwards positive
+ * @param is_fn_pressed Fn state, pans with USE_FN_TRACKPOINT_PAN
+ */
+void kb_mouse_report(kb_mouse_t *m, uint8_t buttons, int8_t dx, int8_t dy,
+  bool is_fn_pressed);
+
+#endif
@@ -0,0 +1,82 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Hardware boundary of kb_core
+ *
+ * The keyboard core reaches the matrix, the clock, the trackpoint and the
+ * hosts only through these callbacks. The firmware implements them on top
+ * of the GPIOs, esp_timer, UART1 and the USB/BLE HID senders, the host
+ * build on top of a simulated matrix, see host/kb_hal_sim.h.
+ */
+#ifndef MY_KB_HAL_H
+#define MY_KB_HAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "keymap.h"
+
+typedef struct {
+  void *ctx;  // passed to every callback
+
+  /**
+   * Matrix sampler
+   * @param col_rows output, rows of each column, Fn in KB_FN_MASK of column 0
+   */
+  void (*read_matrix)(void *ctx, uint32_t col_rows[KB_NR_COLS]);
+
+  /**
+   * Clock
+   */
+  uint32_t (*now_us)(void *ctx);
+  void (*delay_ms)(void *ctx, uint32_t ms);
+
+  /**
+   * PS/2 byte source
+   * @param buf output
+   * @param len bytes wanted
+   * @param timeout_ms time to wait for them
+   * @return number of bytes read
+   */
+  int (*ps2_read)(void *ctx, uint8_t *buf, int len, uint32_t timeout_ms);
+  void (*ps2_flush)(void *ctx);
+
+  /**
+   * Report sink. The keyboard report is KB_NKRO_REPORT_LEN bytes if
+   * is_nkro, else the 8-byte boot layout. is_keyboard_ready tells whether
+   * send_keyboard and send_consumer take a report now without waiting,
+   * both kinds are queued in order until then.
+   */
+  bool (*is_nkro)(void *ctx);
+  bool (*is_keyboard_ready)(void *ctx);
+  void (*send_keyboard)(void *ctx, bool is_nkro, uint8_t *report);
+  void (*send_consumer)(void *ctx, uint16_t usage);
+  void (*send_mouse)(void *ctx, uint8_t buttons, int8_t dx, int8_t dy,
+    int8_t vert, int8_t hori);
+
+  /**
+   * Local side effects of the keys: lock key LEDs, since Win10 won't
+   * report them on BLE, and the Fn functions
+   */
+  void (*lock_key)(void *ctx, uint8_t hidkey);
+  void (*do_fnfunc)(void *ctx, fn_function_t fncode);
+} kb_hal_t;
+
+#endif
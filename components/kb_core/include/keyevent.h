@@ -0,0 +1,66 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Lock-free single-producer single-consumer ring of key events, from the
+ * matrix scanner to the report generator
+ */
+#ifndef MY_KEYEVENT_H
+#define MY_KEYEVENT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// must be a power of 2
+#define KB_EVENT_RING_SIZE 64
+
+/**
+ * One key transition
+ */
+typedef struct {
+  uint32_t time_us;   // Scan time of the transition
+  uint8_t col;        // Scan code 1
+  uint8_t row;        // Scan code 2
+  bool is_press;      // Press or release
+} kb_event_t;
+
+typedef struct {
+  kb_event_t buf[KB_EVENT_RING_SIZE];
+  uint32_t head;      // Next slot to write, only written by the producer
+  uint32_t tail;      // Next slot to read, only written by the consumer
+} kb_event_ring_t;
+
+/**
+ * Push one event. Producer side only.
+ * @param ring event ring
+ * @param ev event
+ * @return false if the ring is full
+ */
+bool kb_event_push(kb_event_ring_t *ring, const kb_event_t *ev);
+
+/**
+ * Pop the oldest event. Consumer side only.
+ * @param ring event ring
+ * @param ev output
+ * @return false if the ring is empty
+ */
+bool kb_event_pop(kb_event_ring_t *ring, kb_event_t *ev);
+
+#endif
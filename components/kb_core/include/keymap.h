@@ -32,6 +32,98 @@
 
 #include <stdint.h>
 
+/**
+ * Matrix size: 8 columns selected by the 74HC138, 18 sensed rows.
+ */
+#define KB_NR_COLS 8
+#define KB_NR_ROWS 18
+
+// bit j of a row mask is set if row j is pulled low, i.e. the key is pressed
+#define KB_ROW_MASK   ((1u << KB_NR_ROWS) - 1)
+
+// The Fn button is carried in an unused bit of column 0 so that it goes
+// through the same per-key processing as the matrix
+#define KB_FN_ROW     31
+#define KB_FN_MASK    (1u << KB_FN_ROW)
+
+/**
+ * Layers of the keymap, a higher layer overrides the lower ones. The Fn
+ * button holds KB_LAYER_FN, Fn lock toggles KB_LAYER_FNLOCK, and both
+ * together bring up KB_LAYER_FN_FNLOCK.
+ */
+#define KB_NR_LAYERS 8
+enum {
+  KB_LAYER_BASE = 0,
+  KB_LAYER_FNLOCK,
+  KB_LAYER_FN,
+  KB_LAYER_FN_FNLOCK,
+  KB_LAYER_USER0,
+  KB_LAYER_USER1,
+  KB_LAYER_USER2,
+  KB_LAYER_USER3,
+};
+
+/**
+ * Key action in a layer: kind in the high 4 bits, argument in the low 12.
+ * A zero action is transparent so that unset entries fall through.
+ */
+typedef uint16_t kb_action_t;
+
+#define ACT_KIND(act)       ((act) >> 12)
+#define ACT_ARG(act)        ((act) & 0x0fff)
+
+#define ACT_KIND_TRNS       0x0   // use the layer below
+#define ACT_KIND_KEY        0x1   // keyboard usage
+#define ACT_KIND_CONSUMER   0x2   // consumer usage
+#define ACT_KIND_FN         0x3   // fn_function_t
+#define ACT_KIND_LAYER_MO   0x4   // layer on while held
+#define ACT_KIND_LAYER_TG   0x5   // toggle layer on press
+#define ACT_KIND_LAYER_OS   0x6   // layer on for the next key
+#define ACT_KIND_MOD_TAP    0x7   // modifier when held, key when tapped
+#define ACT_KIND_LAYER_TAP  0x8   // layer when held, key when tapped
+#define ACT_KIND_MACRO      0x9   // play a macro of macrotbl on press
+#define ACT_KIND_LEADER     0xa   // start a sequence of leadertbl on press
+#define ACT_KIND_TEXT       0xb   // type a text of texttbl on press
+#define ACT_KIND_NONE       0xf   // nothing, hides the layers below
+
+#define ACT_TRNS            0x0000
+#define ACT_NONE            0xf000
+#define ACT_KEY(hid)        (0x1000 | (hid))
+#define ACT_CONSUMER(usage) (0x2000 | (usage))
+#define ACT_FN(fncode)      (0x3000 | (fncode))
+#define ACT_MO(layer)       (0x4000 | (layer))
+#define ACT_TG(layer)       (0x5000 | (layer))
+#define ACT_OS(layer)       (0x6000 | (layer))
+// mod: 0~7 for KEY_LEFTCTRL~KEY_RIGHTMETA
+#define ACT_MT(mod, hid)    (0x7000 | ((mod) << 8) | (hid))
+#define ACT_LT(layer, hid)  (0x8000 | ((layer) << 8) | (hid))
+#define ACT_MACRO(id)       (0x9000 | (id))
+#define ACT_LEADER          0xa000
+#define ACT_TEXT(id)        (0xb000 | (id))
+
+// tap-hold actions: the key when tapped, the modifier/layer when held
+#define ACT_TAP_KEY(act)    ((act) & 0x00ff)
+#define ACT_HOLD_ARG(act)   (((act) >> 8) & 0x0f)
+
+/**
+ * Macro step: op in the high 4 bits, keyboard usage in the low 8. A macro
+ * is a list of steps ended by MACRO_END, see MACRO_ITEMS in keymap-*.c.
+ */
+typedef uint16_t kb_macro_step_t;
+
+#define MACRO_OP(step)      ((step) >> 12)
+#define MACRO_KEY(step)     ((step) & 0x00ff)
+
+#define MACRO_OP_END        0x0   // release what the macro holds
+#define MACRO_OP_DOWN       0x1   // press the key
+#define MACRO_OP_UP         0x2   // release the key
+#define MACRO_OP_TAP        0x3   // press and release the key
+
+#define MACRO_END           0x0000
+#define MACRO_DOWN(hid)     (0x1000 | (hid))
+#define MACRO_UP(hid)       (0x2000 | (hid))
+#define MACRO_TAP(hid)      (0x3000 | (hid))
+
 /**
  * Modifier masks - used for the first byte in the HID report.
  * NOTE: The second byte in the report is reserved, 0x00
@@ -388,6 +480,85 @@ typedef struct {
   fn_function_t fncode;  // fn function type
 } fn_keytable_t;
 
+/**
+ * User layer keytable structure
+ */
+typedef struct {
+  uint8_t layer;         // KB_LAYER_USER0 ~ KB_LAYER_USER3
+  uint8_t scan1, scan2;  // scan code
+  kb_action_t action;    // action, e.g. ACT_KEY(KEY_HOME) or ACT_MO(layer)
+} usr_keytable_t;
+
+/**
+ * Combo keytable structure: keys pressed together within the combo term
+ * act as another key
+ */
+#define KB_COMBO_MAX_KEYS 4
+
+#define COMBO_KEY(scan1, scan2) (((scan1) << 5) | (scan2))
+#define COMBO_KEY_COL(key)      ((key) >> 5)
+#define COMBO_KEY_ROW(key)      ((key) & 0x1f)
+
+typedef struct {
+  kb_action_t action;    // action, e.g. ACT_KEY(KEY_ESC)
+  uint8_t nr_keys;
+  uint8_t keys[KB_COMBO_MAX_KEYS];  // COMBO_KEY(scan1, scan2)
+} combo_keytable_t;
+
+/**
+ * Leader sequence keytable structure: the leader key, then these keys one
+ * after another act as another key. The table is sorted, which makes it a
+ * flattened trie, see leader.h.
+ */
+#define KB_LEADER_MAX_KEYS 4
+
+typedef struct {
+  kb_action_t action;    // action, e.g. ACT_FN(FN_BACKLIGHT)
+  uint8_t nr_keys;
+  uint8_t keys[KB_LEADER_MAX_KEYS];  // keyboard usages, e.g. KEY_B
+} leader_keytable_t;
+
+/**
+ * Keymap tables of one keyboard model, see keymap-*.c. The dense lookup
+ * planes are generated from the same tables, indexed by [scan1][scan2].
+ */
+typedef struct {
+  const char *name;                 // e.g. "E580"
+  uint8_t nr_rows;                  // rows on the FPC, 18 with a numpad
+  const keytable_t *kbtbl;          // sparse tables
+  const fn_keytable_t *fntbl;
+  const usr_keytable_t *usrtbl;
+  const combo_keytable_t *combotbl;
+  const leader_keytable_t *leadertbl;
+  const kb_macro_step_t *const *macrotbl;  // indexed by ACT_MACRO
+  const uint32_t *const *texttbl;          // indexed by ACT_TEXT
+  int nr_keys;
+  int nr_fn_keys;
+  int nr_usr_keys;
+  int nr_combos;
+  int nr_leaders;
+  int nr_macros;
+  int nr_texts;
+  const uint8_t (*hid_plane)[KB_NR_ROWS];
+  const fn_keytable_t (*fn_plane)[KB_NR_ROWS];
+} kb_keymap_model_t;
+
+/**
+ * Get the keymap model in use, the one built with USE_KEYMAP_* until
+ * keymap_select_model()
+ * @return keymap model
+ */
+const kb_keymap_model_t *keymap_get_model(void);
+
+/**
+ * Select the keymap model of a keyboard with the given number of rows.
+ * Models without a keymap yet are skipped, and the model in use is kept
+ * if none fits. Select before building anything from the tables.
+ * @param nr_rows rows on the FPC
+ * @return keymap model in use
+ */
+const kb_keymap_model_t *keymap_select_model(unsigned nr_rows);
+
 /**
  * search the USB HID key based on scan code
  * @param scan1 scan code 1
@@ -402,6 +573,6 @@ int search_hid_key(unsigned scan1, unsigned scan2);
  * @param scan2 scan code 2
  * @return NULL if not found
  */
-fn_keytable_t* search_fn(unsigned scan1, unsigned scan2);
+const fn_keytable_t* search_fn(unsigned scan1, unsigned scan2);
 
 #endif
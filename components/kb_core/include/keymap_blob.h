@@ -0,0 +1,100 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Keymap blob
+ *
+ * A keymap stored outside the firmware: a 32-byte header followed by the
+ * kb_keymap_t planes as they are laid out in memory, little-endian. The
+ * planes are checked in place, e.g. in a memory-mapped flash partition.
+ * The firmware then copies them into RAM and unmaps the partition, see
+ * keymap_store_load(), so that the partition can be rewritten while the
+ * keymap is in use.
+ */
+#ifndef MY_KEYMAP_BLOB_H
+#define MY_KEYMAP_BLOB_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "layer.h"
+
+#define KB_KEYMAP_BLOB_MAGIC    0x504d424bu   // "KBMP"
+#define KB_KEYMAP_BLOB_VERSION  1
+#define KB_KEYMAP_BLOB_NAME_LEN 16
+
+typedef struct {
+  uint32_t magic;                       // KB_KEYMAP_BLOB_MAGIC
+  uint16_t version;                     // KB_KEYMAP_BLOB_VERSION
+  uint8_t nr_layers;                    // KB_NR_LAYERS
+  uint8_t nr_cols;                      // KB_NR_COLS
+  uint8_t nr_rows;                      // KB_NR_ROWS
+  uint8_t reserved[3];
+  uint32_t crc32;                       // CRC-32 of the planes
+  char name[KB_KEYMAP_BLOB_NAME_LEN];   // model the keymap is for, e.g. "e580", NUL padded
+} kb_keymap_blob_hdr_t;
+
+static_assert(sizeof(kb_keymap_blob_hdr_t) == 32, "blob header is 32 bytes");
+
+#define KB_KEYMAP_BLOB_SIZE (sizeof(kb_keymap_blob_hdr_t) + sizeof(kb_keymap_t))
+
+/**
+ * CRC-32 (IEEE 802.3), as zlib's crc32()
+ * @param crc CRC so far, 0 to start
+ * @param buf data
+ * @param len data length
+ * @return updated CRC
+ */
+uint32_t kb_crc32(uint32_t crc, const void *buf, size_t len);
+
+/**
+ * Validate a keymap blob
+ * @param blob blob, at least 2-byte aligned
+ * @param len bytes available at blob
+ * @return the planes inside the blob, or NULL if it is not a valid keymap
+ *   of this version and matrix size, or holds an action that is not valid,
+ *   see kb_action_is_valid()
+ */
+const kb_keymap_t *kb_keymap_blob_check(const void *blob, size_t len);
+
+/**
+ * Whether a blob is made for a keyboard model, whose macros, texts, combos
+ * and leader sequences its planes refer to. The names are compared
+ * without case, e.g. "e580" is for the "E580".
+ * @param blob blob header, see kb_keymap_blob_check()
+ * @param name keyboard model, see kb_keymap_model_t
+ * @return false if the name is another one, or too long for the header
+ */
+bool kb_keymap_blob_is_for_model(const void *blob, const char *name);
+
+/**
+ * Serialize a keymap into a blob
+ * @param km keymap
+ * @param name keyboard model the keymap is for, see kb_keymap_model_t,
+ *   truncated to KB_KEYMAP_BLOB_NAME_LEN
+ * @param buf output
+ * @param len size of buf
+ * @return KB_KEYMAP_BLOB_SIZE, or 0 if buf is too small
+ */
+size_t kb_keymap_blob_build(const kb_keymap_t *km, const char *name,
+  void *buf, size_t len);
+
+#endif
@@ -0,0 +1,126 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Layered keymap
+ *
+ * Every layer is a dense [col][row] plane of actions, built once from the
+ * sparse tables of keymap-*.c, so resolving a key only looks at the active
+ * layers from the top down until an entry is not transparent.
+ */
+#ifndef MY_LAYER_H
+#define MY_LAYER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "keymap.h"
+
+typedef struct {
+  kb_action_t plane[KB_NR_LAYERS][KB_NR_COLS][KB_NR_ROWS];
+} kb_keymap_t;
+
+typedef struct {
+  const kb_keymap_t *keymap;
+  uint8_t nr_held[KB_NR_LAYERS];  // momentary keys held per layer
+  uint8_t toggled;                // toggled layers
+  uint8_t oneshot;                // layers waiting for their next key
+  uint8_t active;                 // active layers, recomputed on change
+} kb_layers_t;
+
+/**
+ * Build the layer planes from kbtbl, fntbl and usrtbl of the keymap
+ * model in use
+ * @param km output
+ */
+void kb_keymap_build(kb_keymap_t *km);
+
+/**
+ * Whether an action can be carried out as it is: a keyboard usage fits
+ * in 8 bits, a layer exists, and a mod-tap key holds one of the eight
+ * modifiers. Macros and texts are checked against the tables when played.
+ * @param act action
+ */
+bool kb_action_is_valid(kb_action_t act);
+
+/**
+ * Whether every action in the planes is valid, see kb_action_is_valid()
+ * @param km keymap
+ */
+bool kb_keymap_is_valid(const kb_keymap_t *km);
+
+/**
+ * Reset the layer state, only the base layer active
+ * @param ly layer state
+ * @param km keymap
+ */
+void kb_layers_init(kb_layers_t *ly, const kb_keymap_t *km);
+
+/**
+ * Resolve a key through the active layers
+ * @param ly layer state
+ * @param col scan code 1
+ * @param row scan code 2
+ * @return action of the highest active layer that is not transparent
+ */
+kb_action_t kb_layers_resolve(const kb_layers_t *ly, unsigned col, unsigned row);
+
+/**
+ * Press or release a momentary layer key
+ * @param ly layer state
+ * @param layer layer
+ * @param is_press press or release
+ */
+void kb_layers_hold(kb_layers_t *ly, unsigned layer, bool is_press);
+
+/**
+ * Toggle a layer
+ * @param ly layer state
+ * @param layer layer
+ */
+void kb_layers_toggle(kb_layers_t *ly, unsigned layer);
+
+/**
+ * Turn a layer on for the next key that is not a layer key
+ * @param ly layer state
+ * @param layer layer
+ */
+void kb_layers_oneshot(kb_layers_t *ly, unsigned layer);
+
+/**
+ * Drop the one-shot layers once a key has been resolved through them
+ * @param ly layer state
+ */
+void kb_layers_oneshot_done(kb_layers_t *ly);
+
+/**
+ * Drop the momentary and one-shot layers as if their keys were released,
+ * the toggled layers stay
+ * @param ly layer state
+ */
+void kb_layers_release_all(kb_layers_t *ly);
+
+/**
+ * Whether a layer is active
+ * @param ly layer state
+ * @param layer layer
+ */
+bool kb_layers_is_on(const kb_layers_t *ly, unsigned layer);
+
+#endif
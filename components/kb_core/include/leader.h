@@ -0,0 +1,88 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Leader sequences: the leader key, then a few keys one after another
+ *
+ * leadertbl is kept sorted by the keys, a sequence before the longer ones
+ * it begins. Every trie node, i.e. the sequences that begin with the keys
+ * typed so far, is then a contiguous range of it, and a child is found by
+ * a binary search on the next key. The trie stays in flash and the
+ * matcher is a range and a depth, whatever the number of sequences.
+ */
+#ifndef MY_LEADER_H
+#define MY_LEADER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "keymap.h"
+
+/**
+ * Outcome of a key fed to the matcher
+ */
+typedef enum {
+  LEADER_NONE = 0,  // no sequence goes on with the key
+  LEADER_MORE,      // more keys may still come
+  LEADER_MATCH,     // a sequence ends here, and no longer one begins with it
+} kb_leader_result_t;
+
+/**
+ * Sequence matcher
+ */
+typedef struct {
+  const leader_keytable_t *tbl;   // NULL if leadertbl is not sorted
+  int nr_leaders;
+  int lo, hi;                     // sequences beginning with the keys so far
+  int depth;                      // keys so far
+} kb_leader_t;
+
+/**
+ * Bind the matcher to the leadertbl of the keymap model in use
+ * @param ld output
+ * @return false if leadertbl is not sorted or has a bad sequence, in
+ *   which case nothing matches
+ */
+bool kb_leader_init(kb_leader_t *ld);
+
+/**
+ * Start matching, after the leader key
+ * @param ld matcher
+ */
+void kb_leader_start(kb_leader_t *ld);
+
+/**
+ * Feed the next key of the sequence
+ * @param ld matcher
+ * @param hidkey keyboard usage
+ * @param act output, action of the sequence on LEADER_MATCH
+ * @return see kb_leader_result_t
+ */
+kb_leader_result_t kb_leader_feed(kb_leader_t *ld, uint8_t hidkey,
+  kb_action_t *act);
+
+/**
+ * Match the keys so far as they are, when no more keys come
+ * @param ld matcher
+ * @param act output
+ * @return true if a sequence ends here
+ */
+bool kb_leader_end(const kb_leader_t *ld, kb_action_t *act);
+
+#endif
@@ -0,0 +1,85 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Idle probe of the matrix
+ *
+ * While nobody types, the matrix is not scanned. One column at a time is
+ * selected with the row interrupts armed, and the first row edge goes back
+ * to full-rate scanning. A press only raises an edge on its own column, so
+ * every dwell ends with a sweep of the whole matrix, which bounds the
+ * first-key latency to one dwell whatever the column of the press. The
+ * dwell can then be as long as the idle scan interval, and the CPU only
+ * wakes up once per dwell. The caller owns the interrupts and the waiting.
+ */
+#ifndef MY_PROBE_H
+#define MY_PROBE_H
+
+#include <stdbool.h>
+#include "keymap.h"
+#include "kb_hal.h"
+
+typedef struct {
+  bool is_probing;
+  bool is_woken;      // the last probe ended on a row edge
+  int col;            // column to select for the next dwell
+} kb_probe_t;
+
+/**
+ * Reset the probe, scanning
+ * @param pb probe state
+ */
+void kb_probe_init(kb_probe_t *pb);
+
+/**
+ * Decide after a full scan whether to probe instead of scanning
+ * @param pb probe state
+ * @param is_idle the power state allows probing
+ * @param is_key_pressed a key is pressed in the scan
+ * @return true if probing starts
+ */
+bool kb_probe_start(kb_probe_t *pb, bool is_idle, bool is_key_pressed);
+
+/**
+ * Column to select for the next dwell, the columns go round
+ * @param pb probe state
+ * @return column number 0~7
+ */
+int kb_probe_next_col(kb_probe_t *pb);
+
+/**
+ * Sweep the matrix at the end of a dwell without a row edge, for the
+ * presses on the other columns
+ * @param hal hardware
+ * @return true if a key or Fn is pressed
+ */
+bool kb_probe_sweep(const kb_hal_t *hal);
+
+/**
+ * Account one dwell on the column selected
+ * @param pb probe state
+ * @param is_row_edge a row went low during the dwell, or the sweep after
+ *   it found a key
+ * @param is_idle the power state still allows probing
+ * @return true while probing goes on
+ */
+bool kb_probe_step(kb_probe_t *pb, bool is_row_edge, bool is_idle);
+
+#endif
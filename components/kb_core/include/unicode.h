@@ -0,0 +1,66 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Text input: codepoints as key sequences the host turns back into text
+ *
+ * Letters, digits and space are typed as their keys, found through the
+ * ascii column of kbtbl. Other codepoints go through the input method of
+ * the host OS, which has to be set up for it, see kb_unicode_mode_t.
+ */
+#ifndef MY_UNICODE_H
+#define MY_UNICODE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "keymap.h"
+
+// steps of one codepoint, MACRO_END included
+#define KB_UNICODE_MAX_STEPS 16
+
+/**
+ * Unicode input method of the host
+ */
+typedef enum {
+  UNICODE_LINUX = 0,    // Ctrl+Shift+U, hex, space (IBus, GTK)
+  UNICODE_WINDOWS_HEX,  // Alt held, keypad +, hex (EnableHexNumpad set)
+  UNICODE_WINDOWS_ALT,  // Alt held, decimal on the keypad (Alt code)
+  UNICODE_MACOS,        // Option held, UTF-16 hex (Unicode Hex Input)
+} kb_unicode_mode_t;
+
+/**
+ * Find the key of a character through the ascii column of kbtbl, the
+ * keypad left out
+ * @param c character
+ * @return keyboard usage, -1 if none
+ */
+int kb_ascii_to_hid(int c);
+
+/**
+ * Encode one codepoint as macro steps
+ * @param mode input method of the host
+ * @param cp codepoint
+ * @param steps output, ended by MACRO_END
+ * @return false if the codepoint is invalid or a key is missing
+ */
+bool kb_unicode_encode(kb_unicode_mode_t mode, uint32_t cp,
+  kb_macro_step_t steps[KB_UNICODE_MAX_STEPS]);
+
+#endif
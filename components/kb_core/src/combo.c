@@ -0,0 +1,105 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "combo.h"
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+void kb_combos_build(kb_combos_t *cs)
+{
+  const kb_keymap_model_t *model = keymap_get_model();
+
+  memset(cs, 0, sizeof(*cs));
+
+  for (int i = 0; i < model->nr_combos && cs->nr_combos < KB_MAX_COMBOS; i++) {
+    const combo_keytable_t *item = &model->combotbl[i];
+    kb_combo_t *combo = &cs->combo[cs->nr_combos];
+    bool is_valid = item->nr_keys >= 2 && item->nr_keys <= KB_COMBO_MAX_KEYS;
+
+    memset(combo, 0, sizeof(*combo));
+    for (int k = 0; k < item->nr_keys && is_valid; k++) {
+      int col = COMBO_KEY_COL(item->keys[k]);
+      int row = COMBO_KEY_ROW(item->keys[k]);
+      is_valid = col < KB_NR_COLS && row < KB_NR_ROWS;
+      if (is_valid) {
+        combo->mask[col] |= 1u << row;
+      }
+    }
+    if (!is_valid) {
+      continue;
+    }
+    combo->action = item->action;
+    for (int k = 0; k < KB_NR_COLS; k++) {
+      cs->keys[k] |= combo->mask[k];
+    }
+    cs->nr_combos++;
+  }
+}
+
+bool kb_combos_has_key(const kb_combos_t *cs, int col, int row)
+{
+  return (cs->keys[col] >> row) & 1;
+}
+
+int kb_combos_match(const kb_combos_t *cs, const uint32_t pressed[KB_NR_COLS],
+  bool *is_partial)
+{
+  int match = -1;
+  int col = 0;
+
+  // a combo without the first pressed key can neither match nor grow into
+  // one, which rules out most of them with a single load
+  while (col < KB_NR_COLS && pressed[col] == 0) {
+    col++;
+  }
+  if (col == KB_NR_COLS) {
+    *is_partial = cs->nr_combos > 0;
+    return -1;
+  }
+  uint32_t first = pressed[col] & -pressed[col];
+
+  *is_partial = false;
+  for (int i = 0; i < cs->nr_combos; i++) {
+    const uint32_t *mask = cs->combo[i].mask;
+    if ((mask[col] & first) == 0) {
+      continue;
+    }
+    uint32_t extra = 0;
+    uint32_t missing = 0;
+    for (int k = 0; k < KB_NR_COLS; k++) {
+      extra |= pressed[k] & ~mask[k];
+      missing |= mask[k] & ~pressed[k];
+    }
+    if (extra != 0) {
+      continue;
+    }
+    if (missing != 0) {
+      *is_partial = true;
+    } else if (match < 0) {
+      match = i;
+    }
+  }
+  return match;
+}
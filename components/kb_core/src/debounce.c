@@ -0,0 +1,137 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "debounce.h"
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+// integrator saturates at 3 quanta
+#define DEBOUNCE_NR_QUANTA 3
+
+/**
+ * Saturating increment of the integrators selected by m
+ */
+static inline void cnt_inc(uint32_t *b0, uint32_t *b1, uint32_t m)
+{
+  uint32_t inc = m & ~(*b1 & *b0);
+  *b1 ^= inc & *b0;
+  *b0 ^= inc;
+}
+
+/**
+ * Saturating decrement of the integrators selected by m
+ */
+static inline void cnt_dec(uint32_t *b0, uint32_t *b1, uint32_t m)
+{
+  uint32_t dec = m & (*b1 | *b0);
+  *b1 ^= dec & ~*b0;
+  *b0 ^= dec;
+}
+
+/**
+ * Advance the integrators of the keys in `pending` by k quanta, flip the
+ * state of those which saturate and restart the others. Only the keys in
+ * `steady` advance, a key that just started to differ has not been seen
+ * so for any time yet.
+ */
+static inline void defer_update(debounce_t *db, int i, uint32_t pending,
+  uint32_t steady, unsigned k)
+{
+  db->cnt0[i] &= pending;
+  db->cnt1[i] &= pending;
+  for (unsigned n = 0; n < k; n++) {
+    cnt_inc(&db->cnt0[i], &db->cnt1[i], pending & steady);
+  }
+  uint32_t done = db->cnt0[i] & db->cnt1[i];
+  db->state[i] ^= done;
+  db->cnt0[i] &= ~done;
+  db->cnt1[i] &= ~done;
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+void debounce_init(debounce_t *db, debounce_algo_t algo,
+  uint32_t debounce_us, uint32_t now_us)
+{
+  memset(db, 0, sizeof(*db));
+  db->algo = algo;
+  db->quantum_us = debounce_us / DEBOUNCE_NR_QUANTA;
+  if (db->quantum_us == 0) db->quantum_us = 1;
+  db->last_us = now_us;
+}
+
+void debounce_update(debounce_t *db, uint32_t rows[KB_NR_COLS], uint32_t now_us)
+{
+  // Number of whole quanta since the last step. Unsigned subtraction keeps
+  // it right across the wrap of now_us.
+  uint32_t elapsed = now_us - db->last_us;
+  unsigned k;
+  bool is_slow = elapsed >= DEBOUNCE_NR_QUANTA * db->quantum_us;
+  if (is_slow) {
+    k = DEBOUNCE_NR_QUANTA;
+    db->last_us = now_us;
+  } else {
+    k = elapsed / db->quantum_us;
+    db->last_us += k * db->quantum_us;
+  }
+
+  for (int i = 0; i < KB_NR_COLS; i++) {
+    uint32_t raw = rows[i];
+    // The time since the last sample only counts for the keys it read at
+    // the same level: the others may have changed just before this sample.
+    // Thus a key is integrated from its first differing sample on. Once a
+    // whole debounce time has passed since the last sample though, the
+    // bounce of a change before it is over, so one sample is taken as is:
+    // waiting for a second one would double the latency of slow scans and
+    // miss the keystrokes shorter than two periods.
+    uint32_t steady = is_slow ? ~0u : ~(raw ^ db->last_raw[i]);
+    db->last_raw[i] = raw;
+
+    switch (db->algo) {
+    case DEBOUNCE_EAGER_PRESS:
+      db->state[i] |= raw;
+      defer_update(db, i, db->state[i] & ~raw, steady, k);
+      break;
+    case DEBOUNCE_DEFER_SYM:
+      defer_update(db, i, db->state[i] ^ raw, steady, k);
+      break;
+    case DEBOUNCE_COUNTER:
+      for (unsigned n = 0; n < k; n++) {
+        cnt_inc(&db->cnt0[i], &db->cnt1[i], raw & steady);
+        cnt_dec(&db->cnt0[i], &db->cnt1[i], ~raw & steady);
+      }
+      // hysteresis: pressed when full, released when empty
+      db->state[i] |= db->cnt0[i] & db->cnt1[i];
+      db->state[i] &= db->cnt0[i] | db->cnt1[i];
+      break;
+    }
+
+    rows[i] = db->state[i];
+  }
+}
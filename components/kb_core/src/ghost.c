@@ -0,0 +1,66 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ghost.h"
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+bool ghost_find(const uint32_t rows[KB_NR_COLS], uint32_t amb[KB_NR_COLS])
+{
+  uint32_t any = 0;
+
+  for (int i = 0; i < KB_NR_COLS; i++) {
+    amb[i] = 0;
+  }
+  // 28 column pairs, a rectangle shows up as two or more shared rows
+  for (int i = 0; i < KB_NR_COLS; i++) {
+    uint32_t rows_i = rows[i] & KB_ROW_MASK;
+    if (rows_i == 0) {
+      continue;
+    }
+    for (int k = i + 1; k < KB_NR_COLS; k++) {
+      uint32_t shared = rows_i & rows[k];
+      // If and only if less than two bits is 1, the following expr will be 0
+      if (shared & (shared - 1)) {
+        amb[i] |= shared;
+        amb[k] |= shared;
+        any |= shared;
+      }
+    }
+  }
+  return any != 0;
+}
+
+bool ghost_resolve(uint32_t rows[KB_NR_COLS], const uint32_t prev[KB_NR_COLS])
+{
+  uint32_t amb[KB_NR_COLS];
+
+  if (!ghost_find(rows, amb)) {
+    return false;
+  }
+  for (int i = 0; i < KB_NR_COLS; i++) {
+    rows[i] = (rows[i] & ~amb[i]) | (prev[i] & amb[i]);
+  }
+  return true;
+}
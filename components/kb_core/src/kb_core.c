@@ -0,0 +1,1070 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "kb_core.h"
+#include "ghost.h"
+
+/****************************************************************
+ * 
+ *  Private Definition
+ * 
+ ****************************************************************/
+
+// #define USE_FN_TRACKPOINT_PAN
+#define SCALE_TRACKPOINT_SPEED
+#define MOUSE_SCALE_MIN 1
+
+#define KB_TAPPING_TERM_US 200000
+
+#define KB_COMBO_TERM_US 50000
+
+#define KB_LEADER_TIMEOUT_US 1000000
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+static void taphold_apply(kb_reporter_t *rp, const kb_event_t *ev);
+
+/**
+ * Scale the trackpoint motion since it may be too slow...
+ * @param d motion
+ * @return scaled motion
+ */
+static int8_t scale_motion(int8_t d)
+{
+#ifdef SCALE_TRACKPOINT_SPEED
+  if (d > MOUSE_SCALE_MIN) d += (d-MOUSE_SCALE_MIN) * 2;
+  else if (d < -MOUSE_SCALE_MIN) d += (d+MOUSE_SCALE_MIN) * 2;
+#endif
+  return d;
+}
+
+/**
+ * Set or clear a key in a report of NKRO layout. The usages past the
+ * modifiers have no bit in it.
+ */
+static void nkro_set_key(uint8_t *nkro, int hidkey, bool is_pressed)
+{
+  uint8_t *byte = &nkro[0];
+  uint8_t mask = 1u << (hidkey & 0x07);
+  if (hidkey < KEY_LEFTCTRL) {
+    byte = &nkro[1 + (hidkey >> 3)];
+  } else if (hidkey > KEY_RIGHTMETA) {
+    return;
+  }
+  if (is_pressed) {
+    *byte |= mask;
+  } else {
+    *byte &= ~mask;
+  }
+}
+
+/**
+ * Keyboard report of the pressed keys and the keys held by the macro
+ * @param rp report generator
+ * @param is_nkro NKRO or 6KRO report
+ * @param buf output, KB_NKRO_REPORT_LEN bytes
+ */
+static void merge_report(const kb_reporter_t *rp, bool is_nkro, uint8_t *buf)
+{
+  const uint8_t *held = rp->macro.held;
+
+  if (is_nkro) {
+    for (int i = 0; i < KB_NKRO_REPORT_LEN; i++) {
+      buf[i] = rp->report.nkro[i] | held[i];
+    }
+    return;
+  }
+
+  memset(buf, 0, KB_NKRO_REPORT_LEN);
+  memcpy(buf, &rp->report.hid, sizeof(rp->report.hid));
+  buf[0] |= held[0];
+  int nr_hidkey = 0;
+  while (nr_hidkey < 6 && buf[2+nr_hidkey] != 0) {
+    nr_hidkey++;
+  }
+  // the macro keys take the free slots
+  for (int i = 1; i < KB_NKRO_REPORT_LEN && nr_hidkey < 6; i++) {
+    for (uint32_t bits = held[i]; bits != 0 && nr_hidkey < 6; bits &= bits - 1) {
+      int hidkey = ((i - 1) << 3) + __builtin_ctz(bits);
+      if (memchr(&buf[2], hidkey, nr_hidkey) == NULL) {
+        buf[2+nr_hidkey] = hidkey;
+        nr_hidkey++;
+      }
+    }
+  }
+}
+
+/**
+ * Take a free entry at the end of the queue
+ * @return NULL if the queue is full
+ */
+static kb_queued_report_t *queue_alloc(kb_reporter_t *rp)
+{
+  if (rp->nr_queued >= KB_REPORT_QUEUE_SIZE) {
+    return NULL;
+  }
+  int i = (rp->queue_head + rp->nr_queued) % KB_REPORT_QUEUE_SIZE;
+  rp->nr_queued++;
+  return &rp->queue[i];
+}
+
+/**
+ * Append a keyboard report to the queue
+ * @return false if the queue is full
+ */
+static bool queue_push(kb_reporter_t *rp, bool is_nkro, const uint8_t *buf)
+{
+  kb_queued_report_t *entry = queue_alloc(rp);
+  if (entry == NULL) {
+    return false;
+  }
+  entry->is_consumer = false;
+  entry->is_nkro = is_nkro;
+  memcpy(entry->buf, buf, KB_NKRO_REPORT_LEN);
+  return true;
+}
+
+/**
+ * Queue the consumer report if the usage differs from the last one queued
+ * @return false if it found the queue full
+ */
+static bool queue_hotkey(kb_reporter_t *rp)
+{
+  if (rp->report.hotkey == rp->lasthotkey) {
+    return true;
+  }
+  kb_queued_report_t *entry = queue_alloc(rp);
+  if (entry == NULL) {
+    return false;
+  }
+  entry->is_consumer = true;
+  entry->hotkey = rp->report.hotkey;
+  rp->lasthotkey = rp->report.hotkey;
+  return true;
+}
+
+/**
+ * Queue the consumer and keyboard reports if the key state differs from
+ * the last one queued. A state that finds the queue full is held back,
+ * never written over a queued one, and queued once an entry is free.
+ */
+static void queue_state(kb_reporter_t *rp)
+{
+  uint8_t buf[KB_NKRO_REPORT_LEN];
+  bool is_nkro = rp->last_is_nkro;
+
+  rp->is_state_held = true;
+  if (!queue_hotkey(rp)) {
+    return;
+  }
+  merge_report(rp, is_nkro, buf);
+  if (is_nkro) {
+    if (memcmp(buf, rp->lastnkro, KB_NKRO_REPORT_LEN) != 0) {
+      if (!queue_push(rp, is_nkro, buf)) {
+        return;
+      }
+      memcpy(rp->lastnkro, buf, KB_NKRO_REPORT_LEN);
+    }
+  } else {
+    uint64_t hid;
+    memcpy(&hid, buf, sizeof(hid));
+    if (hid != rp->lasthid) {
+      if (!queue_push(rp, is_nkro, buf)) {
+        return;
+      }
+      rp->lasthid = hid;
+    }
+  }
+  rp->is_state_held = false;
+}
+
+/**
+ * Expand the macro steps into the report queue, up to half of it so that
+ * the pressed keys always find room
+ */
+static void macro_fill(kb_reporter_t *rp)
+{
+  const kb_keymap_model_t *model = keymap_get_model();
+  kb_macro_t *m = &rp->macro;
+
+  // a step queues at most two reports
+  while (rp->nr_queued + 2 <= KB_REPORT_QUEUE_SIZE / 2) {
+    if (m->step == NULL && m->text != NULL) {
+      uint32_t cp = *m->text++;
+      if (cp == 0) {
+        m->text = NULL;
+      } else if (kb_unicode_encode(rp->unicode_mode, cp, m->text_steps)) {
+        m->step = m->text_steps;
+      }
+      continue;
+    }
+    if (m->step == NULL) {
+      if (m->nr_pending == 0) {
+        return;
+      }
+      kb_action_t act = m->pending[0];
+      if (ACT_KIND(act) == ACT_KIND_TEXT) {
+        m->text = model->texttbl[ACT_ARG(act)];
+      } else {
+        m->step = model->macrotbl[ACT_ARG(act)];
+      }
+      m->nr_pending--;
+      memmove(&m->pending[0], &m->pending[1], m->nr_pending * sizeof(kb_action_t));
+      continue;
+    }
+
+    kb_macro_step_t step = *m->step++;
+    int hidkey = MACRO_KEY(step);
+    switch (MACRO_OP(step)) {
+    case MACRO_OP_DOWN:
+      nkro_set_key(m->held, hidkey, true);
+      queue_state(rp);
+      break;
+    case MACRO_OP_UP:
+      nkro_set_key(m->held, hidkey, false);
+      queue_state(rp);
+      break;
+    case MACRO_OP_TAP:
+      nkro_set_key(m->held, hidkey, true);
+      queue_state(rp);
+      nkro_set_key(m->held, hidkey, false);
+      queue_state(rp);
+      break;
+    default:
+      memset(m->held, 0, sizeof(m->held));
+      queue_state(rp);
+      m->step = NULL;
+      break;
+    }
+  }
+}
+
+/**
+ * Send one key event with its action and the reports that change
+ * @param rp report generator
+ * @param ev key event
+ * @param act action resolved on press, or the latched one on release
+ */
+static void send_action(kb_reporter_t *rp, const kb_event_t *ev, kb_action_t act)
+{
+  const kb_hal_t *hal = rp->hal;
+  kb_macro_t *m = &rp->macro;
+
+  if (ev->is_press) {
+    rp->actions[ev->col][ev->row] = act;
+    rp->key_rows[ev->col] |= 1u << ev->row;
+  } else {
+    rp->key_rows[ev->col] &= ~(1u << ev->row);
+  }
+
+  switch (ACT_KIND(act)) {
+  case ACT_KIND_LAYER_MO:
+    kb_layers_hold(&rp->layers, ACT_ARG(act), ev->is_press);
+    return;
+  case ACT_KIND_LAYER_TG:
+    if (ev->is_press) {
+      kb_layers_toggle(&rp->layers, ACT_ARG(act));
+    }
+    return;
+  case ACT_KIND_LAYER_OS:
+    if (ev->is_press) {
+      kb_layers_oneshot(&rp->layers, ACT_ARG(act));
+    }
+    return;
+  case ACT_KIND_FN:
+    if (ev->is_press) {
+      if (ACT_ARG(act) == FN_FNLOCK) {
+        kb_layers_toggle(&rp->layers, KB_LAYER_FNLOCK);
+      }
+      hal->do_fnfunc(hal->ctx, ACT_ARG(act));
+    }
+    break;
+  case ACT_KIND_MACRO:
+  case ACT_KIND_TEXT: {
+    const kb_keymap_model_t *model = keymap_get_model();
+    int nr = ACT_KIND(act) == ACT_KIND_MACRO ? model->nr_macros : model->nr_texts;
+    if (ev->is_press && ACT_ARG(act) < nr && m->nr_pending < KB_MACRO_QUEUE_SIZE) {
+      m->pending[m->nr_pending++] = act;
+    }
+    break;
+  }
+  default:
+    break;
+  }
+  if (ev->is_press) {
+    kb_layers_oneshot_done(&rp->layers);
+  }
+
+  kb_report_t report;
+  uint8_t *hidbuf = (uint8_t*)&report.hid;
+  kb_build_report(rp->key_rows, (const kb_action_t (*)[KB_NR_ROWS])rp->actions, &report);
+
+  bool is_nkro = hal->is_nkro(hal->ctx);
+  if (is_nkro != rp->last_is_nkro) {
+    // release everything held in the report we switch away from
+    uint8_t empty[KB_NKRO_REPORT_LEN] = {0};
+    if (queue_push(rp, rp->last_is_nkro, empty)) {
+      memset(rp->lastnkro, 0, sizeof(rp->lastnkro));
+      rp->lasthid = 0;
+      rp->last_is_nkro = is_nkro;
+    }
+  }
+
+  if (report.hid != rp->report.hid
+    && (hidbuf[2] == KEY_CAPSLOCK || hidbuf[2] == KEY_NUMLOCK)
+  ) {
+    hal->lock_key(hal->ctx, hidbuf[2]);
+  }
+
+  rp->report = report;
+  queue_state(rp);
+  kb_reporter_flush(rp);
+}
+
+/**
+ * Press and release an action on a key
+ */
+static void tap_action(kb_reporter_t *rp, const kb_event_t *ev, kb_action_t act)
+{
+  kb_event_t key = *ev;
+
+  key.is_press = true;
+  send_action(rp, &key, act);
+  key.is_press = false;
+  send_action(rp, &key, act);
+}
+
+/**
+ * End the leader sequence with the keys typed so far
+ */
+static void leader_end(kb_reporter_t *rp)
+{
+  kb_leader_state_t *lds = &rp->leader;
+  kb_action_t act;
+
+  lds->is_active = false;
+  if (kb_leader_end(lds->match, &act)) {
+    tap_action(rp, &lds->last, act);
+  }
+}
+
+/**
+ * Feed the leader sequence with one key event
+ * @return true if the event is swallowed
+ */
+static bool leader_apply(kb_reporter_t *rp, const kb_event_t *ev, kb_action_t act)
+{
+  kb_leader_state_t *lds = &rp->leader;
+  uint32_t bit = 1u << ev->row;
+
+  if (!ev->is_press) {
+    if (lds->swallowed[ev->col] & bit) {
+      lds->swallowed[ev->col] &= ~bit;
+      return true;
+    }
+    return false;
+  }
+
+  if (lds->is_active && ev->time_us - lds->last.time_us >= lds->timeout_us) {
+    leader_end(rp);
+  }
+  if (ACT_KIND(act) == ACT_KIND_LEADER) {
+    lds->swallowed[ev->col] |= bit;
+    if (lds->match != NULL) {
+      lds->is_active = true;
+      lds->last = *ev;
+      kb_leader_start(lds->match);
+    }
+    return true;
+  }
+  // modifiers and layer keys work as usual in the sequence
+  int hidkey = ACT_ARG(act);
+  if (!lds->is_active || ACT_KIND(act) != ACT_KIND_KEY
+    || (hidkey >= KEY_LEFTCTRL && hidkey <= KEY_RIGHTMETA)
+  ) {
+    return false;
+  }
+
+  lds->swallowed[ev->col] |= bit;
+  lds->last = *ev;
+  switch (kb_leader_feed(lds->match, hidkey, &act)) {
+  case LEADER_MATCH:
+    lds->is_active = false;
+    tap_action(rp, ev, act);
+    break;
+  case LEADER_NONE:
+    lds->is_active = false;
+    break;
+  default:
+    break;
+  }
+  return true;
+}
+
+/**
+ * Whether any key has an effect that depends on the keymap in use
+ */
+static bool is_key_held(const kb_reporter_t *rp)
+{
+  uint32_t rows = 0;
+  for (int i = 0; i < KB_NR_COLS; i++) {
+    rows |= rp->key_rows[i];
+  }
+  for (int i = 0; i < KB_COMBO_MAX_ACTIVE; i++) {
+    rows |= rp->combo.active[i].is_used;
+  }
+  return rows != 0 || rp->combo.is_pending || rp->taphold.is_pending
+    || rp->leader.is_active;
+}
+
+/**
+ * Release every key held as if nothing were pressed. The keys go up as
+ * nothing when they are actually released.
+ */
+static void release_all(kb_reporter_t *rp)
+{
+  kb_combo_state_t *cb = &rp->combo;
+
+  for (int i = 0; i < KB_NR_COLS; i++) {
+    for (int j = 0; j < KB_NR_ROWS; j++) {
+      rp->actions[i][j] = ACT_NONE;
+    }
+  }
+  memset(rp->key_rows, 0, sizeof(rp->key_rows));
+  cb->is_pending = false;
+  cb->nr_buf = 0;
+  memset(cb->pressed, 0, sizeof(cb->pressed));
+  memset(cb->active, 0, sizeof(cb->active));
+  rp->taphold.is_pending = false;
+  rp->taphold.nr_buf = 0;
+  rp->leader.is_active = false;
+  kb_layers_release_all(&rp->layers);
+
+  memset(&rp->report, 0, sizeof(rp->report));
+  queue_state(rp);
+}
+
+/**
+ * Swap in the keymap of kb_reporter_swap_keymap() once it can be
+ */
+static void keymap_swap(kb_reporter_t *rp)
+{
+  const kb_keymap_t *km = __atomic_load_n(&rp->next_keymap, __ATOMIC_ACQUIRE);
+
+  if (km == NULL) {
+    return;
+  }
+  if (is_key_held(rp)) {
+    if (!rp->is_swap_release_all) {
+      return;
+    }
+    release_all(rp);
+  }
+  rp->layers.keymap = km;
+  __atomic_store_n(&rp->next_keymap, NULL, __ATOMIC_RELEASE);
+}
+
+/**
+ * Apply one key event with its action, unless a leader sequence takes it
+ */
+static void apply_action(kb_reporter_t *rp, const kb_event_t *ev, kb_action_t act)
+{
+  if (!leader_apply(rp, ev, act)) {
+    send_action(rp, ev, act);
+  }
+}
+
+static bool is_taphold(kb_action_t act)
+{
+  return ACT_KIND(act) == ACT_KIND_MOD_TAP || ACT_KIND(act) == ACT_KIND_LAYER_TAP;
+}
+
+/**
+ * Whether the press of a released key is held back by the tap-hold key
+ */
+static bool is_buffered_press(const kb_taphold_t *th, const kb_event_t *ev)
+{
+  for (int i = 0; i < th->nr_buf; i++) {
+    if (th->buf[i].is_press && th->buf[i].col == ev->col && th->buf[i].row == ev->row) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Decide the pending tap-hold key, then replay the events held back
+ * @param rp report generator
+ * @param is_hold hold, or tap which also releases the key
+ */
+static void taphold_decide(kb_reporter_t *rp, bool is_hold)
+{
+  kb_taphold_t *th = &rp->taphold;
+  kb_event_t key = th->key;
+  kb_event_t buf[KB_TAPHOLD_BUF_SIZE];
+  int nr_buf = th->nr_buf;
+
+  memcpy(buf, th->buf, nr_buf * sizeof(kb_event_t));
+  th->is_pending = false;
+  th->nr_buf = 0;
+
+  if (is_hold) {
+    kb_action_t hold = ACT_KIND(th->act) == ACT_KIND_MOD_TAP
+      ? ACT_KEY(KEY_LEFTCTRL + ACT_HOLD_ARG(th->act))
+      : ACT_MO(ACT_HOLD_ARG(th->act));
+    apply_action(rp, &key, hold);
+  } else {
+    apply_action(rp, &key, ACT_KEY(ACT_TAP_KEY(th->act)));
+    key.is_press = false;
+    apply_action(rp, &key, rp->actions[key.col][key.row]);
+  }
+
+  // which may start another tap-hold key
+  for (int i = 0; i < nr_buf; i++) {
+    taphold_apply(rp, &buf[i]);
+  }
+}
+
+/**
+ * Apply one key event after the combos, holding it back while a tap-hold
+ * key is undecided
+ */
+static void taphold_apply(kb_reporter_t *rp, const kb_event_t *ev)
+{
+  kb_taphold_t *th = &rp->taphold;
+
+  if (!th->is_pending) {
+    if (ev->is_press) {
+      kb_action_t act = kb_layers_resolve(&rp->layers, ev->col, ev->row);
+      if (is_taphold(act)) {
+        th->is_pending = true;
+        th->key = *ev;
+        th->act = act;
+        th->nr_buf = 0;
+        return;
+      }
+      apply_action(rp, ev, act);
+    } else {
+      apply_action(rp, ev, rp->actions[ev->col][ev->row]);
+    }
+    return;
+  }
+
+  // Decide the pending key as soon as this event tells how
+  if (ev->time_us - th->key.time_us >= th->cfg.tapping_term_us) {
+    taphold_decide(rp, true);
+    taphold_apply(rp, ev);
+  } else if (ev->col == th->key.col && ev->row == th->key.row) {
+    // released within the tapping term
+    taphold_decide(rp, false);
+  } else if (ev->is_press && th->cfg.is_hold_on_other_key_press) {
+    taphold_decide(rp, true);
+    taphold_apply(rp, ev);
+  } else if (!ev->is_press && th->cfg.is_permissive_hold
+    && is_buffered_press(th, ev)
+  ) {
+    // a key tapped while the tap-hold key is down
+    taphold_decide(rp, true);
+    taphold_apply(rp, ev);
+  } else if (!ev->is_press && !is_buffered_press(th, ev)) {
+    // pressed before the tap-hold key, unaffected by it
+    apply_action(rp, ev, rp->actions[ev->col][ev->row]);
+  } else if (th->nr_buf < KB_TAPHOLD_BUF_SIZE) {
+    th->buf[th->nr_buf++] = *ev;
+  } else {
+    taphold_decide(rp, true);
+    taphold_apply(rp, ev);
+  }
+}
+
+/**
+ * Release the action of a combo held down when one of its keys goes up
+ * @return true if the key belongs to a combo held down
+ */
+static bool combo_release(kb_reporter_t *rp, const kb_event_t *ev)
+{
+  kb_combo_state_t *cb = &rp->combo;
+
+  for (int i = 0; i < KB_COMBO_MAX_ACTIVE; i++) {
+    kb_active_combo_t *ac = &cb->active[i];
+    if (!ac->is_used || !((ac->keys[ev->col] >> ev->row) & 1)) {
+      continue;
+    }
+    ac->keys[ev->col] &= ~(1u << ev->row);
+    if (ac->is_down) {
+      kb_event_t up = ac->carrier;
+      up.time_us = ev->time_us;
+      up.is_press = false;
+      ac->is_down = false;
+      taphold_apply(rp, &up);
+    }
+    ac->is_used = false;
+    for (int k = 0; k < KB_NR_COLS; k++) {
+      ac->is_used |= ac->keys[k] != 0;
+    }
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Replay the presses held back as the keys themselves
+ */
+static void combo_replay(kb_reporter_t *rp)
+{
+  kb_combo_state_t *cb = &rp->combo;
+  kb_event_t buf[KB_COMBO_BUF_SIZE];
+  int nr_buf = cb->nr_buf;
+
+  memcpy(buf, cb->buf, nr_buf * sizeof(kb_event_t));
+  cb->is_pending = false;
+  cb->nr_buf = 0;
+  memset(cb->pressed, 0, sizeof(cb->pressed));
+
+  for (int i = 0; i < nr_buf; i++) {
+    taphold_apply(rp, &buf[i]);
+  }
+}
+
+/**
+ * Press the action of a combo made of the keys held back
+ * @param rp report generator
+ * @param idx combo index
+ */
+static void combo_fire(kb_reporter_t *rp, int idx)
+{
+  kb_combo_state_t *cb = &rp->combo;
+  kb_active_combo_t *ac = NULL;
+
+  for (int i = 0; i < KB_COMBO_MAX_ACTIVE && ac == NULL; i++) {
+    if (!cb->active[i].is_used) {
+      ac = &cb->active[i];
+    }
+  }
+  if (ac == NULL) {
+    combo_replay(rp);
+    return;
+  }
+
+  ac->is_used = true;
+  ac->is_down = true;
+  ac->carrier = cb->buf[0];
+  memcpy(ac->keys, cb->pressed, sizeof(ac->keys));
+  cb->is_pending = false;
+  cb->nr_buf = 0;
+  memset(cb->pressed, 0, sizeof(cb->pressed));
+
+  // the combo is another key press to an undecided tap-hold key, which
+  // cannot hold it back since it has no position of its own
+  if (rp->taphold.is_pending) {
+    taphold_decide(rp, true);
+  }
+  apply_action(rp, &ac->carrier, cb->combos->combo[idx].action);
+}
+
+/**
+ * Decide the keys held back: the combo they make, else themselves
+ */
+static void combo_decide(kb_reporter_t *rp)
+{
+  kb_combo_state_t *cb = &rp->combo;
+  bool is_partial;
+  int match = kb_combos_match(cb->combos, cb->pressed, &is_partial);
+
+  if (match >= 0) {
+    combo_fire(rp, match);
+  } else {
+    combo_replay(rp);
+  }
+}
+
+/**
+ * Apply one key event, holding back the presses that may make a combo
+ */
+static void combo_apply(kb_reporter_t *rp, const kb_event_t *ev)
+{
+  kb_combo_state_t *cb = &rp->combo;
+
+  if (!ev->is_press && combo_release(rp, ev)) {
+    return;
+  }
+
+  if (!cb->is_pending) {
+    if (ev->is_press && cb->combos != NULL
+      && kb_combos_has_key(cb->combos, ev->col, ev->row)
+    ) {
+      cb->is_pending = true;
+      memset(cb->pressed, 0, sizeof(cb->pressed));
+      cb->pressed[ev->col] = 1u << ev->row;
+      cb->buf[0] = *ev;
+      cb->nr_buf = 1;
+      return;
+    }
+    taphold_apply(rp, ev);
+    return;
+  }
+
+  if (ev->time_us - cb->buf[0].time_us >= cb->term_us) {
+    combo_decide(rp);
+    combo_apply(rp, ev);
+  } else if (ev->is_press) {
+    uint32_t pressed[KB_NR_COLS];
+    bool is_partial;
+    memcpy(pressed, cb->pressed, sizeof(pressed));
+    pressed[ev->col] |= 1u << ev->row;
+    int match = kb_combos_match(cb->combos, pressed, &is_partial);
+    if ((match < 0 && !is_partial) || cb->nr_buf >= KB_COMBO_BUF_SIZE) {
+      // no combo with the keys held back, which are decided without it
+      combo_decide(rp);
+      combo_apply(rp, ev);
+      return;
+    }
+    memcpy(cb->pressed, pressed, sizeof(pressed));
+    cb->buf[cb->nr_buf++] = *ev;
+    if (!is_partial) {
+      // complete, and no larger combo to wait for
+      combo_fire(rp, match);
+    }
+  } else if ((cb->pressed[ev->col] >> ev->row) & 1) {
+    // released before the combo is complete
+    combo_decide(rp);
+    combo_apply(rp, ev);
+  } else {
+    // pressed before the keys held back
+    taphold_apply(rp, ev);
+  }
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+void kb_scanner_init(kb_scanner_t *sc, const kb_hal_t *hal,
+  kb_event_ring_t *events, debounce_algo_t algo, uint32_t debounce_us)
+{
+  sc->hal = hal;
+  sc->events = events;
+  debounce_init(&sc->debounce, algo, debounce_us, hal->now_us(hal->ctx));
+  memset(sc->reported_rows, 0, sizeof(sc->reported_rows));
+}
+
+bool kb_scanner_scan(kb_scanner_t *sc)
+{
+  const kb_hal_t *hal = sc->hal;
+  uint32_t col_rows[KB_NR_COLS];
+
+  hal->read_matrix(hal->ctx, col_rows);
+  uint32_t now_us = hal->now_us(hal->ctx);
+  debounce_update(&sc->debounce, col_rows, now_us);
+
+  bool is_key_pressed = false;
+  for (int i = 0; i < KB_NR_COLS; i++) {
+    is_key_pressed |= (col_rows[i] & KB_ROW_MASK) != 0;
+  }
+
+  // Keys that may be "phantom keys" keep their reported state, the rest
+  // of the matrix updates as usual.
+  ghost_resolve(col_rows, sc->reported_rows);
+
+  // Queue every transition of this scan. A transition that does not fit
+  // stays unreported and is retried on the next scan.
+  for (int i = 0; i < KB_NR_COLS; i++) {
+    uint32_t changed = col_rows[i] ^ sc->reported_rows[i];
+    for (; changed != 0; changed &= changed - 1) {
+      int j = __builtin_ctz(changed);
+      kb_event_t ev = {
+        .time_us = now_us,
+        .col = i,
+        .row = j,
+        .is_press = (col_rows[i] >> j) & 1,
+      };
+      if (!kb_event_push(sc->events, &ev)) {
+        break;
+      }
+      sc->reported_rows[i] ^= 1u << j;
+    }
+  }
+  return is_key_pressed;
+}
+
+void kb_build_report(const uint32_t key_rows[KB_NR_COLS],
+  const kb_action_t actions[KB_NR_COLS][KB_NR_ROWS], kb_report_t *report)
+{
+  uint64_t hid = 0;
+  uint8_t *hidbuf = (uint8_t*)&hid;
+  uint8_t *nkro = report->nkro;
+  int nr_hidkey = 0;
+  uint16_t hotkey = 0;
+  memset(nkro, 0, KB_NKRO_REPORT_LEN);
+
+  for (int i = 0; i < KB_NR_COLS; i++) {
+    uint32_t rows_cur_col = key_rows[i] & KB_ROW_MASK; // rows connected with the current col
+    for (uint32_t pending = rows_cur_col; pending != 0; pending &= pending - 1) {
+      int j = __builtin_ctz(pending);
+      kb_action_t act = actions[i][j];
+      int hidkey = ACT_ARG(act);
+
+      switch (ACT_KIND(act)) {
+      case ACT_KIND_KEY:
+        if (hidkey >= KEY_LEFTCTRL && hidkey <= KEY_RIGHTMETA) {
+          hidbuf[0] |= 1u << (hidkey & 0x07);
+        } else {
+          // the 6KRO report keeps the first six, NKRO takes them all
+          if (nr_hidkey < 6) {
+            hidbuf[2+nr_hidkey] = hidkey;
+            nr_hidkey++;
+          }
+          nkro_set_key(nkro, hidkey, true);
+          hotkey = 0; // clear hotkey
+        }
+        break;
+      case ACT_KIND_CONSUMER:
+        hotkey = ACT_ARG(act);
+        hid = 0;  // clear keyboard key
+        nr_hidkey = 0;
+        memset(nkro, 0, KB_NKRO_REPORT_LEN);
+        break;
+      default:
+        break;
+      }
+    }
+  }
+
+  nkro[0] = hidbuf[0];
+  report->hid = hid;
+  report->hotkey = hotkey;
+}
+
+void kb_reporter_init(kb_reporter_t *rp, const kb_hal_t *hal,
+  const kb_keymap_t *km)
+{
+  memset(rp, 0, sizeof(*rp));
+  rp->hal = hal;
+  kb_layers_init(&rp->layers, km);
+  rp->combo.term_us = KB_COMBO_TERM_US;
+  rp->leader.timeout_us = KB_LEADER_TIMEOUT_US;
+  rp->taphold.cfg = (kb_taphold_cfg_t) {
+    .tapping_term_us = KB_TAPPING_TERM_US,
+    .is_permissive_hold = true,
+    .is_hold_on_other_key_press = false,
+  };
+}
+
+void kb_reporter_set_taphold(kb_reporter_t *rp, const kb_taphold_cfg_t *cfg)
+{
+  rp->taphold.cfg = *cfg;
+}
+
+void kb_reporter_set_combos(kb_reporter_t *rp, const kb_combos_t *cs,
+  uint32_t term_us)
+{
+  rp->combo.combos = cs;
+  rp->combo.term_us = term_us != 0 ? term_us : KB_COMBO_TERM_US;
+}
+
+void kb_reporter_set_unicode(kb_reporter_t *rp, kb_unicode_mode_t mode)
+{
+  rp->unicode_mode = mode;
+}
+
+void kb_reporter_set_leader(kb_reporter_t *rp, kb_leader_t *ld,
+  uint32_t timeout_us)
+{
+  rp->leader.match = ld;
+  rp->leader.is_active = false;
+  rp->leader.timeout_us = timeout_us != 0 ? timeout_us : KB_LEADER_TIMEOUT_US;
+}
+
+bool kb_reporter_swap_keymap(kb_reporter_t *rp, const kb_keymap_t *km,
+  bool is_release_all)
+{
+  if (kb_reporter_is_swap_pending(rp)) {
+    return false;
+  }
+  rp->is_swap_release_all = is_release_all;
+  __atomic_store_n(&rp->next_keymap, km, __ATOMIC_RELEASE);
+  return true;
+}
+
+bool kb_reporter_is_swap_pending(const kb_reporter_t *rp)
+{
+  return __atomic_load_n(&rp->next_keymap, __ATOMIC_ACQUIRE) != NULL;
+}
+
+void kb_reporter_apply(kb_reporter_t *rp, const kb_event_t *ev)
+{
+  keymap_swap(rp);
+  if (ev->col == 0 && ev->row == KB_FN_ROW) {
+    // the Fn button only switches the layer of the keys pressed after it
+    kb_layers_hold(&rp->layers, KB_LAYER_FN, ev->is_press);
+    return;
+  }
+  if (ev->col >= KB_NR_COLS || ev->row >= KB_NR_ROWS) {
+    return;
+  }
+  combo_apply(rp, ev);
+}
+
+void kb_reporter_tick(kb_reporter_t *rp, uint32_t now_us)
+{
+  kb_combo_state_t *cb = &rp->combo;
+  kb_taphold_t *th = &rp->taphold;
+  kb_leader_state_t *lds = &rp->leader;
+
+  if (cb->is_pending && now_us - cb->buf[0].time_us >= cb->term_us) {
+    combo_decide(rp);
+  }
+  if (th->is_pending && now_us - th->key.time_us >= th->cfg.tapping_term_us) {
+    taphold_decide(rp, true);
+  }
+  if (lds->is_active && now_us - lds->last.time_us >= lds->timeout_us) {
+    leader_end(rp);
+  }
+  keymap_swap(rp);
+  kb_reporter_flush(rp);
+}
+
+void kb_reporter_flush(kb_reporter_t *rp)
+{
+  const kb_hal_t *hal = rp->hal;
+
+  macro_fill(rp);
+  while (rp->nr_queued > 0 && hal->is_keyboard_ready(hal->ctx)) {
+    kb_queued_report_t *entry = &rp->queue[rp->queue_head];
+    if (entry->is_consumer) {
+      hal->send_consumer(hal->ctx, entry->hotkey);
+    } else {
+      hal->send_keyboard(hal->ctx, entry->is_nkro, entry->buf);
+    }
+    rp->queue_head = (rp->queue_head + 1) % KB_REPORT_QUEUE_SIZE;
+    rp->nr_queued--;
+    if (rp->is_state_held) {
+      queue_state(rp);
+    }
+    macro_fill(rp);
+  }
+}
+
+bool kb_reporter_is_ready(const kb_reporter_t *rp)
+{
+  return rp->nr_queued <= KB_REPORT_QUEUE_SIZE / 2;
+}
+
+bool kb_reporter_resend(kb_reporter_t *rp)
+{
+  const kb_hal_t *hal = rp->hal;
+  uint8_t buf[KB_NKRO_REPORT_LEN] = {0};
+
+  if (rp->nr_queued > 0 || !hal->is_keyboard_ready(hal->ctx)) {
+    return false;
+  }
+  // nothing is queued, so the last queued report is the last one sent
+  if (rp->last_is_nkro) {
+    memcpy(buf, rp->lastnkro, KB_NKRO_REPORT_LEN);
+  } else {
+    memcpy(buf, &rp->lasthid, sizeof(rp->lasthid));
+  }
+  hal->send_keyboard(hal->ctx, rp->last_is_nkro, buf);
+  return true;
+}
+
+bool kb_ps2_read_packet(const kb_hal_t *hal, ps2_packet_t *pkt)
+{
+  int nrrd = hal->ps2_read(hal->ctx, (uint8_t*)pkt->data, 3, 5);
+  if (nrrd <= 0) {
+    return false;
+  }
+  if (nrrd < 3) {
+    // read the remaining bytes
+    int nrrd2 = hal->ps2_read(hal->ctx, (uint8_t*)&pkt->data[nrrd], 3-nrrd, 3);
+    if (nrrd2 > 0) {
+      nrrd += nrrd2;
+    }
+  }
+  if (nrrd != 3) {
+    // discard the dirty data
+    hal->ps2_flush(hal->ctx);
+    return false;
+  }
+  return true;
+}
+
+void kb_mouse_init(kb_mouse_t *m, const kb_hal_t *hal)
+{
+  m->hal = hal;
+  m->is_midkey = false;
+  m->is_pan = true;
+}
+
+void kb_mouse_report(kb_mouse_t *m, uint8_t buttons, int8_t dx, int8_t dy,
+  bool is_fn_pressed)
+{
+  const kb_hal_t *hal = m->hal;
+  int8_t pan_x = 0, pan_y = 0;
+
+  buttons &= 0b00000111;
+#ifndef USE_FN_TRACKPOINT_PAN
+  (void)is_fn_pressed;
+
+  // mid key detection
+  if (buttons & 0b00000100) {
+    m->is_midkey = true;
+    if (dx != 0 || dy != 0) {
+      // middle key for pan
+      pan_x = dx > 0 ? 1 : dx < 0 ? -1 : 0;
+      pan_y = dy < 0 ? 1 : dy > 0 ? -1 : 0;
+      dx = dy = 0;
+      m->is_pan = true;
+    }
+  } else {
+    if (m->is_midkey && !m->is_pan) {
+      // a middle click without motion
+      hal->send_mouse(hal->ctx, 0b00000100, 0,0,0,0);
+      hal->delay_ms(hal->ctx, 20);
+      hal->send_mouse(hal->ctx, 0, 0,0,0,0);
+      hal->delay_ms(hal->ctx, 20);
+    }
+    m->is_midkey = m->is_pan = false;
+    dx = scale_motion(dx);
+    dy = scale_motion(dy);
+  }
+  hal->send_mouse(hal->ctx, buttons & 0b00000011, dx, dy, pan_y, pan_x);
+
+#else
+
+  if (is_fn_pressed) {
+    // panning
+    pan_x = dx > 0 ? 1 : dx < 0 ? -1 : 0;
+    pan_y = dy < 0 ? 1 : dy > 0 ? -1 : 0;
+    dx = dy = 0;
+  } else {
+    dx = scale_motion(dx);
+    dy = scale_motion(dy);
+  }
+  hal->send_mouse(hal->ctx, buttons, dx, dy, pan_y, pan_x);
+#endif
+}
@@ -0,0 +1,59 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "keyevent.h"
+
+_Static_assert((KB_EVENT_RING_SIZE & (KB_EVENT_RING_SIZE - 1)) == 0,
+  "KB_EVENT_RING_SIZE must be a power of 2");
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+bool kb_event_push(kb_event_ring_t *ring, const kb_event_t *ev)
+{
+  uint32_t head = ring->head;
+  // the consumer frees slots by releasing tail
+  uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  if (head - tail >= KB_EVENT_RING_SIZE) {
+    return false;
+  }
+
+  ring->buf[head & (KB_EVENT_RING_SIZE - 1)] = *ev;
+  // publish the slot before the new head
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+bool kb_event_pop(kb_event_ring_t *ring, kb_event_t *ev)
+{
+  uint32_t tail = ring->tail;
+  uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  if (head == tail) {
+    return false;
+  }
+
+  *ev = ring->buf[tail & (KB_EVENT_RING_SIZE - 1)];
+  // hand the slot back after reading it
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
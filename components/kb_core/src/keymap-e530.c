@@ -24,10 +24,14 @@
 
 #include "keymap.h"
 
-keytable_t kbtbl[] = {
-  // TODO
-};
+#define KEYMAP_MODEL         e530
+#define KEYMAP_MODEL_NAME    "E530"
+#define KEYMAP_MODEL_NR_ROWS 16   // without a numpad
 
-fn_keytable_t fntbl[] = {
-  // TODO
-};
+// X(scan1, scan2, ascii, hidcode)
+#define KBTBL_ITEMS(X) \
+  /* TODO */
+
+// X(scan1, scan2, consumer hidcode, fncode)
+#define FNTBL_ITEMS(X) \
+  /* TODO */
@@ -0,0 +1,192 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Keymap for Thinkpad E580/T470 etc.
+ *
+ * The tables are X-macro lists so that keymap.c can expand them into both
+ * the sparse tables and the dense lookup planes.
+ */
+
+#include "keymap.h"
+
+#define KEYMAP_MODEL         e580
+#define KEYMAP_MODEL_NAME    "E580"
+#define KEYMAP_MODEL_NR_ROWS 18   // with the numpad
+
+// X(scan1, scan2, ascii, hidcode)
+#define KBTBL_ITEMS(X) \
+  X(0,  1, 0, KEY_ESC)                    \
+  X(7,  4, 0, KEY_F1)                     \
+  X(7,  3, 0, KEY_F2)                     \
+  X(1,  3, 0, KEY_F3)                     \
+  X(0,  3, 0, KEY_F4)                     \
+  X(0, 14, 0, KEY_F5)                     \
+  X(0,  8, 0, KEY_F6)                     \
+  X(1,  6, 0, KEY_F7)                     \
+  X(7,  6, 0, KEY_F8)                     \
+  X(7, 14, 0, KEY_F9)                     \
+  X(5, 14, 0, KEY_F10)                    \
+  X(5, 13, 0, KEY_F11)                    \
+  X(5, 11, 0, KEY_F12)                    \
+  X(7, 12, 0, KEY_HOME)                   \
+  X(5, 12, 0, KEY_END)                    \
+  X(7, 11, 0, KEY_INSERT)                 \
+  X(7, 13, 0, KEY_DELETE)                 \
+                                          \
+  X(7,  1, '~', KEY_GRAVE)                \
+  X(5,  1, '1', KEY_1)                    \
+  X(5,  4, '2', KEY_2)                    \
+  X(5,  3, '3', KEY_3)                    \
+  X(5,  5, '4', KEY_4)                    \
+  X(7,  5, '5', KEY_5)                    \
+  X(7,  2, '6', KEY_6)                    \
+  X(5,  2, '7', KEY_7)                    \
+  X(5,  8, '8', KEY_8)                    \
+  X(5,  6, '9', KEY_9)                    \
+  X(5,  7, '0', KEY_0)                    \
+  X(7,  7, '-', KEY_MINUS)                \
+  X(7,  8, '=', KEY_EQUAL)                \
+  X(1, 14, 0, KEY_BACKSPACE)              \
+                                          \
+  X(1,  1, 0, KEY_TAB)                    \
+  X(6,  1, 'q', KEY_Q)                    \
+  X(6,  4, 'w', KEY_W)                    \
+  X(6,  3, 'e', KEY_E)                    \
+  X(6,  5, 'r', KEY_R)                    \
+  X(1,  5, 't', KEY_T)                    \
+  X(1,  2, 'y', KEY_Y)                    \
+  X(6,  2, 'u', KEY_U)                    \
+  X(6,  8, 'i', KEY_I)                    \
+  X(6,  6, 'o', KEY_O)                    \
+  X(6,  7, 'p', KEY_P)                    \
+  X(1,  7, '[', KEY_LEFTBRACE)            \
+  X(1,  8, ']', KEY_RIGHTBRACE)           \
+  X(4, 14, '\\', KEY_BACKSLASH)           \
+                                          \
+  X(1,  4, 0, KEY_CAPSLOCK)               \
+  X(4,  1, 'a', KEY_A)                    \
+  X(4,  4, 's', KEY_S)                    \
+  X(4,  3, 'd', KEY_D)                    \
+  X(4,  5, 'f', KEY_F)                    \
+  X(0,  5, 'g', KEY_G)                    \
+  X(0,  2, 'h', KEY_H)                    \
+  X(4,  2, 'j', KEY_J)                    \
+  X(4,  8, 'k', KEY_K)                    \
+  X(4,  6, 'l', KEY_L)                    \
+  X(4,  7, ';', KEY_SEMICOLON)            \
+  X(0,  7, '\'', KEY_APOSTROPHE)          \
+  X(3, 14, 0, KEY_ENTER)                  \
+                                          \
+  X(1,  0, 0, KEY_LEFTSHIFT)              \
+  X(3,  1, 'z', KEY_Z)                    \
+  X(3,  4, 'x', KEY_X)                    \
+  X(3,  3, 'c', KEY_C)                    \
+  X(3,  5, 'v', KEY_V)                    \
+  X(2,  5, 'b', KEY_B)                    \
+  X(2,  2, 'n', KEY_N)                    \
+  X(3,  2, 'm', KEY_M)                    \
+  X(3,  8, ',', KEY_COMMA)                \
+  X(3,  6, '.', KEY_DOT)                  \
+  X(2,  7, '/', KEY_SLASH)                \
+  X(3,  0, 0, KEY_RIGHTSHIFT)             \
+                                          \
+  /* { 23, 24, 0, 0 }, // Fn key */       \
+  X(7,  9, 0, KEY_LEFTCTRL)               \
+  X(1, 11, 0, KEY_LEFTMETA) /* win key */ \
+  X(0, 10, 0, KEY_LEFTALT)                \
+  X(2, 14, ' ', KEY_SPACE)                \
+  X(2, 10, 0, KEY_RIGHTALT)               \
+  X(5, 10, 0, KEY_PRTSC)                  \
+  X(3,  9, 0, KEY_RIGHTCTRL)              \
+  X(7, 15, 0, KEY_PAGEUP)                 \
+  X(0, 12, 0, KEY_UP)                     \
+  X(5, 15, 0, KEY_PAGEDOWN)               \
+                                          \
+  X(2, 12, 0, KEY_LEFT)                   \
+  X(2, 13, 0, KEY_DOWN)                   \
+  X(2, 11, 0, KEY_RIGHT)                  \
+                                          \
+  X(1, 12, 0, KEY_MEDIA_CALC)             \
+  X(6, 12, '(', KEY_KPLEFTPAREN)          \
+  X(1, 15, ')', KEY_KPRIGHTPAREN)         \
+  X(6, 15, 0, KEY_BACKSPACE)              \
+  X(0, 16, 0, KEY_NUMLOCK)                \
+  X(1, 16, '/', KEY_KPSLASH)              \
+  X(6, 16, '*', KEY_KPASTERISK)           \
+  X(7, 16, '-', KEY_KPMINUS)              \
+  X(4, 16, '7', KEY_KP7)                  \
+  X(5, 16, '8', KEY_KP8)                  \
+  X(3, 16, '9', KEY_KP9)                  \
+  X(2, 16, '+', KEY_KPPLUS)               \
+  X(0, 17, '4', KEY_KP4)                  \
+  X(1, 17, '5', KEY_KP5)                  \
+  X(6, 17, '6', KEY_KP6)                  \
+  X(7, 17, '1', KEY_KP1)                  \
+  X(4, 17, '2', KEY_KP2)                  \
+  X(5, 17, '3', KEY_KP3)                  \
+  X(3, 17, 0, KEY_KPENTER)                \
+  X(2, 17, '0', KEY_KP0)                  \
+  X(6, 11, '.', KEY_KPDOT)
+
+// X(scan1, scan2, consumer hidcode, fncode)
+#define FNTBL_ITEMS(X) \
+  X(0,  1, 0, FN_FNLOCK)                              \
+  X(7,  4, KEY_CONSUMER_MUTE, FN_NOP)                 \
+  X(7,  3, KEY_CONSUMER_VOLUME_DECREMENT, FN_NOP)     \
+  X(1,  3, KEY_CONSUMER_VOLUME_INCREMENT, FN_NOP)     \
+  /* { 0,  3, , 0 }, */                               \
+  X(0, 14, KEY_CONSUMER_BRIGHTNESS_DECREMENT, FN_NOP) \
+  X(0,  8, KEY_CONSUMER_BRIGHTNESS_INCREMENT, FN_NOP) \
+  /* { 1,  6, , 0 }, */                               \
+  /* { 7,  6, , 0 }, */                               \
+  /* { 7, 14, , 0 }, */                               \
+  /* { 5, 14, , 0 }, */                               \
+  /* { 5, 13, , 0 }, */                               \
+  /* { 5, 11, , 0 }, */                               \
+  X(2, 14, 0, FN_BACKLIGHT)
+
+// X(layer, scan1, scan2, action), over kbtbl and fntbl in any layer, and
+// the only way into KB_LAYER_USER0 ~ KB_LAYER_USER3
+#define USRTBL_ITEMS(X) \
+  X(KB_LAYER_BASE, 1, 4, ACT_MT(0, KEY_CAPSLOCK))   /* Ctrl when held */ \
+  X(KB_LAYER_FN,   3, 9, ACT_LEADER)                 /* Fn + RightCtrl */
+
+// X(name, steps...), played by ACT_MACRO(name) in USRTBL_ITEMS, e.g.
+//   X(MACRO_SIG, MACRO_DOWN(KEY_LEFTSHIFT), MACRO_TAP(KEY_H), MACRO_UP(KEY_LEFTSHIFT), MACRO_TAP(KEY_I))
+#define MACRO_ITEMS(X) \
+  /* none yet */
+
+// X(name, codepoints...), typed by ACT_TEXT(name) in USRTBL_ITEMS or
+// LEADER_ITEMS
+#define TEXT_ITEMS(X) \
+  X(TEXT_SHRUG, 0xaf, '\\', '_', '(', 0x30c4, ')', '_', '/', 0xaf)
+
+// X(action, COMBO_KEY(scan1, scan2), ...), 2 ~ KB_COMBO_MAX_KEYS keys, e.g.
+//   X(ACT_KEY(KEY_ESC), COMBO_KEY(2, 5), COMBO_KEY(2, 6))
+#define COMBO_ITEMS(X) \
+  X(ACT_CONSUMER(KEY_CONSUMER_PLAY_PAUSE), COMBO_KEY(7, 15), COMBO_KEY(5, 15))   /* PgUp + PgDn */
+
+// X(action, keys...) after ACT_LEADER, 1 ~ KB_LEADER_MAX_KEYS keys, sorted
+// by the keys with a sequence before the longer ones it begins
+#define LEADER_ITEMS(X) \
+  X(ACT_FN(FN_BACKLIGHT), KEY_B, KEY_L)             \
+  X(ACT_CONSUMER(KEY_CONSUMER_MUTE), KEY_M)         \
+  X(ACT_TEXT(TEXT_SHRUG), KEY_S, KEY_H)
@@ -0,0 +1,100 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Common part of keymap. The tables of every model are compiled in, and
+ * the boot probe selects the one of the keyboard actually connected.
+ */
+
+#include "keymap.h"
+
+#define KBTBL_ENTRY(s1, s2, asc, hid)   { s1, s2, asc, hid },
+#define KBTBL_PLANE(s1, s2, asc, hid)   [s1][s2] = hid,
+#define FNTBL_ENTRY(s1, s2, hid, fn)    { s1, s2, hid, fn },
+#define FNTBL_PLANE(s1, s2, hid, fn)    [s1][s2] = { s1, s2, hid, fn },
+#define USRTBL_ENTRY(l, s1, s2, act)    { l, s1, s2, act },
+#define COMBO_ENTRY(act, ...)           { act, sizeof((uint8_t[]) { __VA_ARGS__ }), { __VA_ARGS__ } },
+#define LEADER_ENTRY(act, ...)          { act, sizeof((uint8_t[]) { __VA_ARGS__ }), { __VA_ARGS__ } },
+#define MACRO_ID(name, ...)             name,
+#define MACRO_ENTRY(name, ...)          [name] = (const kb_macro_step_t[]) { __VA_ARGS__, MACRO_END },
+#define TEXT_ID(name, ...)              name,
+#define TEXT_ENTRY(name, ...)           [name] = (const uint32_t[]) { __VA_ARGS__, 0 },
+
+#define MODEL_SYM__(model, sym)         model##_##sym
+#define MODEL_SYM_(model, sym)          MODEL_SYM__(model, sym)
+#define MODEL_SYM(sym)                  MODEL_SYM_(KEYMAP_MODEL, sym)
+
+// each keymap-*.c is expanded by keymap_model.inc into <model>_model
+#include "keymap-e580.c"
+#include "keymap_model.inc"
+
+#include "keymap-e530.c"
+#include "keymap_model.inc"
+
+static const kb_keymap_model_t *const models[] = {
+  &e580_model,
+  &e530_model,
+};
+
+#ifdef USE_KEYMAP_E530
+static const kb_keymap_model_t *model = &e530_model;
+#else
+static const kb_keymap_model_t *model = &e580_model;
+#endif
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+const kb_keymap_model_t *keymap_get_model(void)
+{
+  return model;
+}
+
+const kb_keymap_model_t *keymap_select_model(unsigned nr_rows)
+{
+  for (int i = 0; i < (int)(sizeof(models) / sizeof(models[0])); i++) {
+    if (models[i]->nr_rows == nr_rows && models[i]->nr_keys != 0) {
+      model = models[i];
+      break;
+    }
+  }
+  return model;
+}
+
+int search_hid_key(unsigned scan1, unsigned scan2)
+{
+  if (scan1 >= KB_NR_COLS || scan2 >= KB_NR_ROWS) {
+    return -1;
+  }
+  uint8_t hidcode = model->hid_plane[scan1][scan2];
+  return hidcode != KEY_NONE ? hidcode : -1;
+}
+
+const fn_keytable_t* search_fn(unsigned scan1, unsigned scan2)
+{
+  if (scan1 >= KB_NR_COLS || scan2 >= KB_NR_ROWS) {
+    return 0;
+  }
+  const fn_keytable_t *item = &model->fn_plane[scan1][scan2];
+  return (item->hidcode != 0 || item->fncode != FN_NOP) ? item : 0;
+}
@@ -0,0 +1,95 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <strings.h>
+#include "keymap_blob.h"
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+uint32_t kb_crc32(uint32_t crc, const void *buf, size_t len)
+{
+  const uint8_t *p = buf;
+
+  // bitwise, a blob is only checked once at boot
+  crc = ~crc;
+  while (len--) {
+    crc ^= *p++;
+    for (int k = 0; k < 8; k++) {
+      crc = (crc >> 1) ^ (0xedb88320u & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+const kb_keymap_t *kb_keymap_blob_check(const void *blob, size_t len)
+{
+  const kb_keymap_blob_hdr_t *hdr = blob;
+
+  if (blob == NULL || len < KB_KEYMAP_BLOB_SIZE) {
+    return NULL;
+  }
+  if (hdr->magic != KB_KEYMAP_BLOB_MAGIC
+    || hdr->version != KB_KEYMAP_BLOB_VERSION
+    || hdr->nr_layers != KB_NR_LAYERS
+    || hdr->nr_cols != KB_NR_COLS
+    || hdr->nr_rows != KB_NR_ROWS
+  ) {
+    return NULL;
+  }
+
+  const kb_keymap_t *km = (const kb_keymap_t*)(hdr + 1);
+  if (kb_crc32(0, km, sizeof(*km)) != hdr->crc32 || !kb_keymap_is_valid(km)) {
+    return NULL;
+  }
+  return km;
+}
+
+bool kb_keymap_blob_is_for_model(const void *blob, const char *name)
+{
+  const kb_keymap_blob_hdr_t *hdr = blob;
+
+  return strlen(name) < KB_KEYMAP_BLOB_NAME_LEN
+    && strncasecmp(hdr->name, name, KB_KEYMAP_BLOB_NAME_LEN) == 0;
+}
+
+size_t kb_keymap_blob_build(const kb_keymap_t *km, const char *name,
+  void *buf, size_t len)
+{
+  kb_keymap_blob_hdr_t *hdr = buf;
+
+  if (len < KB_KEYMAP_BLOB_SIZE) {
+    return 0;
+  }
+  memset(hdr, 0, sizeof(*hdr));
+  hdr->magic = KB_KEYMAP_BLOB_MAGIC;
+  hdr->version = KB_KEYMAP_BLOB_VERSION;
+  hdr->nr_layers = KB_NR_LAYERS;
+  hdr->nr_cols = KB_NR_COLS;
+  hdr->nr_rows = KB_NR_ROWS;
+  hdr->crc32 = kb_crc32(0, km, sizeof(*km));
+  memcpy(hdr->name, name, strnlen(name, sizeof(hdr->name)));
+  memcpy(hdr + 1, km, sizeof(*km));
+  return KB_KEYMAP_BLOB_SIZE;
+}
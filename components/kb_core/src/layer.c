@@ -0,0 +1,221 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "layer.h"
+
+_Static_assert(KB_NR_LAYERS <= 8, "layer masks are 8 bits");
+
+#define LAYER_BIT(layer) (1u << (layer))
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+/**
+ * Recompute the active layers. Fn and Fn lock together bring up
+ * KB_LAYER_FN_FNLOCK, so that Fn gives back the F-keys under Fn lock.
+ */
+static void update_active(kb_layers_t *ly)
+{
+  uint8_t active = LAYER_BIT(KB_LAYER_BASE) | ly->toggled | ly->oneshot;
+  for (int i = 0; i < KB_NR_LAYERS; i++) {
+    if (ly->nr_held[i] != 0) {
+      active |= LAYER_BIT(i);
+    }
+  }
+  if ((active & LAYER_BIT(KB_LAYER_FN)) && (active & LAYER_BIT(KB_LAYER_FNLOCK))) {
+    active |= LAYER_BIT(KB_LAYER_FN_FNLOCK);
+  }
+  ly->active = active;
+}
+
+static bool is_fkey(int hidkey)
+{
+  return hidkey >= KEY_F1 && hidkey <= KEY_F12;
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+void kb_keymap_build(kb_keymap_t *km)
+{
+  const kb_keymap_model_t *model = keymap_get_model();
+
+  memset(km, 0, sizeof(*km));
+
+  for (int i = 0; i < model->nr_keys; i++) {
+    const keytable_t *item = &model->kbtbl[i];
+    km->plane[KB_LAYER_BASE][item->scan1][item->scan2] = ACT_KEY(item->hidcode);
+  }
+
+  // Fn + a key without a Fn function does nothing
+  for (int i = 0; i < KB_NR_COLS; i++) {
+    for (int j = 0; j < KB_NR_ROWS; j++) {
+      km->plane[KB_LAYER_FN][i][j] = ACT_NONE;
+    }
+  }
+  for (int i = 0; i < model->nr_fn_keys; i++) {
+    const fn_keytable_t *item = &model->fntbl[i];
+    kb_action_t act = item->hidcode != 0
+      ? ACT_CONSUMER(item->hidcode) : ACT_FN(item->fncode);
+    int hidkey = search_hid_key(item->scan1, item->scan2);
+
+    km->plane[KB_LAYER_FN][item->scan1][item->scan2] = act;
+    // Fn lock turns the F-keys into their Fn functions...
+    if (is_fkey(hidkey)) {
+      km->plane[KB_LAYER_FNLOCK][item->scan1][item->scan2] = act;
+    }
+  }
+  // ...and Fn gives the F-keys back
+  for (int i = 0; i < model->nr_keys; i++) {
+    const keytable_t *item = &model->kbtbl[i];
+    if (is_fkey(item->hidcode)) {
+      km->plane[KB_LAYER_FN_FNLOCK][item->scan1][item->scan2] = ACT_KEY(item->hidcode);
+    }
+  }
+
+  for (int i = 0; i < model->nr_usr_keys; i++) {
+    const usr_keytable_t *item = &model->usrtbl[i];
+    km->plane[item->layer][item->scan1][item->scan2] = item->action;
+  }
+}
+
+bool kb_action_is_valid(kb_action_t act)
+{
+  int arg = ACT_ARG(act);
+
+  switch (ACT_KIND(act)) {
+  case ACT_KIND_TRNS:
+  case ACT_KIND_NONE:
+    return arg == 0;
+  case ACT_KIND_KEY:
+    return arg <= 0xff;
+  case ACT_KIND_LAYER_MO:
+  case ACT_KIND_LAYER_TG:
+  case ACT_KIND_LAYER_OS:
+    return arg < KB_NR_LAYERS;
+  case ACT_KIND_MOD_TAP:
+    return ACT_HOLD_ARG(act) <= KEY_RIGHTMETA - KEY_LEFTCTRL;
+  case ACT_KIND_LAYER_TAP:
+    return ACT_HOLD_ARG(act) < KB_NR_LAYERS;
+  case ACT_KIND_CONSUMER:
+  case ACT_KIND_FN:
+  case ACT_KIND_MACRO:
+  case ACT_KIND_LEADER:
+  case ACT_KIND_TEXT:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool kb_keymap_is_valid(const kb_keymap_t *km)
+{
+  for (int l = 0; l < KB_NR_LAYERS; l++) {
+    for (int i = 0; i < KB_NR_COLS; i++) {
+      for (int j = 0; j < KB_NR_ROWS; j++) {
+        if (!kb_action_is_valid(km->plane[l][i][j])) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+void kb_layers_init(kb_layers_t *ly, const kb_keymap_t *km)
+{
+  memset(ly, 0, sizeof(*ly));
+  ly->keymap = km;
+  update_active(ly);
+}
+
+kb_action_t kb_layers_resolve(const kb_layers_t *ly, unsigned col, unsigned row)
+{
+  if (col >= KB_NR_COLS || row >= KB_NR_ROWS) {
+    return ACT_NONE;
+  }
+  for (uint32_t active = ly->active; active != 0; ) {
+    int layer = 31 - __builtin_clz(active);
+    kb_action_t act = ly->keymap->plane[layer][col][row];
+    if (act != ACT_TRNS) {
+      return act;
+    }
+    active &= ~LAYER_BIT(layer);
+  }
+  return ACT_NONE;
+}
+
+void kb_layers_hold(kb_layers_t *ly, unsigned layer, bool is_press)
+{
+  if (layer >= KB_NR_LAYERS) {
+    return;
+  }
+  if (is_press) {
+    ly->nr_held[layer]++;
+  } else if (ly->nr_held[layer] != 0) {
+    ly->nr_held[layer]--;
+  }
+  update_active(ly);
+}
+
+void kb_layers_toggle(kb_layers_t *ly, unsigned layer)
+{
+  if (layer >= KB_NR_LAYERS) {
+    return;
+  }
+  ly->toggled ^= LAYER_BIT(layer);
+  update_active(ly);
+}
+
+void kb_layers_oneshot(kb_layers_t *ly, unsigned layer)
+{
+  if (layer >= KB_NR_LAYERS) {
+    return;
+  }
+  ly->oneshot |= LAYER_BIT(layer);
+  update_active(ly);
+}
+
+void kb_layers_oneshot_done(kb_layers_t *ly)
+{
+  if (ly->oneshot != 0) {
+    ly->oneshot = 0;
+    update_active(ly);
+  }
+}
+
+void kb_layers_release_all(kb_layers_t *ly)
+{
+  memset(ly->nr_held, 0, sizeof(ly->nr_held));
+  ly->oneshot = 0;
+  update_active(ly);
+}
+
+bool kb_layers_is_on(const kb_layers_t *ly, unsigned layer)
+{
+  return layer < KB_NR_LAYERS && (ly->active & LAYER_BIT(layer));
+}
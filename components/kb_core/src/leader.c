@@ -0,0 +1,128 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include "leader.h"
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+/**
+ * Compare two sequences by their keys, a sequence before the longer ones
+ * it begins
+ */
+static int seq_cmp(const leader_keytable_t *a, const leader_keytable_t *b)
+{
+  for (int i = 0; i < a->nr_keys && i < b->nr_keys; i++) {
+    if (a->keys[i] != b->keys[i]) {
+      return a->keys[i] < b->keys[i] ? -1 : 1;
+    }
+  }
+  return a->nr_keys - b->nr_keys;
+}
+
+/**
+ * First sequence in [lo, hi) whose key at depth is not below hidkey, or
+ * above it with is_upper. The sequences ending before depth come first.
+ */
+static int seq_bound(const kb_leader_t *ld, int lo, int hi, uint8_t hidkey,
+  bool is_upper)
+{
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    const leader_keytable_t *item = &ld->tbl[mid];
+    if (item->nr_keys <= ld->depth || item->keys[ld->depth] < hidkey
+      || (is_upper && item->keys[ld->depth] == hidkey)
+    ) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+bool kb_leader_init(kb_leader_t *ld)
+{
+  const kb_keymap_model_t *model = keymap_get_model();
+  const leader_keytable_t *tbl = model->leadertbl;
+
+  ld->tbl = NULL;
+  ld->nr_leaders = 0;
+  for (int i = 0; i < model->nr_leaders; i++) {
+    if (tbl[i].nr_keys < 1 || tbl[i].nr_keys > KB_LEADER_MAX_KEYS
+      || (i > 0 && seq_cmp(&tbl[i-1], &tbl[i]) >= 0)
+    ) {
+      return false;
+    }
+  }
+  ld->tbl = tbl;
+  ld->nr_leaders = model->nr_leaders;
+  kb_leader_start(ld);
+  return true;
+}
+
+void kb_leader_start(kb_leader_t *ld)
+{
+  ld->lo = 0;
+  ld->hi = ld->nr_leaders;
+  ld->depth = 0;
+}
+
+kb_leader_result_t kb_leader_feed(kb_leader_t *ld, uint8_t hidkey,
+  kb_action_t *act)
+{
+  if (ld->depth >= KB_LEADER_MAX_KEYS) {
+    ld->lo = ld->hi;
+    return LEADER_NONE;
+  }
+
+  ld->lo = seq_bound(ld, ld->lo, ld->hi, hidkey, false);
+  ld->hi = seq_bound(ld, ld->lo, ld->hi, hidkey, true);
+  ld->depth++;
+
+  if (ld->lo == ld->hi) {
+    return LEADER_NONE;
+  }
+  if (ld->hi - ld->lo == 1 && ld->tbl[ld->lo].nr_keys == ld->depth) {
+    *act = ld->tbl[ld->lo].action;
+    return LEADER_MATCH;
+  }
+  return LEADER_MORE;
+}
+
+bool kb_leader_end(const kb_leader_t *ld, kb_action_t *act)
+{
+  // a sequence ending here sorts first in the range
+  if (ld->depth == 0 || ld->lo == ld->hi || ld->tbl[ld->lo].nr_keys != ld->depth) {
+    return false;
+  }
+  *act = ld->tbl[ld->lo].action;
+  return true;
+}
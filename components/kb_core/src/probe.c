@@ -0,0 +1,73 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "probe.h"
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+void kb_probe_init(kb_probe_t *pb)
+{
+  pb->is_probing = false;
+  pb->is_woken = false;
+  pb->col = 0;
+}
+
+bool kb_probe_start(kb_probe_t *pb, bool is_idle, bool is_key_pressed)
+{
+  // a key held down would raise an edge at once
+  pb->is_probing = is_idle && !is_key_pressed;
+  pb->is_woken = false;
+  return pb->is_probing;
+}
+
+int kb_probe_next_col(kb_probe_t *pb)
+{
+  int col = pb->col;
+  pb->col = (col + 1) % KB_NR_COLS;
+  return col;
+}
+
+bool kb_probe_sweep(const kb_hal_t *hal)
+{
+  uint32_t col_rows[KB_NR_COLS];
+
+  hal->read_matrix(hal->ctx, col_rows);
+  for (int i = 0; i < KB_NR_COLS; i++) {
+    if (col_rows[i] != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool kb_probe_step(kb_probe_t *pb, bool is_row_edge, bool is_idle)
+{
+  if (is_row_edge) {
+    pb->is_woken = true;
+    pb->is_probing = false;
+  } else if (!is_idle) {
+    pb->is_probing = false;
+  }
+  return pb->is_probing;
+}
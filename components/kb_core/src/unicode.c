@@ -0,0 +1,157 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "unicode.h"
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+static bool is_keypad(int hidkey)
+{
+  return hidkey >= KEY_KPSLASH && hidkey <= KEY_KPDOT;
+}
+
+/**
+ * Append the taps of the digits of a number
+ * @param steps output
+ * @param p_nr_steps steps so far, updated
+ * @param n number
+ * @param base 10 or 16
+ * @param min_digits zero padded to this many digits
+ * @param is_keypad_digit 0~9 on the keypad, which Alt codes need
+ * @return false if a key is missing
+ */
+static bool tap_digits(kb_macro_step_t *steps, int *p_nr_steps, uint32_t n,
+  uint32_t base, int min_digits, bool is_keypad_digit)
+{
+  char digits[8];
+  int nr_digits = 0;
+
+  do {
+    digits[nr_digits++] = "0123456789abcdef"[n % base];
+    n /= base;
+  } while (n != 0 || nr_digits < min_digits);
+
+  for (int i = 0; i < nr_digits; i++) {
+    char c = digits[nr_digits - 1 - i];
+    int hidkey;
+    if (is_keypad_digit && c >= '0' && c <= '9') {
+      hidkey = c == '0' ? KEY_KP0 : KEY_KP1 + (c - '1');
+    } else {
+      hidkey = kb_ascii_to_hid(c);
+    }
+    if (hidkey < 0) {
+      return false;
+    }
+    steps[(*p_nr_steps)++] = MACRO_TAP(hidkey);
+  }
+  return true;
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+int kb_ascii_to_hid(int c)
+{
+  const kb_keymap_model_t *model = keymap_get_model();
+
+  for (int i = 0; i < model->nr_keys; i++) {
+    const keytable_t *item = &model->kbtbl[i];
+    if (item->ascii == c && !is_keypad(item->hidcode)) {
+      return item->hidcode;
+    }
+  }
+  return -1;
+}
+
+bool kb_unicode_encode(kb_unicode_mode_t mode, uint32_t cp,
+  kb_macro_step_t steps[KB_UNICODE_MAX_STEPS])
+{
+  int n = 0;
+  bool is_ok;
+
+  if (cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff)) {
+    return false;
+  }
+
+  // the ascii column only tells the unshifted character of a key, which
+  // is reliable for letters, digits and space
+  bool is_upper = cp >= 'A' && cp <= 'Z';
+  int hidkey = -1;
+  if ((cp >= 'a' && cp <= 'z') || (cp >= '0' && cp <= '9') || cp == ' ' || is_upper) {
+    hidkey = kb_ascii_to_hid(is_upper ? (int)cp - 'A' + 'a' : (int)cp);
+  }
+  if (hidkey >= 0) {
+    if (is_upper) {
+      steps[n++] = MACRO_DOWN(KEY_LEFTSHIFT);
+    }
+    steps[n++] = MACRO_TAP(hidkey);
+    steps[n++] = MACRO_END;
+    return true;
+  }
+
+  switch (mode) {
+  case UNICODE_LINUX:
+    steps[n++] = MACRO_DOWN(KEY_LEFTCTRL);
+    steps[n++] = MACRO_DOWN(KEY_LEFTSHIFT);
+    steps[n++] = MACRO_TAP(KEY_U);
+    steps[n++] = MACRO_UP(KEY_LEFTSHIFT);
+    steps[n++] = MACRO_UP(KEY_LEFTCTRL);
+    is_ok = tap_digits(steps, &n, cp, 16, 1, false);
+    steps[n++] = MACRO_TAP(KEY_SPACE);
+    break;
+  case UNICODE_WINDOWS_HEX:
+    steps[n++] = MACRO_DOWN(KEY_LEFTALT);
+    steps[n++] = MACRO_TAP(KEY_KPPLUS);
+    is_ok = tap_digits(steps, &n, cp, 16, 1, true);
+    break;
+  case UNICODE_WINDOWS_ALT:
+    // a leading 0 picks the ANSI code page, which is Latin-1 below 256
+    steps[n++] = MACRO_DOWN(KEY_LEFTALT);
+    is_ok = tap_digits(steps, &n, cp, 10, cp < 0x100 ? 4 : 1, true);
+    break;
+  case UNICODE_MACOS:
+    steps[n++] = MACRO_DOWN(KEY_LEFTALT);
+    if (cp >= 0x10000) {
+      // a surrogate pair
+      cp -= 0x10000;
+      if (!tap_digits(steps, &n, 0xd800 | (cp >> 10), 16, 4, false)) {
+        return false;
+      }
+      cp = 0xdc00 | (cp & 0x3ff);
+    }
+    is_ok = tap_digits(steps, &n, cp, 16, 4, false);
+    break;
+  default:
+    return false;
+  }
+  if (!is_ok) {
+    return false;
+  }
+  // MACRO_END releases the modifiers still held
+  steps[n++] = MACRO_END;
+  return true;
+}
@@ -19,9 +19,41 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "tusb.h"
 #include "tinyusb.h"
 
+// NKRO report: modifier byte + bitmap of usages 0x00-0xDF
+#define TUSB_HID_NKRO_REPORT_LEN 29
+
+// Reports waiting for the endpoint, per report ID
+#define TUSB_HID_QUEUE_DEPTH 8
+
+// Keyboard, mouse, consumer and NKRO, numbered from 1, the queued ones
+#define TUSB_HID_NR_REPORT_IDS 4
+
+// Keymap feature report without its ID, as much as a control transfer to
+// the HID class takes, CFG_TUD_HID_EP_BUFSIZE
+#define TUSB_HID_KEYMAP_REPORT_LEN 31
+
+/**
+ * @brief Report queue statistics of one report ID
+ */
+typedef struct {
+    uint32_t depth;         // reports queued now
+    uint32_t max_depth;     // most reports queued at once
+    uint32_t sent;          // reports sent
+    uint32_t dropped;       // reports dropped on a full queue
+    uint32_t max_wait_us;   // longest time from queueing to sending
+    uint64_t total_wait_us; // sum of the waits of the reports sent
+} tinyusb_hid_queue_stats_t;
+
+
+/*
+ * The reports below are queued per report ID and sent in order without
+ * waiting for the endpoint. The keyboard, the mouse and the consumer control
+ * have an interface and an endpoint each, see tinyusb_hid_get_queue_stats().
+ */
 
 /**
  * @brief Report mouse movement and buttons.
@@ -46,6 +78,65 @@ void tinyusb_hid_keyboard_report(uint8_t *keycode);
  */
 void tinyusb_hid_consumer_report(uint16_t keycode);
 
+/**
+ * @brief Report key press in the keyboard, using bitmap here for N-key rollover.
+ * @param report modifier byte followed by the key bitmap, TUSB_HID_NKRO_REPORT_LEN bytes
+ */
+void tinyusb_hid_nkro_report(uint8_t *report);
+
+/**
+ * @brief Whether the host has selected the boot protocol, where only the
+ * 6-key keyboard report can be used.
+ */
+bool tinyusb_hid_is_boot_protocol(void);
+
+/**
+ * @brief Whether a keyboard report can be queued without being dropped.
+ * While suspended, sending a report wakes up the host instead.
+ */
+bool tinyusb_hid_is_ready(void);
+
+/**
+ * @brief Drop the queued reports. A transfer cut off by a bus reset or
+ * suspend never completes, so the queues start over on the next connection.
+ */
+void tinyusb_hid_flush_queues(void);
+
+/**
+ * @brief Send the reports left queued by a refused transfer, for when the
+ * host is back from a reset or a suspend.
+ */
+void tinyusb_hid_send_queued(void);
+
+/**
+ * @brief Get the report queue statistics.
+ * @param stats output, indexed by report ID - 1
+ */
+void tinyusb_hid_get_queue_stats(tinyusb_hid_queue_stats_t stats[TUSB_HID_NR_REPORT_IDS]);
+
+/**
+ * @brief Invoked when a report has reached the host, so that the next one
+ * can be sent. Weak, to be overridden by the application.
+ */
+void kb_report_complete_cb(void);
+
+/**
+ * @brief Invoked when the host writes the keymap feature report. Weak, to be
+ * overridden by the application.
+ * @param buf report without its ID
+ * @param len report length
+ */
+void kb_keymap_set_report_cb(const uint8_t *buf, uint16_t len);
+
+/**
+ * @brief Invoked when the host reads the keymap feature report. Weak, to be
+ * overridden by the application.
+ * @param buf output, without the report ID
+ * @param len room in buf
+ * @return the report length, 0 to stall the request
+ */
+uint16_t kb_keymap_get_report_cb(uint8_t *buf, uint16_t len);
+
 #ifdef __cplusplus
 }
 #endif
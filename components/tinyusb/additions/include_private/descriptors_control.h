@@ -26,15 +26,35 @@
  */
 #define EPNUM_MSC 0x03
 
+// HID interrupt IN endpoints, one per interface
+#define EPNUM_HID_KEYBOARD 0x84
+#define EPNUM_HID_MOUSE 0x85
+#define EPNUM_HID_CONSUMER 0x86
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 //------------- HID Report Descriptor -------------//
 #if CFG_TUD_HID
+// HID instances, in the order of their interfaces
+enum {
+    HID_INSTANCE_KEYBOARD = 0,
+    HID_INSTANCE_MOUSE,
+    HID_INSTANCE_CONSUMER,
+};
+
+/*
+ * Only the keyboard interface has several reports and puts the report ID on
+ * the wire. The mouse and consumer reports are alone on their interfaces, and
+ * their IDs only number the report queues. The keymap feature report has no
+ * queue, it only goes over the control pipe.
+ */
 enum {
     REPORT_ID_KEYBOARD = 1,
     REPORT_ID_MOUSE,
     REPORT_ID_CONSUMER,
+    REPORT_ID_NKRO,
+    REPORT_ID_KEYMAP,
 };
 #endif
 
@@ -50,7 +70,9 @@ enum {
 #   endif
 
 #   if CFG_TUD_HID
-    ITF_NUM_HID,
+    ITF_NUM_HID_KEYBOARD,
+    ITF_NUM_HID_MOUSE,
+    ITF_NUM_HID_CONSUMER,
 #   endif
 
     ITF_NUM_TOTAL
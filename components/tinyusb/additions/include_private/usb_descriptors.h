@@ -21,7 +21,8 @@
 extern "C" {
 #endif
 
-#define _PID_MAP(itf, n) ((CFG_TUD_##itf) << (n))
+// One bit per class, whatever the number of its interfaces
+#define _PID_MAP(itf, n) (((CFG_TUD_##itf) > 0) << (n))
 
 extern tusb_desc_device_t descriptor_tinyusb;
 extern tusb_desc_strarray_device_t descriptor_str_tinyusb;
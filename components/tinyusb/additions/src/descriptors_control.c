@@ -14,6 +14,7 @@
 
 #include "esp_log.h"
 #include "descriptors_control.h"
+#include "tusb_hid.h"
 
 static const char *TAG = "tusb_desc";
 static tusb_desc_device_t s_descriptor;
@@ -81,11 +82,59 @@ static uint8_t *s_config_descriptor = NULL;
     HID_COLLECTION_END                                            , \
   HID_COLLECTION_END \
 
-#if CFG_TUD_HID //HID Report Descriptor
-uint8_t const desc_hid_report[] = {
+// N-key rollover Keyboard Report Descriptor Template
+// modifier byte, then one bit for each usage in 0x00-0xDF
+#define MY_HID_REPORT_DESC_NKRO(...) \
+  HID_USAGE_PAGE ( HID_USAGE_PAGE_DESKTOP      )                   ,\
+  HID_USAGE      ( HID_USAGE_DESKTOP_KEYBOARD  )                   ,\
+  HID_COLLECTION ( HID_COLLECTION_APPLICATION  )                   ,\
+    /* Report ID if any */\
+    __VA_ARGS__ \
+    /* 8 bits Modifier Keys (Shift, Control, Alt) */ \
+    HID_USAGE_PAGE  ( HID_USAGE_PAGE_KEYBOARD )                    ,\
+      HID_USAGE_MIN   ( 224                                    )   ,\
+      HID_USAGE_MAX   ( 231                                    )   ,\
+      HID_LOGICAL_MIN ( 0                                      )   ,\
+      HID_LOGICAL_MAX ( 1                                      )   ,\
+      HID_REPORT_COUNT( 8                                      )   ,\
+      HID_REPORT_SIZE ( 1                                      )   ,\
+      HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE )   ,\
+      /* 224 bits key bitmap */ \
+      HID_USAGE_MIN   ( 0                                      )   ,\
+      HID_USAGE_MAX   ( 223                                    )   ,\
+      HID_REPORT_COUNT( 224                                    )   ,\
+      HID_REPORT_SIZE ( 1                                      )   ,\
+      HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE )   ,\
+  HID_COLLECTION_END \
+
+// Vendor-defined feature report for uploading a keymap, see keymap_hid.h
+#define MY_HID_REPORT_DESC_KEYMAP(report_size, ...) \
+  HID_USAGE_PAGE_N ( HID_USAGE_PAGE_VENDOR, 2  )                   ,\
+  HID_USAGE      ( 0x01                        )                   ,\
+  HID_COLLECTION ( HID_COLLECTION_APPLICATION  )                   ,\
+    /* Report ID if any */\
+    __VA_ARGS__ \
+    HID_USAGE       ( 0x02                                     )   ,\
+    HID_LOGICAL_MIN ( 0x00                                     )   ,\
+    HID_LOGICAL_MAX_N ( 0xff, 2                                )   ,\
+    HID_REPORT_COUNT( report_size                              )   ,\
+    HID_REPORT_SIZE ( 8                                        )   ,\
+    HID_FEATURE     ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE   )   ,\
+  HID_COLLECTION_END \
+
+#if CFG_TUD_HID //HID Report Descriptors, one per interface
+uint8_t const desc_hid_keyboard_report[] = {
     TUD_HID_REPORT_DESC_KEYBOARD(HID_REPORT_ID(REPORT_ID_KEYBOARD)),
-    MY_HID_REPORT_DESC_MOUSE(HID_REPORT_ID(REPORT_ID_MOUSE)),
-    TUD_HID_REPORT_DESC_CONSUMER(HID_REPORT_ID(REPORT_ID_CONSUMER))
+    MY_HID_REPORT_DESC_NKRO(HID_REPORT_ID(REPORT_ID_NKRO)),
+    MY_HID_REPORT_DESC_KEYMAP(TUSB_HID_KEYMAP_REPORT_LEN, HID_REPORT_ID(REPORT_ID_KEYMAP))
+};
+
+uint8_t const desc_hid_mouse_report[] = {
+    MY_HID_REPORT_DESC_MOUSE()
+};
+
+uint8_t const desc_hid_consumer_report[] = {
+    TUD_HID_REPORT_DESC_CONSUMER()
 };
 #endif
 
@@ -103,7 +152,13 @@ uint8_t const desc_configuration[] = {
 #   endif
 #   if CFG_TUD_HID
     // Interface number, string index, protocol, report descriptor len, EP In address, size & polling interval
-    TUD_HID_DESCRIPTOR(ITF_NUM_HID, 6, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), 0x84, 16, 10)
+    // A separate endpoint for each, so that a stream of mouse reports never holds a key back
+    TUD_HID_DESCRIPTOR(ITF_NUM_HID_KEYBOARD, 6, HID_ITF_PROTOCOL_KEYBOARD, sizeof(desc_hid_keyboard_report),
+                       EPNUM_HID_KEYBOARD, CFG_TUD_HID_EP_BUFSIZE, CONFIG_TINYUSB_HID_KEYBOARD_INTERVAL),
+    TUD_HID_DESCRIPTOR(ITF_NUM_HID_MOUSE, 6, HID_ITF_PROTOCOL_MOUSE, sizeof(desc_hid_mouse_report),
+                       EPNUM_HID_MOUSE, 8, CONFIG_TINYUSB_HID_MOUSE_INTERVAL),
+    TUD_HID_DESCRIPTOR(ITF_NUM_HID_CONSUMER, 6, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_consumer_report),
+                       EPNUM_HID_CONSUMER, 8, CONFIG_TINYUSB_HID_CONSUMER_INTERVAL)
 #   endif
 };
 
@@ -187,8 +242,14 @@ uint16_t const *tud_descriptor_string_cb(uint8_t index, uint16_t langid)
 uint8_t const *tud_hid_descriptor_report_cb(uint8_t itf)
 {
     ESP_LOGD("TUSB", "%s(%u)", __func__, itf);
-    (void)itf;
-    return desc_hid_report;
+    switch (itf) {
+    case HID_INSTANCE_MOUSE:
+        return desc_hid_mouse_report;
+    case HID_INSTANCE_CONSUMER:
+        return desc_hid_consumer_report;
+    default:
+        return desc_hid_keyboard_report;
+    }
 }
 #endif
 
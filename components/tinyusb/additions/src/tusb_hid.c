@@ -14,7 +14,9 @@
 
 
 #include <stdint.h>
+#include <string.h>
 #include "esp_err.h"
+#include "esp_timer.h"
 #include "sdkconfig.h"
 #include "esp_log.h"
 #include "tusb_hid.h"
@@ -25,6 +27,237 @@ static const char *TAG = "tusb_hid";
 
 uint8_t curr_resolution_multiplier = 1;
 
+// boot protocol reports, without report ID
+#define HID_BOOT_KEYBOARD_LEN 8
+#define HID_BOOT_MOUSE_LEN 3
+
+// keyboard usage filling the key slots when too many keys are held
+#define HID_USAGE_ERROR_ROLLOVER 0x01
+
+/**
+ * Reports of one report ID waiting for the endpoint of its interface. The
+ * senders only push, and each endpoint sends one report at a time: the first
+ * from the sender when the endpoint is idle, the next from
+ * tud_hid_report_complete_cb().
+ *
+ * A report is queued in both the report and the boot protocol encodings, so
+ * that the one the host asked for last is picked when it is sent.
+ */
+typedef struct {
+    uint8_t len;
+    uint8_t buf[TUSB_HID_NKRO_REPORT_LEN];
+    uint8_t boot_len;               // 0 when there is no boot report
+    uint8_t boot[HID_BOOT_KEYBOARD_LEN];
+    uint32_t seq;                   // order across the report IDs
+    int64_t time_us;                // when it was queued
+} hid_queued_report_t;
+
+typedef struct {
+    hid_queued_report_t report[TUSB_HID_QUEUE_DEPTH];
+    uint32_t head;
+    uint32_t count;                 // reports in the queue, those being sent included
+    uint32_t nr_sending;            // reports from the head handed to tud_hid_n_report()
+    tinyusb_hid_queue_stats_t stats;
+} hid_queue_t;
+
+/**
+ * Where the reports of a report ID go
+ */
+typedef struct {
+    uint8_t instance;               // HID interface
+    uint8_t report_id;              // on the wire, 0 when alone on the interface
+} hid_route_t;
+
+// indexed by report ID - 1
+static const hid_route_t hid_routes[TUSB_HID_NR_REPORT_IDS] = {
+    [REPORT_ID_KEYBOARD - 1] = { HID_INSTANCE_KEYBOARD, REPORT_ID_KEYBOARD },
+    [REPORT_ID_MOUSE - 1] = { HID_INSTANCE_MOUSE, 0 },
+    [REPORT_ID_CONSUMER - 1] = { HID_INSTANCE_CONSUMER, 0 },
+    [REPORT_ID_NKRO - 1] = { HID_INSTANCE_KEYBOARD, REPORT_ID_NKRO },
+};
+
+// indexed by report ID - 1
+static hid_queue_t hid_queues[TUSB_HID_NR_REPORT_IDS];
+static uint32_t hid_seq = 0;
+static bool is_in_flight[CFG_TUD_HID];  // a queued report is on the endpoint
+static portMUX_TYPE hid_queue_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// how long to wait before sending again a report the endpoint refused, a frame
+#define HID_RETRY_US 1000
+
+static esp_timer_handle_t hid_retry_timer = NULL;
+
+static void hid_retry_cb(void *arg)
+{
+    (void) arg;
+    tinyusb_hid_send_queued();
+}
+
+/**
+ * Send the queued reports again shortly. Not while unplugged or suspended,
+ * tinyusb_hid_send_queued() is called on mount and resume for that.
+ */
+static void hid_retry_later(void)
+{
+    static bool is_creating = false;
+
+    if (!tud_mounted() || tud_suspended()) {
+        return;
+    }
+    if (__atomic_load_n(&hid_retry_timer, __ATOMIC_ACQUIRE) == NULL) {
+        if (__atomic_exchange_n(&is_creating, true, __ATOMIC_ACQ_REL)) {
+            // another task is creating it and will retry
+            return;
+        }
+        const esp_timer_create_args_t args = {
+            .callback = hid_retry_cb,
+            .name = "hid_retry",
+        };
+        esp_timer_handle_t timer;
+        if (esp_timer_create(&args, &timer) != ESP_OK) {
+            ESP_LOGE(TAG, "no retry timer");
+            __atomic_store_n(&is_creating, false, __ATOMIC_RELEASE);
+            return;
+        }
+        __atomic_store_n(&hid_retry_timer, timer, __ATOMIC_RELEASE);
+    }
+    // already armed when another interface was refused too
+    esp_timer_start_once(hid_retry_timer, HID_RETRY_US);
+}
+
+/**
+ * Send the oldest report queued for an interface unless one is already on
+ * its endpoint. The report keeps its slot until tud_hid_n_report() takes it,
+ * counted in nr_sending, so that the completion of a fast transfer can never
+ * send it twice and a push can never take its slot. A refused report stays
+ * queued in order and is sent again from a timer.
+ */
+static void hid_queue_send_next(uint8_t instance)
+{
+    hid_queue_t *q = NULL;
+    hid_queued_report_t report;
+
+    portENTER_CRITICAL(&hid_queue_lock);
+    if (!is_in_flight[instance]) {
+        for (int i = 0; i < TUSB_HID_NR_REPORT_IDS; i++) {
+            hid_queue_t *cur = &hid_queues[i];
+            if (hid_routes[i].instance != instance || cur->count <= cur->nr_sending) {
+                continue;
+            }
+            uint32_t seq = cur->report[(cur->head + cur->nr_sending) % TUSB_HID_QUEUE_DEPTH].seq;
+            if (q == NULL || (int32_t)(seq - report.seq) < 0) {
+                q = cur;
+                report = cur->report[(cur->head + cur->nr_sending) % TUSB_HID_QUEUE_DEPTH];
+            }
+        }
+    }
+    if (q != NULL) {
+        q->nr_sending++;
+        is_in_flight[instance] = true;
+    }
+    portEXIT_CRITICAL(&hid_queue_lock);
+
+    if (q == NULL) {
+        return;
+    }
+
+    bool is_sent;
+    if (report.boot_len > 0 && tud_hid_n_get_protocol(instance) == HID_PROTOCOL_BOOT) {
+        is_sent = tud_hid_n_ready(instance)
+            && tud_hid_n_report(instance, 0, report.boot, report.boot_len);
+    } else {
+        is_sent = tud_hid_n_ready(instance)
+            && tud_hid_n_report(instance, hid_routes[q - hid_queues].report_id, report.buf, report.len);
+    }
+    uint32_t wait_us = esp_timer_get_time() - report.time_us;
+
+    portENTER_CRITICAL(&hid_queue_lock);
+    // none after tinyusb_hid_flush_queues()
+    if (q->nr_sending > 0) {
+        q->nr_sending--;
+        if (is_sent) {
+            q->head = (q->head + 1) % TUSB_HID_QUEUE_DEPTH;
+            q->count--;
+        }
+    }
+    if (is_sent) {
+        q->stats.sent++;
+        q->stats.total_wait_us += wait_us;
+        if (wait_us > q->stats.max_wait_us) {
+            q->stats.max_wait_us = wait_us;
+        }
+    } else {
+        is_in_flight[instance] = false;
+    }
+    portEXIT_CRITICAL(&hid_queue_lock);
+
+    if (!is_sent) {
+        hid_retry_later();
+    }
+}
+
+/**
+ * Queue a report without waiting for the endpoint, and send it right away
+ * if the endpoint of its interface is idle. A report that does not fit is
+ * dropped.
+ * @param boot the boot protocol report, NULL if none
+ */
+static void hid_queue_push(uint8_t report_id, const void *buf, uint8_t len,
+    const void *boot, uint8_t boot_len)
+{
+    hid_queue_t *q = &hid_queues[report_id - 1];
+    int64_t now = esp_timer_get_time();
+    bool is_dropped = false;
+
+    portENTER_CRITICAL(&hid_queue_lock);
+    if (q->count < TUSB_HID_QUEUE_DEPTH) {
+        hid_queued_report_t *report = &q->report[(q->head + q->count) % TUSB_HID_QUEUE_DEPTH];
+        report->len = len;
+        memcpy(report->buf, buf, len);
+        report->boot_len = boot_len;
+        if (boot_len > 0) {
+            memcpy(report->boot, boot, boot_len);
+        }
+        report->seq = hid_seq++;
+        report->time_us = now;
+        q->count++;
+        if (q->count > q->stats.max_depth) {
+            q->stats.max_depth = q->count;
+        }
+    } else {
+        q->stats.dropped++;
+        is_dropped = true;
+    }
+    portEXIT_CRITICAL(&hid_queue_lock);
+
+    if (is_dropped) {
+        ESP_LOGD(TAG, "report %d dropped, queue full", report_id);
+    }
+    hid_queue_send_next(hid_routes[report_id - 1].instance);
+}
+
+/**
+ * The boot report of an NKRO report, for when the host switches to the boot
+ * protocol with NKRO reports still queued. Past 6 keys, every key slot
+ * reports ErrorRollOver.
+ */
+static void nkro_to_boot(const uint8_t *nkro, hid_keyboard_report_t *boot)
+{
+    int n = 0;
+
+    memset(boot, 0, sizeof(*boot));
+    boot->modifier = nkro[0];
+    for (int i = 1; i < TUSB_HID_NKRO_REPORT_LEN; i++) {
+        for (uint8_t bits = nkro[i]; bits != 0; bits &= bits - 1) {
+            if (n == sizeof(boot->keycode)) {
+                memset(boot->keycode, HID_USAGE_ERROR_ROLLOVER, sizeof(boot->keycode));
+                return;
+            }
+            boot->keycode[n++] = (i - 1) * 8 + __builtin_ctz(bits);
+        }
+    }
+}
+
 void tinyusb_hid_mouse_report(
     uint8_t buttons, int8_t x, int8_t y, int8_t vertical, int8_t horizontal)
 {
@@ -37,18 +270,15 @@ void tinyusb_hid_mouse_report(
         // and REMOTE_WAKEUP feature is enabled by host
         tud_remote_wakeup();
     } else {
-        // Send the 1st of report chain, the rest will be sent by tud_hid_report_complete_cb()
-        // skip if hid is not ready yet
-        int i = 0;
-        for (; i < 5 && !tud_hid_ready(); i++) {
-            vTaskDelay(5);
-        }
-        if (i >= 5) {
-            ESP_LOGW(__func__, "tinyusb not ready");
-            return;
-        }
-
-        tud_hid_mouse_report(REPORT_ID_MOUSE, buttons, x, y, vertical, horizontal);
+        hid_mouse_report_t report = {
+            .buttons = buttons,
+            .x = x,
+            .y = y,
+            .wheel = vertical,
+            .pan = horizontal,
+        };
+        // the boot report is buttons, x and y
+        hid_queue_push(REPORT_ID_MOUSE, &report, sizeof(report), &report, HID_BOOT_MOUSE_LEN);
     }
 }
 
@@ -63,18 +293,13 @@ void tinyusb_hid_keyboard_report(uint8_t *keycode)
         // and REMOTE_WAKEUP feature is enabled by host
         tud_remote_wakeup();
     } else {
-        // Send the 1st of report chain, the rest will be sent by tud_hid_report_complete_cb()
-        // skip if hid is not ready yet
-        int i = 0;
-        for (; i < 5 && !tud_hid_ready(); i++) {
-            vTaskDelay(5);
-        }
-        if (i >= 5) {
-            ESP_LOGW(__func__, "tinyusb not ready");
-            return;
-        }
-
-        tud_hid_keyboard_report(REPORT_ID_KEYBOARD, keycode[0], &keycode[2]);
+        // modifier, reserved, 6 keys
+        hid_keyboard_report_t report = {
+            .modifier = keycode[0],
+        };
+        memcpy(report.keycode, &keycode[2], sizeof(report.keycode));
+        // the same in both protocols, the boot one has no report ID
+        hid_queue_push(REPORT_ID_KEYBOARD, &report, sizeof(report), &report, sizeof(report));
     }
 }
 
@@ -88,30 +313,99 @@ void tinyusb_hid_consumer_report(uint16_t keycode)
         // and REMOTE_WAKEUP feature is enabled by host
         tud_remote_wakeup();
     } else {
-        // Send the 1st of report chain, the rest will be sent by tud_hid_report_complete_cb()
-        // skip if hid is not ready yet
-        int i = 0;
-        for (; i < 5 && !tud_hid_ready(); i++) {
-            vTaskDelay(5);
-        }
-        if (i >= 5) {
-            ESP_LOGW(__func__, "tinyusb not ready");
-            return;
-        }
+        hid_queue_push(REPORT_ID_CONSUMER, &keycode, sizeof(keycode), NULL, 0);
+    }
+}
+
+void tinyusb_hid_nkro_report(uint8_t *report)
+{
+    ESP_LOGD(TAG, "nkro: %02x", report[0]);
+
+    // Remote wakeup
+    if (tud_suspended()) {
+        // Wake up host if we are in suspend mode
+        // and REMOTE_WAKEUP feature is enabled by host
+        tud_remote_wakeup();
+    } else {
+        hid_keyboard_report_t boot;
+        nkro_to_boot(report, &boot);
+        hid_queue_push(REPORT_ID_NKRO, report, TUSB_HID_NKRO_REPORT_LEN, &boot, sizeof(boot));
+    }
+}
+
+bool tinyusb_hid_is_boot_protocol(void)
+{
+    return tud_hid_n_get_protocol(HID_INSTANCE_KEYBOARD) == HID_PROTOCOL_BOOT;
+}
+
+bool tinyusb_hid_is_ready(void)
+{
+    bool is_full;
+
+    portENTER_CRITICAL(&hid_queue_lock);
+    is_full = hid_queues[REPORT_ID_KEYBOARD - 1].count >= TUSB_HID_QUEUE_DEPTH
+        || hid_queues[REPORT_ID_NKRO - 1].count >= TUSB_HID_QUEUE_DEPTH;
+    portEXIT_CRITICAL(&hid_queue_lock);
+    return tud_suspended() || !is_full;
+}
+
+void tinyusb_hid_flush_queues(void)
+{
+    int dropped = 0;
 
-        tud_hid_report(REPORT_ID_CONSUMER, &keycode, sizeof(keycode));
+    portENTER_CRITICAL(&hid_queue_lock);
+    for (int i = 0; i < TUSB_HID_NR_REPORT_IDS; i++) {
+        dropped += hid_queues[i].count;
+        hid_queues[i].stats.dropped += hid_queues[i].count;
+        hid_queues[i].head = 0;
+        hid_queues[i].count = 0;
+        hid_queues[i].nr_sending = 0;
+    }
+    for (int i = 0; i < CFG_TUD_HID; i++) {
+        is_in_flight[i] = false;
+    }
+    portEXIT_CRITICAL(&hid_queue_lock);
+
+    if (dropped > 0) {
+        ESP_LOGI(TAG, "%d queued reports flushed", dropped);
+    }
+}
+
+void tinyusb_hid_send_queued(void)
+{
+    for (uint8_t i = 0; i < CFG_TUD_HID; i++) {
+        hid_queue_send_next(i);
     }
 }
 
+void tinyusb_hid_get_queue_stats(tinyusb_hid_queue_stats_t stats[TUSB_HID_NR_REPORT_IDS])
+{
+    portENTER_CRITICAL(&hid_queue_lock);
+    for (int i = 0; i < TUSB_HID_NR_REPORT_IDS; i++) {
+        stats[i] = hid_queues[i].stats;
+        stats[i].depth = hid_queues[i].count;
+    }
+    portEXIT_CRITICAL(&hid_queue_lock);
+}
+
 /************************************************** TinyUSB callbacks ***********************************************/
 // Invoked when sent REPORT successfully to host
 // Application can use this to send the next report
 // Note: For composite reports, report[0] is report ID
 void tud_hid_report_complete_cb(uint8_t itf, uint8_t const *report, uint8_t len)
 {
-    (void) itf;
     (void) report;
     (void) len;
+
+    // chain the next queued report of this interface
+    portENTER_CRITICAL(&hid_queue_lock);
+    is_in_flight[itf] = false;
+    portEXIT_CRITICAL(&hid_queue_lock);
+    hid_queue_send_next(itf);
+
+    if (itf == HID_INSTANCE_KEYBOARD) {
+        kb_report_complete_cb();
+    }
 }
 
 // Invoked when received GET_REPORT control request
@@ -119,13 +413,12 @@ void tud_hid_report_complete_cb(uint8_t itf, uint8_t const *report, uint8_t len)
 // Return zero will cause the stack to STALL request
 uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t *buffer, uint16_t reqlen)
 {
-    (void) instance;
     // esp_backtrace_print(8);
     // ESP_LOGI(TAG, "get instance %d, report id %d, report type %d, len %d", 
     //   instance, report_id, report_type, reqlen);
 
     if (report_type == HID_REPORT_TYPE_FEATURE) {
-      if (report_id == REPORT_ID_MOUSE && reqlen >= 1) {
+      if (instance == HID_INSTANCE_MOUSE && reqlen >= 1) {
         /**
          * Return the resolution multiplier for high-resolution pointer & wheel.
          * Windows may deliberately aquire for this parameter, whereas Linux may not...
@@ -133,6 +426,12 @@ uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_t
         buffer[0] = curr_resolution_multiplier;
         return 1;
       }
+      if (instance == HID_INSTANCE_KEYBOARD && report_id == REPORT_ID_KEYMAP && reqlen >= 1) {
+        // this TinyUSB leaves the report ID of a GET_REPORT answer to us
+        buffer[0] = REPORT_ID_KEYMAP;
+        uint16_t len = kb_keymap_get_report_cb(&buffer[1], reqlen - 1);
+        return len > 0 ? len + 1 : 0;
+      }
     }
 
     return 0;
@@ -144,24 +443,43 @@ void __attribute__((weak)) kb_led_cb(uint8_t kbd_leds)
     ESP_LOGI(TAG, "LED: 0x%02x", kbd_leds);
 }
 
+// My template report chaining callback
+void __attribute__((weak)) kb_report_complete_cb(void)
+{
+}
+
+// My template keymap upload callbacks, reading the report stalls
+void __attribute__((weak)) kb_keymap_set_report_cb(const uint8_t *buf, uint16_t len)
+{
+    (void) buf;
+    (void) len;
+}
+
+uint16_t __attribute__((weak)) kb_keymap_get_report_cb(uint8_t *buf, uint16_t len)
+{
+    (void) buf;
+    (void) len;
+    return 0;
+}
+
 // Invoked when received SET_REPORT control request or
 // received data on OUT endpoint ( Report ID = 0, Type = 0 )
 void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t const* buffer, uint16_t bufsize)
 {
-  (void) instance;
   ESP_LOGI(TAG, "set instance %d, report id %d, report type %d, len %d, buf[0] 0x%02x", 
     instance, report_id, report_type, bufsize, buffer[0]);
 
   if (report_type == HID_REPORT_TYPE_OUTPUT) {
     // Set keyboard LED e.g Capslock, Numlock etc...
-    if (report_id == REPORT_ID_KEYBOARD) {
+    // The boot protocol output report has no report ID
+    if (instance == HID_INSTANCE_KEYBOARD && (report_id == REPORT_ID_KEYBOARD || report_id == 0)) {
       // bufsize should be (at least) 1
       if ( bufsize < 1 ) return;
 
       kb_led_cb(buffer[0]);
     }
   } else if (report_type == HID_REPORT_TYPE_FEATURE) {
-    if (report_id == REPORT_ID_MOUSE) {
+    if (instance == HID_INSTANCE_MOUSE) {
       /**
        * Set the resolution multiplier.
        * Windows should set it on connection.
@@ -169,6 +487,16 @@ void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_
       if (bufsize >= 1) {
         curr_resolution_multiplier = buffer[0];
       }
+    } else if (instance == HID_INSTANCE_KEYBOARD && report_id == REPORT_ID_KEYMAP) {
+      kb_keymap_set_report_cb(buffer, bufsize);
     }
   }
 }
+
+// Invoked when received SET_PROTOCOL request
+// The reports already queued carry both encodings and need no rebuilding
+void tud_hid_set_protocol_cb(uint8_t instance, uint8_t protocol)
+{
+  ESP_LOGI(TAG, "set instance %d, protocol %s", instance,
+    protocol == HID_PROTOCOL_BOOT ? "boot" : "report");
+}
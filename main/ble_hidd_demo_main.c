@@ -32,7 +32,9 @@
 #include "esp_pm.h"
 #include "esp_sleep.h"
 
+#include "keyboard.h"
 #include "keyboard_pm.h"
+#include "keymap_hid.h"
 
 /**
  * Brief:
@@ -144,6 +146,10 @@ static void hidd_event_callback(esp_hidd_cb_event_t event, esp_hidd_cb_param_t *
             kb_led_cb(param->vendor_write.data[0]);
             break;
         }
+        case ESP_HIDD_EVENT_BLE_REPORT_SENT_EVT: {
+            kb_report_complete_cb();
+            break;
+        }
         default:
             break;
     }
@@ -156,6 +162,13 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
     case ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT:
         esp_ble_gap_start_advertising(&hidd_adv_params);
         break;
+    case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
+        ESP_LOGI(HID_DEMO_TAG, "conn params status %d, interval %d",
+            param->update_conn_params.status, param->update_conn_params.conn_int);
+        if (param->update_conn_params.status == ESP_BT_STATUS_SUCCESS) {
+            kb_ble_conn_params_cb(param->update_conn_params.conn_int);
+        }
+        break;
     case ESP_GAP_BLE_SEC_REQ_EVT:
         for(int i = 0; i < ESP_BD_ADDR_LEN; i++) {
             ESP_LOGD(HID_DEMO_TAG, "%x:",param->ble_security.ble_req.bd_addr[i]);
@@ -244,6 +257,6 @@ void app_main(void)
     esp_ble_gap_set_security_param(ESP_BLE_SM_SET_INIT_KEY, &init_key, sizeof(uint8_t));
     esp_ble_gap_set_security_param(ESP_BLE_SM_SET_RSP_KEY, &rsp_key, sizeof(uint8_t));
 
-    void keyboard_task(void *arg);
     xTaskCreate(&keyboard_task,  "kb_task", 4096, NULL, configMAX_PRIORITIES, NULL);
+    init_keymap_hid();
 }
@@ -18,6 +18,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "esp_log.h"
+#include "esp_gatt_common_api.h"
 
 // HID keyboard input report length
 #define HID_KEYBOARD_IN_RPT_LEN     8
@@ -31,6 +32,12 @@
 // HID consumer control input report length
 #define HID_CC_IN_RPT_LEN           2
 
+// HID NKRO keyboard input report length
+#define HID_NKRO_IN_RPT_LEN         29
+
+// Local ATT MTU, enough for the NKRO report in one notification
+#define HIDD_LE_LOCAL_MTU           64
+
 extern uint16_t hid_conn_id;
 extern bool is_ble_connected;
 
@@ -66,6 +73,7 @@ esp_err_t esp_hidd_profile_init(void)
     // Reset the hid device target environment
     memset(&hidd_le_env, 0, sizeof(hidd_le_env_t));
     hidd_le_env.enabled = true;
+    esp_ble_gatt_set_local_mtu(HIDD_LE_LOCAL_MTU);
     return ESP_OK;
 }
 
@@ -117,6 +125,35 @@ void esp_hidd_send_keyboard_value(uint8_t *buffer)
     return;
 }
 
+void esp_hidd_send_nkro_value(uint8_t *buffer)
+{
+    if (!is_ble_connected) {
+        return;
+    }
+
+    ESP_LOGD(HID_LE_PRF_TAG, "the nkro modifier = %d", buffer[0]);
+    hid_dev_send_report(hidd_le_env.gatt_if, hid_conn_id,
+        HID_RPT_ID_NKRO_IN, HID_REPORT_TYPE_INPUT, HID_NKRO_IN_RPT_LEN, buffer);
+    return;
+}
+
+bool esp_hidd_is_nkro_ready(void)
+{
+    // a notification carries MTU-3 bytes of the report
+    return hidProtocolMode == HID_PROTOCOL_MODE_REPORT
+        && hidd_le_mtu >= HID_NKRO_IN_RPT_LEN + 3;
+}
+
+bool esp_hidd_is_keyboard_ready(void)
+{
+    return !is_ble_connected || hid_dev_is_key_queue_ready();
+}
+
+void esp_hidd_get_report_stats(esp_hidd_report_stats_t *stats)
+{
+    hid_dev_get_report_stats(stats);
+}
+
 void esp_hidd_send_mouse_value(uint8_t buttons, 
     int8_t dx, int8_t dy, int8_t vertical, int8_t horizontal)
 {
@@ -15,6 +15,7 @@
 #ifndef __ESP_HIDD_API_H__
 #define __ESP_HIDD_API_H__
 
+#include <stdbool.h>
 #include "esp_bt_defs.h"
 #include "esp_gatt_defs.h"
 #include "esp_err.h"
@@ -31,6 +32,7 @@ typedef enum {
     ESP_HIDD_EVENT_BLE_DISCONNECT,
     ESP_HIDD_EVENT_BLE_VENDOR_REPORT_WRITE_EVT,
     ESP_HIDD_EVENT_BLE_LED_OUT_WRITE_EVT,
+    ESP_HIDD_EVENT_BLE_REPORT_SENT_EVT,
 } esp_hidd_cb_event_t;
 
 /// HID config status
@@ -159,9 +161,55 @@ void esp_hidd_send_consumer_value(uint16_t key);
 
 void esp_hidd_send_keyboard_value(uint8_t *buffer);
 
+void esp_hidd_send_nkro_value(uint8_t *buffer);
+
+/**
+ *
+ * @brief           Whether the NKRO report can be sent
+ *
+ * @return          true if in report protocol and the MTU fits the report
+ *
+ */
+bool esp_hidd_is_nkro_ready(void);
+
+/**
+ *
+ * @brief           Whether a keyboard report can be sent now. Reports are
+ *                  queued and paced by the notifications the stack has
+ *                  confirmed sent, see ESP_HIDD_EVENT_BLE_REPORT_SENT_EVT
+ *
+ * @return          true if the key report queue has room
+ *
+ */
+bool esp_hidd_is_keyboard_ready(void);
+
 void esp_hidd_send_mouse_value(uint8_t buttons, 
     int8_t dx, int8_t dy, int8_t vertical, int8_t horizontal);
 
+/// Report counters of one report class
+typedef struct {
+    uint32_t sent;                  /*!< notifications handed to the stack */
+    uint32_t coalesced;             /*!< reports merged into a queued one */
+    uint32_t dropped;               /*!< reports lost on a full queue */
+} esp_hidd_report_count_t;
+
+/// Report scheduler counters
+typedef struct {
+    esp_hidd_report_count_t key;    /*!< keyboard, NKRO and consumer reports */
+    esp_hidd_report_count_t mouse;  /*!< mouse reports */
+    uint32_t congested;             /*!< times the stack became congested */
+    uint32_t send_failed;           /*!< notifications refused by the stack and retried */
+} esp_hidd_report_stats_t;
+
+/**
+ *
+ * @brief           Get the report scheduler counters, kept since boot
+ *
+ * @param[out]      stats: the counters
+ *
+ */
+void esp_hidd_get_report_stats(esp_hidd_report_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
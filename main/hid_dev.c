@@ -18,10 +18,51 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+// HID mouse input report: buttons, X, Y, wheel, AC pan
+#define HID_DEV_MOUSE_RPT_LEN       5
 
 static hid_report_map_t *hid_dev_rpt_tbl;
 static uint8_t hid_dev_rpt_tbl_Len;
 
+/**
+ * A report waiting for the stack to take it
+ */
+typedef struct {
+    uint8_t id;
+    uint8_t type;
+    uint8_t length;
+    uint8_t data[HID_DEV_REPORT_MAX_LEN];
+} hid_dev_queued_report_t;
+
+typedef struct {
+    hid_dev_queued_report_t report[HID_DEV_KEY_QUEUE_DEPTH];
+    uint8_t head;
+    uint8_t count;
+    uint8_t depth;
+    bool is_head_sending;   // the head is being handed to the stack
+} hid_dev_queue_t;
+
+/*
+ * Key state reports (keyboard, NKRO and consumer) and mouse reports wait in
+ * separate queues, and the key queue always goes first. Notifications are
+ * handed to the stack while fewer than HIDD_LE_MAX_INFLIGHT are unconfirmed
+ * and the stack is not congested, so its TX queue never overflows and drops
+ * a key release. The last slot of the key queue is kept for a report of an
+ * ID not queued yet, see hid_dev_is_key_queue_ready().
+ */
+static hid_dev_queue_t hid_dev_key_queue = { .depth = HID_DEV_KEY_QUEUE_DEPTH };
+static hid_dev_queue_t hid_dev_mouse_queue = { .depth = HID_DEV_MOUSE_QUEUE_DEPTH };
+static esp_hidd_report_stats_t hid_dev_stats;
+static bool hid_dev_is_congested = false;
+static bool hid_dev_is_sending = false;     // a context is handing reports to the stack
+static esp_gatt_if_t hid_dev_gatts_if;
+static uint16_t hid_dev_conn_id;
+static esp_timer_handle_t hid_dev_retry_timer = NULL;
+static portMUX_TYPE hid_dev_lock = portMUX_INITIALIZER_UNLOCKED;
+
 static hid_report_map_t *hid_dev_rpt_by_id(uint8_t id, uint8_t type)
 {
     hid_report_map_t *rpt = hid_dev_rpt_tbl;
@@ -35,28 +76,279 @@ static hid_report_map_t *hid_dev_rpt_by_id(uint8_t id, uint8_t type)
     return NULL;
 }
 
+static hid_dev_queued_report_t *hid_dev_queue_at(hid_dev_queue_t *q, int i)
+{
+    return &q->report[(q->head + i) % q->depth];
+}
+
+/**
+ * Hand the queued reports to the stack, key reports first, until the stack
+ * cannot take more. Only one context sends at a time, and the others leave
+ * their reports to it, so the reports keep their order. The report being
+ * sent keeps its slot until the stack takes it, so a refused one stays at
+ * the head and no queued report is ever written over it.
+ */
+static void hid_dev_send_pending(void)
+{
+    for (;;) {
+        hid_dev_queue_t *q = NULL;
+        hid_dev_queued_report_t report;
+
+        portENTER_CRITICAL(&hid_dev_lock);
+        if (!hid_dev_is_sending && !hid_dev_is_congested
+            && hidd_le_nr_inflight < HIDD_LE_MAX_INFLIGHT) {
+            if (hid_dev_key_queue.count > 0) {
+                q = &hid_dev_key_queue;
+            } else if (hid_dev_mouse_queue.count > 0) {
+                q = &hid_dev_mouse_queue;
+            }
+        }
+        if (q != NULL) {
+            report = *hid_dev_queue_at(q, 0);
+            q->is_head_sending = true;
+            hidd_le_nr_inflight++;
+            hid_dev_is_sending = true;
+        }
+        portEXIT_CRITICAL(&hid_dev_lock);
+
+        if (q == NULL) {
+            return;
+        }
+
+        // get att handle for report, which depends on the protocol mode
+        hid_report_map_t *p_rpt = hid_dev_rpt_by_id(report.id, report.type);
+        esp_err_t ret = ESP_FAIL;
+        if (p_rpt != NULL) {
+            ESP_LOGD(HID_LE_PRF_TAG, "%s(), send the report, handle = %d", __func__, p_rpt->handle);
+            ret = esp_ble_gatts_send_indicate(hid_dev_gatts_if, hid_dev_conn_id,
+                p_rpt->handle, report.length, report.data, false);
+        }
+
+        portENTER_CRITICAL(&hid_dev_lock);
+        esp_hidd_report_count_t *count = q == &hid_dev_key_queue ? &hid_dev_stats.key : &hid_dev_stats.mouse;
+        hid_dev_is_sending = false;
+        if (ret == ESP_OK) {
+            count->sent++;
+        } else {
+            hidd_le_nr_inflight--;
+        }
+        if (p_rpt == NULL) {
+            // no such report in this protocol mode
+            count->dropped++;
+        }
+        if (ret != ESP_OK && p_rpt != NULL) {
+            // left at the head, retried when the stack has room
+            hid_dev_stats.send_failed++;
+        } else if (q->is_head_sending) {
+            // not after hid_dev_reset_reports()
+            q->head = (q->head + 1) % q->depth;
+            q->count--;
+        }
+        q->is_head_sending = false;
+        portEXIT_CRITICAL(&hid_dev_lock);
+
+        if (ret != ESP_OK && p_rpt != NULL) {
+            // nothing may be in flight to trigger the retry
+            esp_timer_stop(hid_dev_retry_timer);
+            esp_timer_start_once(hid_dev_retry_timer, HID_DEV_RETRY_US);
+            return;
+        }
+    }
+}
+
+static void hid_dev_retry_cb(void *arg)
+{
+    (void)arg;
+    hid_dev_send_pending();
+}
+
+/**
+ * Queue a key state report. When the queue is full, the newest report of the
+ * same ID is replaced, so the last state of that report still reaches the
+ * host even if a transition in between is lost; that counts as coalesced. A
+ * report of another ID is never replaced: with none of the same ID, the new
+ * report is dropped.
+ */
+static void hid_dev_queue_key(uint8_t id, uint8_t type, uint8_t length, const uint8_t *data)
+{
+    hid_dev_queue_t *q = &hid_dev_key_queue;
+    hid_dev_queued_report_t *report = NULL;
+    int first = q->is_head_sending ? 1 : 0;
+
+    if (q->count < q->depth) {
+        report = hid_dev_queue_at(q, q->count);
+        q->count++;
+    } else {
+        for (int i = q->count - 1; i >= first && report == NULL; i--) {
+            if (hid_dev_queue_at(q, i)->id == id) {
+                report = hid_dev_queue_at(q, i);
+            }
+        }
+        if (report == NULL) {
+            hid_dev_stats.key.dropped++;
+            return;
+        }
+        hid_dev_stats.key.coalesced++;
+    }
+    report->id = id;
+    report->type = type;
+    report->length = length;
+    memcpy(report->data, data, length);
+}
+
+static int8_t hid_dev_add_delta(int8_t a, int8_t b, bool *is_clipped)
+{
+    int sum = a + b;
+    if (sum > INT8_MAX || sum < -INT8_MAX) {
+        *is_clipped = true;
+        return sum > 0 ? INT8_MAX : -INT8_MAX;
+    }
+    return sum;
+}
+
+/**
+ * Queue a mouse report. The motion is added to the newest queued report as
+ * long as its buttons are the same. When the queue is full, the newest
+ * report takes the new buttons as well, and a click in between is lost.
+ */
+static void hid_dev_queue_mouse(uint8_t id, uint8_t type, uint8_t length, const uint8_t *data)
+{
+    hid_dev_queue_t *q = &hid_dev_mouse_queue;
+    int first = q->is_head_sending ? 1 : 0;
+    hid_dev_queued_report_t *tail = q->count > first ? hid_dev_queue_at(q, q->count - 1) : NULL;
+
+    if (tail != NULL && length == HID_DEV_MOUSE_RPT_LEN
+        && (tail->data[0] == data[0] || q->count == q->depth)) {
+        hid_dev_queued_report_t merged = *tail;
+        bool is_clipped = tail->data[0] != data[0];
+        merged.data[0] = data[0];
+        for (int i = 1; i < HID_DEV_MOUSE_RPT_LEN; i++) {
+            merged.data[i] = hid_dev_add_delta(tail->data[i], data[i], &is_clipped);
+        }
+        if (!is_clipped) {
+            *tail = merged;
+            hid_dev_stats.mouse.coalesced++;
+            return;
+        }
+        if (q->count == q->depth) {
+            *tail = merged;
+            hid_dev_stats.mouse.dropped++;
+            return;
+        }
+    }
+    if (q->count < q->depth) {
+        hid_dev_queued_report_t *report = hid_dev_queue_at(q, q->count);
+        report->id = id;
+        report->type = type;
+        report->length = length;
+        memcpy(report->data, data, length);
+        q->count++;
+    } else {
+        hid_dev_stats.mouse.dropped++;
+    }
+}
+
 void hid_dev_register_reports(uint8_t num_reports, hid_report_map_t *p_report)
 {
     hid_dev_rpt_tbl = p_report;
     hid_dev_rpt_tbl_Len = num_reports;
+
+    if (hid_dev_retry_timer == NULL) {
+        const esp_timer_create_args_t args = {
+            .callback = hid_dev_retry_cb,
+            .name = "hid_dev_retry",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&args, &hid_dev_retry_timer));
+    }
     return;
 }
 
 void hid_dev_send_report(esp_gatt_if_t gatts_if, uint16_t conn_id,
                                     uint8_t id, uint8_t type, uint8_t length, uint8_t *data)
 {
-    hid_report_map_t *p_rpt;
+    if (length > HID_DEV_REPORT_MAX_LEN) {
+        ESP_LOGE(HID_LE_PRF_TAG, "%s(), report %d too long: %d", __func__, id, length);
+        return;
+    }
 
-    // get att handle for report
-    if ((p_rpt = hid_dev_rpt_by_id(id, type)) != NULL) {
-        // if notifications are enabled
-        ESP_LOGD(HID_LE_PRF_TAG, "%s(), send the report, handle = %d", __func__, p_rpt->handle);
-        esp_ble_gatts_send_indicate(gatts_if, conn_id, p_rpt->handle, length, data, false);
+    portENTER_CRITICAL(&hid_dev_lock);
+    hid_dev_gatts_if = gatts_if;
+    hid_dev_conn_id = conn_id;
+    if (id == HID_RPT_ID_MOUSE_IN) {
+        hid_dev_queue_mouse(id, type, length, data);
+    } else {
+        hid_dev_queue_key(id, type, length, data);
     }
+    portEXIT_CRITICAL(&hid_dev_lock);
 
+    hid_dev_send_pending();
     return;
 }
 
+bool hid_dev_is_key_queue_ready(void)
+{
+    // the last slot is kept for a report of another ID
+    return __atomic_load_n(&hid_dev_key_queue.count, __ATOMIC_ACQUIRE) < HID_DEV_KEY_QUEUE_DEPTH - 1;
+}
+
+void hid_dev_report_sent(void)
+{
+    portENTER_CRITICAL(&hid_dev_lock);
+    if (hidd_le_nr_inflight > 0) {
+        hidd_le_nr_inflight--;
+    }
+    portEXIT_CRITICAL(&hid_dev_lock);
+
+    hid_dev_send_pending();
+}
+
+void hid_dev_set_congested(bool is_congested)
+{
+    portENTER_CRITICAL(&hid_dev_lock);
+    if (is_congested && !hid_dev_is_congested) {
+        hid_dev_stats.congested++;
+    }
+    hid_dev_is_congested = is_congested;
+    portEXIT_CRITICAL(&hid_dev_lock);
+
+    if (!is_congested) {
+        hid_dev_send_pending();
+    }
+}
+
+void hid_dev_reset_reports(void)
+{
+    esp_hidd_report_stats_t stats;
+
+    if (hid_dev_retry_timer != NULL) {
+        esp_timer_stop(hid_dev_retry_timer);
+    }
+
+    hid_dev_get_report_stats(&stats);
+    ESP_LOGI(HID_LE_PRF_TAG, "key reports sent %u, coalesced %u, dropped %u; mouse reports "
+        "sent %u, coalesced %u, dropped %u; congested %u, retried %u",
+        stats.key.sent, stats.key.coalesced, stats.key.dropped, stats.mouse.sent, stats.mouse.coalesced,
+        stats.mouse.dropped, stats.congested, stats.send_failed);
+
+    portENTER_CRITICAL(&hid_dev_lock);
+    hid_dev_key_queue.head = 0;
+    hid_dev_key_queue.count = 0;
+    hid_dev_key_queue.is_head_sending = false;
+    hid_dev_mouse_queue.head = 0;
+    hid_dev_mouse_queue.count = 0;
+    hid_dev_mouse_queue.is_head_sending = false;
+    hid_dev_is_congested = false;
+    hidd_le_nr_inflight = 0;
+    portEXIT_CRITICAL(&hid_dev_lock);
+}
+
+void hid_dev_get_report_stats(esp_hidd_report_stats_t *stats)
+{
+    portENTER_CRITICAL(&hid_dev_lock);
+    *stats = hid_dev_stats;
+    portEXIT_CRITICAL(&hid_dev_lock);
+}
+
 void hid_consumer_build_report(uint8_t *buffer, consumer_cmd_t cmd)
 {
     if (!buffer) {
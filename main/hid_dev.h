@@ -242,11 +242,40 @@ typedef struct
 
 } hid_dev_cfg_t;
 
+// Longest report queued for sending, the NKRO report
+#define HID_DEV_REPORT_MAX_LEN      29
+
+// Reports queued for sending, key state and mouse
+#define HID_DEV_KEY_QUEUE_DEPTH     8
+#define HID_DEV_MOUSE_QUEUE_DEPTH   4
+
+// Retry delay when the stack refuses a notification
+#define HID_DEV_RETRY_US            10000
+
 void hid_dev_register_reports(uint8_t num_reports, hid_report_map_t *p_report);
 
+/**
+ * Queue a report and hand it to the stack as soon as flow control allows.
+ * Key state reports go before mouse reports, and mouse motion is coalesced.
+ */
 void hid_dev_send_report(esp_gatt_if_t gatts_if, uint16_t conn_id,
                                     uint8_t id, uint8_t type, uint8_t length, uint8_t *data);
 
+// Whether a key state report can be queued without replacing another, with
+// a slot left for a report of another ID
+bool hid_dev_is_key_queue_ready(void);
+
+// A notification has been confirmed sent (ESP_GATTS_CONF_EVT)
+void hid_dev_report_sent(void);
+
+// The stack is congested or not any more (ESP_GATTS_CONGEST_EVT)
+void hid_dev_set_congested(bool is_congested);
+
+// Drop the queued reports of the last connection
+void hid_dev_reset_reports(void);
+
+void hid_dev_get_report_stats(esp_hidd_report_stats_t *stats);
+
 void hid_consumer_build_report(uint8_t *buffer, consumer_cmd_t cmd);
 
 void hid_keyboard_build_report(uint8_t *buffer, keyboard_cmd_t cmd);
@@ -125,6 +125,30 @@ static const uint8_t hidReportMap[] = {
     0x81, 0x00,   //   Input: (Data, Array, Abs)
     0xc0,         // End Collection
 
+    0x05, 0x01,  // Usage Pg (Generic Desktop)
+    0x09, 0x06,  // Usage (Keyboard)
+    0xA1, 0x01,  // Collection: (Application)
+    0x85, 0x05,  // Report Id (5)
+    //
+    0x05, 0x07,  //   Usage Pg (Key Codes)
+    0x19, 0xE0,  //   Usage Min (224)
+    0x29, 0xE7,  //   Usage Max (231)
+    0x15, 0x00,  //   Log Min (0)
+    0x25, 0x01,  //   Log Max (1)
+    //
+    //   Modifier byte
+    0x75, 0x01,  //   Report Size (1)
+    0x95, 0x08,  //   Report Count (8)
+    0x81, 0x02,  //   Input: (Data, Variable, Absolute)
+    //
+    //   Key bitmap (28 bytes)
+    0x19, 0x00,  //   Usage Min (0)
+    0x29, 0xDF,  //   Usage Max (223)
+    0x95, 0xE0,  //   Report Count (224)
+    0x81, 0x02,  //   Input: (Data, Variable, Absolute)
+    //
+    0xC0,        // End Collection
+
 #if (SUPPORT_REPORT_VENDOR == true)
     0x06, 0xFF, 0xFF, // Usage Page(Vendor defined)
     0x09, 0xA5,       // Usage(Vendor Defined)
@@ -168,9 +192,15 @@ struct gatts_profile_inst {
 hidd_le_env_t hidd_le_env;
 
 // HID report map length
-uint8_t hidReportMapLen = sizeof(hidReportMap);
+uint16_t hidReportMapLen = sizeof(hidReportMap);
 uint8_t hidProtocolMode = HID_PROTOCOL_MODE_REPORT;
 
+// ATT MTU of the current connection
+uint16_t hidd_le_mtu = ESP_GATT_DEF_BLE_MTU_SIZE;
+
+// Notifications handed to the stack and not confirmed sent yet
+uint32_t hidd_le_nr_inflight = 0;
+
 // HID report mapping table
 //static hidRptMap_t  hidRptMap[HID_NUM_REPORTS];
 
@@ -212,6 +242,10 @@ static uint8_t hidReportRefFeature[HID_REPORT_REF_LEN] =
 static uint8_t hidReportRefCCIn[HID_REPORT_REF_LEN] =
              { HID_RPT_ID_CC_IN, HID_REPORT_TYPE_INPUT };
 
+// HID Report Reference characteristic descriptor, NKRO key input
+static uint8_t hidReportRefNkroIn[HID_REPORT_REF_LEN] =
+             { HID_RPT_ID_NKRO_IN, HID_REPORT_TYPE_INPUT };
+
 
 /*
  *  Heart Rate PROFILE ATTRIBUTES
@@ -434,6 +468,27 @@ static esp_gatts_attr_db_t hidd_le_gatt_db[HIDD_LE_IDX_NB] =
                                                                        sizeof(hidReportRefCCIn), sizeof(hidReportRefCCIn),
                                                                        hidReportRefCCIn}},
 
+    // Report Characteristic Declaration
+    [HIDD_LE_IDX_REPORT_NKRO_IN_CHAR]       = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid,
+                                                                         ESP_GATT_PERM_READ,
+                                                                         CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE,
+                                                                         (uint8_t *)&char_prop_read_notify}},
+    // Report Characteristic Value
+    [HIDD_LE_IDX_REPORT_NKRO_IN_VAL]        = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&hid_report_uuid,
+                                                                       ESP_GATT_PERM_READ,
+                                                                       HIDD_LE_REPORT_MAX_LEN, 0,
+                                                                       NULL}},
+    // Report NKRO INPUT Characteristic - Client Characteristic Configuration Descriptor
+    [HIDD_LE_IDX_REPORT_NKRO_IN_CCC]        = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&character_client_config_uuid,
+                                                                      (ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE),
+                                                                      sizeof(uint16_t), 0,
+                                                                      NULL}},
+     // Report Characteristic - Report Reference Descriptor
+    [HIDD_LE_IDX_REPORT_NKRO_IN_REP_REF]    = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&hid_report_ref_descr_uuid,
+                                                                       ESP_GATT_PERM_READ,
+                                                                       sizeof(hidReportRefNkroIn), sizeof(hidReportRefNkroIn),
+                                                                       hidReportRefNkroIn}},
+
     // Boot Keyboard Input Report Characteristic Declaration
     [HIDD_LE_IDX_BOOT_KB_IN_REPORT_CHAR] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid,
                                                                         ESP_GATT_PERM_READ,
@@ -522,6 +577,11 @@ void esp_hidd_prf_cb_hdl(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
             break;
         }
         case ESP_GATTS_CONF_EVT: {
+            // a notification has left, the next report may go
+            hid_dev_report_sent();
+            if(hidd_le_env.hidd_cb != NULL) {
+                (hidd_le_env.hidd_cb)(ESP_HIDD_EVENT_BLE_REPORT_SENT_EVT, NULL);
+            }
             break;
         }
         case ESP_GATTS_CREATE_EVT:
@@ -532,6 +592,10 @@ void esp_hidd_prf_cb_hdl(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
 			memcpy(cb_param.connect.remote_bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
             cb_param.connect.conn_id = param->connect.conn_id;
             hidd_clcb_alloc(param->connect.conn_id, param->connect.remote_bda);
+            // a new connection starts in report protocol with the default MTU
+            hidProtocolMode = HID_PROTOCOL_MODE_REPORT;
+            hidd_le_mtu = ESP_GATT_DEF_BLE_MTU_SIZE;
+            hid_dev_reset_reports();
             esp_ble_set_encryption(param->connect.remote_bda, ESP_BLE_SEC_ENCRYPT_NO_MITM);
             if(hidd_le_env.hidd_cb != NULL) {
                 (hidd_le_env.hidd_cb)(ESP_HIDD_EVENT_BLE_CONNECT, &cb_param);
@@ -539,6 +603,7 @@ void esp_hidd_prf_cb_hdl(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
             break;
         }
         case ESP_GATTS_DISCONNECT_EVT: {
+            hid_dev_reset_reports();
 			 if(hidd_le_env.hidd_cb != NULL) {
                     (hidd_le_env.hidd_cb)(ESP_HIDD_EVENT_BLE_DISCONNECT, NULL);
              }
@@ -547,8 +612,20 @@ void esp_hidd_prf_cb_hdl(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
         }
         case ESP_GATTS_CLOSE_EVT:
             break;
+        case ESP_GATTS_MTU_EVT:
+            hidd_le_mtu = param->mtu.mtu;
+            break;
+        case ESP_GATTS_CONGEST_EVT:
+            hid_dev_set_congested(param->congest.congested);
+            break;
         case ESP_GATTS_WRITE_EVT: {
             esp_hidd_cb_param_t cb_param = {0};
+            if (param->write.handle == hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_PROTO_MODE_VAL] &&
+                param->write.len >= HID_PROTOCOL_MODE_LEN) {
+                // the host switches between boot and report protocol
+                hidProtocolMode = param->write.value[0];
+                ESP_LOGI(HID_LE_PRF_TAG, "protocol mode %d", hidProtocolMode);
+            }
             if (param->write.handle == hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_LED_OUT_VAL] &&
                 hidd_le_env.hidd_cb != NULL) {
                 cb_param.vendor_write.conn_id = param->write.conn_id;
@@ -772,6 +849,13 @@ static void hid_add_id_tbl(void)
       hid_rpt_map[7].cccdHandle = 0;
       hid_rpt_map[7].mode = HID_PROTOCOL_MODE_REPORT;
 
+      // NKRO key input report
+      hid_rpt_map[8].id = hidReportRefNkroIn[0];
+      hid_rpt_map[8].type = hidReportRefNkroIn[1];
+      hid_rpt_map[8].handle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_NKRO_IN_VAL];
+      hid_rpt_map[8].cccdHandle = hidd_le_env.hidd_inst.att_tbl[HIDD_LE_IDX_REPORT_NKRO_IN_CCC];
+      hid_rpt_map[8].mode = HID_PROTOCOL_MODE_REPORT;
+
 
   // Setup report ID map
   hid_dev_register_reports(HID_NUM_REPORTS, hid_rpt_map);
@@ -48,6 +48,7 @@
 #define HID_RPT_ID_KEY_IN        2   // Keyboard input report ID
 #define HID_RPT_ID_CC_IN         3   //Consumer Control input report ID
 #define HID_RPT_ID_VENDOR_OUT    4   // Vendor output report ID
+#define HID_RPT_ID_NKRO_IN       5   // NKRO keyboard input report ID
 #define HID_RPT_ID_LED_OUT       2  // LED output report ID
 #define HID_RPT_ID_FEATURE       0  // Feature report ID
 
@@ -69,6 +70,9 @@
 /// Length of Boot Report Char. Value Maximal Length
 #define HIDD_LE_BOOT_REPORT_MAX_LEN           (8)
 
+/// Maximal number of notifications handed to the stack before the keyboard reports wait
+#define HIDD_LE_MAX_INFLIGHT                  (4)
+
 /// Boot KB Input Report Notification Configuration Bit Mask
 #define HIDD_LE_BOOT_KB_IN_NTF_CFG_MASK       (0x40)
 /// Boot KB Input Report Notification Configuration Bit Mask
@@ -153,6 +157,11 @@ enum {
     HIDD_LE_IDX_REPORT_CC_IN_VAL,
     HIDD_LE_IDX_REPORT_CC_IN_CCC,
     HIDD_LE_IDX_REPORT_CC_IN_REP_REF,
+    //Report NKRO key input
+    HIDD_LE_IDX_REPORT_NKRO_IN_CHAR,
+    HIDD_LE_IDX_REPORT_NKRO_IN_VAL,
+    HIDD_LE_IDX_REPORT_NKRO_IN_CCC,
+    HIDD_LE_IDX_REPORT_NKRO_IN_REP_REF,
 
     // Boot Keyboard Input Report
     HIDD_LE_IDX_BOOT_KB_IN_REPORT_CHAR,
@@ -325,6 +334,8 @@ typedef struct {
 
 extern hidd_le_env_t hidd_le_env;
 extern uint8_t hidProtocolMode;
+extern uint16_t hidd_le_mtu;
+extern uint32_t hidd_le_nr_inflight;
 
 
 void hidd_clcb_alloc (uint16_t conn_id, esp_bd_addr_t bda);
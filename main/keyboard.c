@@ -27,6 +27,8 @@
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "sdkconfig.h"
 #include "esp_log.h"
 
@@ -45,6 +47,7 @@
 #include "esp_pm.h"
 #include "esp_sleep.h"
 #include "esp_timer.h"
+#include "esp_rom_sys.h"
 
 #include <sys/fcntl.h>
 #include <sys/errno.h>
@@ -52,7 +55,17 @@
 #include <sys/select.h>
 
 #include "pin_cfg.h"
+#include "keyboard.h"
 #include "keyboard_pm.h"
+#include "matrix.h"
+#include "kb_core.h"
+#include "keymap_store.h"
+
+// A header compiled by tools/keymapc replaces the keymap-*.c tables as
+// the fallback keymap, e.g. -DKB_KEYMAP_HEADER='"e580.h"'
+#ifdef KB_KEYMAP_HEADER
+#include KB_KEYMAP_HEADER
+#endif
 
 /****************************************************************
  * 
@@ -60,9 +73,49 @@
  * 
  ****************************************************************/
 
-// #define USE_FN_TRACKPOINT_PAN
-#define SCALE_TRACKPOINT_SPEED
-#define MOUSE_SCALE_MIN 1
+#define USE_NKRO
+
+// DEBOUNCE_EAGER_PRESS, DEBOUNCE_DEFER_SYM or DEBOUNCE_COUNTER
+#define KB_DEBOUNCE_ALGO DEBOUNCE_EAGER_PRESS
+#define KB_DEBOUNCE_US   5000
+
+// input method of the host for ACT_TEXT, see kb_unicode_mode_t
+#define KB_UNICODE_MODE  UNICODE_LINUX
+
+// time for the rows to settle after selecting a column, when no row can
+// be measured
+#define KB_COL_SETTLE_US 5
+
+// Settle calibration: a row left low by the previous column only reads
+// released once its pull-up has charged it, the slow edge of a column
+// change. Each row is discharged and its rise timed, the slowest of
+// KB_SETTLE_PROBE_TRIES tries, and the dwell is twice the slowest row.
+#define KB_SETTLE_PROBE_TRIES     2
+#define KB_SETTLE_TIMEOUT_NS      20000
+#define KB_SETTLE_MIN_DWELL_NS    500
+
+// Model detection: rows 16/17 only reach the FPC of a keyboard with the
+// numpad. A wired row rises slower than KB_MODEL_RISE_NS after being
+// discharged, taking the fastest of KB_MODEL_PROBE_TRIES tries. The rise
+// times are logged and kept in kb_model_info_t. The keymap is only
+// selected from them with USE_MODEL_DETECT, which stays off until the
+// threshold is measured on both models and the E530 keymap is filled in.
+// #define USE_MODEL_DETECT
+#define KB_MODEL_PROBE_TRIES      4
+#define KB_MODEL_RISE_NS          600
+#define KB_MODEL_RISE_TIMEOUT_NS  5000
+
+// Log the scan timing statistics of kb_get_scan_stats() every
+// KB_SCAN_STATS_LOG_US while scanning. The log line itself delays the
+// next scan, which is left out of the statistics.
+// #define USE_SCAN_STATS_LOG
+#define KB_SCAN_STATS_LOG_US      10000000
+
+// BLE keepalive while a shorter connection interval is negotiated: one
+// report per connection event, for KB_KEEPALIVE_TIMEOUT_US at most. The
+// interval is KB_KEEPALIVE_DEFAULT_US until the host reports one.
+#define KB_KEEPALIVE_TIMEOUT_US   15000000
+#define KB_KEEPALIVE_DEFAULT_US   30000
 
 /****************************************************************
  * 
@@ -71,20 +124,73 @@
  ****************************************************************/
 
 static bool is_init_finish = false;
-static bool is_fn_locked = 0;
-
-// keyboard pin array
-static uint rowscan_pins[18] = {
-  KB_ROW_0, KB_ROW_1, KB_ROW_2, KB_ROW_3, KB_ROW_4, KB_ROW_5, KB_ROW_6, KB_ROW_7,
-  KB_ROW_8, KB_ROW_9, KB_ROW_10, KB_ROW_11, KB_ROW_12, KB_ROW_13, KB_ROW_14, KB_ROW_15,
-  KB_ROW_16, KB_ROW_17,
-};
 
 // UART1 fd for select()
 static int uart1_fd = -1;
 
-static uint wakeup_time = 0;
-static const uint wakeup_period_us = 15000000;
+/**
+ * The host takes a new connection interval sooner when the link has
+ * notifications to carry. The keepalive sends the current key state again
+ * once per connection event without other traffic, until the interval
+ * asked for is confirmed.
+ */
+typedef struct {
+  bool is_active;
+  uint start_us;
+  uint period_us;       // connection interval in effect
+  uint nr_sent;         // keepalive notifications
+  uint nr_burst_est;    // estimate of what the former dummy burst would
+                        // have sent, from the scan period, not counted
+  uint burst_us;        // time the estimate is counted up to
+} kb_keepalive_t;
+
+static kb_keepalive_t keepalive = { .period_us = KB_KEEPALIVE_DEFAULT_US };
+static esp_timer_handle_t keepalive_timer = NULL;
+static volatile bool is_keepalive_due = false;
+static portMUX_TYPE keepalive_lock = portMUX_INITIALIZER_UNLOCKED;
+// held across a start, a stop or a new period, timer included
+static SemaphoreHandle_t keepalive_mutex = NULL;
+static volatile uint last_keyboard_report_us = 0;
+
+// scanner -> report task
+static kb_scanner_t kb_scanner;
+static kb_event_ring_t kb_events;
+static kb_reporter_t kb_reporter;
+// double-buffered keymaps in RAM: the one in use, and the one kb_set_keymap()
+// writes and swaps in. The stored or compiled-in keymap starts in kb_keymaps[0].
+static kb_keymap_t kb_keymaps[2];
+static kb_combos_t kb_combos;
+static kb_leader_t kb_leader;
+static TaskHandle_t report_task_handle = NULL;
+
+// PS2 reader task -> mouse task
+static QueueHandle_t ps2_queue = NULL;
+static kb_mouse_t kb_mouse;
+
+// periodic scan timer, notifying the keyboard task
+static esp_timer_handle_t scan_timer = NULL;
+static uint scan_period_us = 0;   // 0 when the timer is stopped
+
+// idle probe instead of the scan timer while nobody is typing
+static kb_probe_t kb_probe;
+
+static kb_scan_stats_t scan_stats;
+static uint64_t scan_jitter_sum_us = 0;
+static uint last_scan_us = 0;
+static bool is_scan_restarted = true;
+#ifdef USE_SCAN_STATS_LOG
+static uint scan_stats_log_us = 0;
+#endif
+static portMUX_TYPE scan_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// guarded by scan_stats_lock
+static kb_settle_calib_t settle_calib = {
+  .dwell_ns = KB_COL_SETTLE_US * 1000,
+};
+
+// detected at boot by detect_model()
+static kb_model_info_t model_info;
+static uint32_t model_row_mask = KB_ROW_MASK;
 
 // backlight duration
 static const int MAX_BACKLIGHT_ON_US = 10*60*1000000;
@@ -124,11 +230,59 @@ static void ps2_write_2(uint8_t ch);
 static void init_usb(void);
 static void init_trackpad(void);
 static void init_matrix_keyboard(void);
+static void detect_model(void);
+static void calibrate_settle(void);
 
-static void kb_set_column_scan(int n);
 static void do_fnfunc(fn_function_t fncode);
 static void led_task(void *arg);
-static void poll_trackpoint(uint poll_ms);
+static void ps2_task(void *arg);
+static void mouse_task(void *arg);
+static void poll_trackpoint(TickType_t wait);
+static void scan_timer_cb(void *arg);
+static void keepalive_start(void);
+static void keepalive_stop(const char *reason);
+static void keepalive_tick(void);
+static bool scan_timer_start(uint period_us);
+static void scan_timer_stop(void);
+static void scan_stats_update(uint now_us, uint period_us, uint scan_us);
+#ifdef USE_SCAN_STATS_LOG
+static void scan_stats_log(uint now_us);
+#endif
+static void scan_matrix(uint32_t col_rows[KB_NR_COLS]);
+static bool is_nkro_active(void);
+static void send_keyboard_report(bool is_nkro, uint8_t *buf);
+static void report_task(void *arg);
+
+static void hal_read_matrix(void *ctx, uint32_t col_rows[KB_NR_COLS]);
+static uint32_t hal_now_us(void *ctx);
+static void hal_delay_ms(void *ctx, uint32_t ms);
+static int hal_ps2_read(void *ctx, uint8_t *buf, int len, uint32_t timeout_ms);
+static void hal_ps2_flush(void *ctx);
+static bool hal_is_nkro(void *ctx);
+static bool hal_is_keyboard_ready(void *ctx);
+static void hal_send_keyboard(void *ctx, bool is_nkro, uint8_t *report);
+static void hal_send_consumer(void *ctx, uint16_t usage);
+static void hal_send_mouse(void *ctx, uint8_t buttons, int8_t dx, int8_t dy,
+  int8_t vert, int8_t hori);
+static void hal_lock_key(void *ctx, uint8_t hidkey);
+static void hal_do_fnfunc(void *ctx, fn_function_t fncode);
+
+// kb_core on top of this board
+static const kb_hal_t kb_hal = {
+  .ctx = NULL,
+  .read_matrix = hal_read_matrix,
+  .now_us = hal_now_us,
+  .delay_ms = hal_delay_ms,
+  .ps2_read = hal_ps2_read,
+  .ps2_flush = hal_ps2_flush,
+  .is_nkro = hal_is_nkro,
+  .is_keyboard_ready = hal_is_keyboard_ready,
+  .send_keyboard = hal_send_keyboard,
+  .send_consumer = hal_send_consumer,
+  .send_mouse = hal_send_mouse,
+  .lock_key = hal_lock_key,
+  .do_fnfunc = hal_do_fnfunc,
+};
 
 /****************************************************************
  * 
@@ -141,6 +295,7 @@ void tud_mount_cb(void)
 {
   is_usb_connected = true;
   printf("USB connected.\n");
+  tinyusb_hid_send_queued();
   if (is_init_finish) {
     flush_power_state(PM_CHARGING);
   }
@@ -150,6 +305,7 @@ void tud_mount_cb(void)
 void tud_umount_cb(void)
 {
   is_usb_connected = false;
+  tinyusb_hid_flush_queues();
   printf("USB disconnected\n");
 }
 
@@ -157,6 +313,7 @@ void tud_suspend_cb(bool remote_wakeup_en)
 {
   (void)remote_wakeup_en;
   is_usb_connected = false;
+  tinyusb_hid_flush_queues();
   // printf("USB suspended, %s\n");
   printf("%s(%s)\n", __func__, remote_wakeup_en ? "true" : "false");
 }
@@ -165,6 +322,7 @@ void tud_resume_cb(void)
 {
   is_usb_connected = true;
   printf("%s\n", __func__);
+  tinyusb_hid_send_queued();
   if (is_init_finish) {
     flush_power_state(PM_CHARGING);
   }
@@ -192,6 +350,49 @@ void kb_led_cb(uint8_t kbd_leds)
   }
 }
 
+/**
+ * A report has reached the host, USB or BLE: let the report task send
+ * the next queued one.
+ */
+void kb_report_complete_cb(void)
+{
+  if (report_task_handle != NULL) {
+    xTaskNotifyGive(report_task_handle);
+  }
+}
+
+/**
+ * The BLE connection parameters are updated: the keepalive stops once the
+ * interval asked for is in effect, or follows the new one.
+ * @param conn_int connection interval, x 1.25ms
+ */
+void kb_ble_conn_params_cb(uint16_t conn_int)
+{
+  uint period_us = conn_int * 1250;
+  bool is_confirmed;
+  bool is_active;
+
+  portENTER_CRITICAL(&keepalive_lock);
+  keepalive.period_us = period_us;
+  is_active = keepalive.is_active;
+  is_confirmed = conn_int <= ble_conn_param.max_int;
+  portEXIT_CRITICAL(&keepalive_lock);
+
+  if (!is_active) {
+    return;
+  }
+  if (is_confirmed) {
+    keepalive_stop("confirmed");
+    return;
+  }
+  xSemaphoreTake(keepalive_mutex, portMAX_DELAY);
+  if (keepalive.is_active) {
+    esp_timer_stop(keepalive_timer);
+    esp_timer_start_periodic(keepalive_timer, period_us);
+  }
+  xSemaphoreGive(keepalive_mutex);
+}
+
 
 /****************************************************************
  * 
@@ -484,13 +685,9 @@ static void init_trackpad(void)
 
 static void init_matrix_keyboard(void)
 {
-  GPIO_INIT_OUT_PULLUP(KB_COLSEL_0);
-  GPIO_INIT_OUT_PULLUP(KB_COLSEL_1);
-  GPIO_INIT_OUT_PULLUP(KB_COLSEL_2);
-
-  for (int i = 0; i < 18; i++) {
-    GPIO_INIT_IN_PULLUP(rowscan_pins[i]);
-  }
+  matrix_init();
+  detect_model();
+  calibrate_settle();
 
   GPIO_INIT_IN_PULLUP(BUTTON_FN);
   GPIO_INIT_IN_PULLUP(BUTTON_MIDDLE);
@@ -511,14 +708,100 @@ static void init_matrix_keyboard(void)
 }
 
 /**
- * Set keyboard column scan.
- * @param n column number 0~7
+ * Tell the keyboard model from the rise time of rows 16/17, and select
+ * its keymap with USE_MODEL_DETECT. The rows past the model are masked
+ * only when its keymap is found, so that a misdetection never hides the
+ * keys of the keymap kept. It takes some hundreds of microseconds.
+ */
+static void detect_model(void)
+{
+  uint32_t ticks_per_us = esp_rom_get_cpu_ticks_per_us();
+  uint32_t timeout_cycles = KB_MODEL_RISE_TIMEOUT_NS * ticks_per_us / 1000;
+  bool has_numpad = true;
+
+  for (int i = 0; i < 2; i++) {
+    uint32_t rise_cycles = timeout_cycles;
+    bool is_held = false;
+    for (int k = 0; k < KB_MODEL_PROBE_TRIES && !is_held; k++) {
+      uint32_t cycles;
+      is_held = !matrix_probe_row_rise(16 + i, timeout_cycles, &cycles);
+      if (!is_held && cycles < rise_cycles) {
+        rise_cycles = cycles;
+      }
+    }
+    // a key held on the row tells that it is wired
+    model_info.rise_ns[i] = is_held ? 0 : rise_cycles * 1000 / ticks_per_us;
+    has_numpad = has_numpad
+      && (is_held || model_info.rise_ns[i] >= KB_MODEL_RISE_NS);
+  }
+
+  model_info.nr_rows = has_numpad ? 18 : 16;
+#ifdef USE_MODEL_DETECT
+  const kb_keymap_model_t *model = keymap_select_model(model_info.nr_rows);
+#else
+  const kb_keymap_model_t *model = keymap_get_model();
+#endif
+  model_info.keymap_name = model->name;
+
+  ESP_LOGI(TAG, "%d-row keyboard, rise ns: %u %u, keymap %s",
+    model_info.nr_rows, model_info.rise_ns[0], model_info.rise_ns[1],
+    model->name);
+#ifdef USE_MODEL_DETECT
+  if (model->nr_rows == model_info.nr_rows) {
+    model_row_mask = (1u << model_info.nr_rows) - 1;
+  } else {
+    ESP_LOGW(TAG, "No keymap for a %d-row keyboard yet", model_info.nr_rows);
+  }
+#endif
+}
+
+/**
+ * Time the pull-up rise of every row of the model from a discharged state,
+ * and derive the column dwell from the slowest. A row with a key held can
+ * not be discharged and is skipped. Call after detect_model(), it takes
+ * some milliseconds.
  */
-static void kb_set_column_scan(int n)
+static void calibrate_settle(void)
 {
-  gpio_set_level(KB_COLSEL_0, n & 0b001);
-  gpio_set_level(KB_COLSEL_1, n & 0b010);
-  gpio_set_level(KB_COLSEL_2, n & 0b100);
+  uint32_t ticks_per_us = esp_rom_get_cpu_ticks_per_us();
+  uint32_t timeout_cycles = KB_SETTLE_TIMEOUT_NS * ticks_per_us / 1000;
+  uint32_t max_rise_ns = 0;
+  int nr_rows = 0;
+
+  for (int i = 0; i < KB_NR_ROWS; i++) {
+    uint32_t rise_cycles = 0;
+    // rows past the model float
+    bool is_skipped = !(model_row_mask & (1u << i));
+    for (int k = 0; k < KB_SETTLE_PROBE_TRIES && !is_skipped; k++) {
+      uint32_t cycles;
+      is_skipped = !matrix_probe_row_rise(i, timeout_cycles, &cycles);
+      if (!is_skipped && cycles > rise_cycles) {
+        rise_cycles = cycles;
+      }
+    }
+    settle_calib.rise_ns[i] = is_skipped ? 0 : rise_cycles * 1000 / ticks_per_us;
+    if (!is_skipped) {
+      nr_rows++;
+      if (settle_calib.rise_ns[i] > max_rise_ns) {
+        max_rise_ns = settle_calib.rise_ns[i];
+      }
+    }
+    if (rise_cycles >= timeout_cycles) {
+      ESP_LOGW(TAG, "Row %d does not rise within %u ns", i, KB_SETTLE_TIMEOUT_NS);
+    }
+  }
+
+  uint32_t dwell_ns = KB_COL_SETTLE_US * 1000;
+  if (nr_rows > 0) {
+    dwell_ns = max_rise_ns * 2 > KB_SETTLE_MIN_DWELL_NS
+      ? max_rise_ns * 2 : KB_SETTLE_MIN_DWELL_NS;
+  }
+  portENTER_CRITICAL(&scan_stats_lock);
+  settle_calib.dwell_ns = dwell_ns;
+  portEXIT_CRITICAL(&scan_stats_lock);
+
+  ESP_LOGI(TAG, "Slowest row rise %u ns over %d rows, column dwell %u ns",
+    max_rise_ns, nr_rows, dwell_ns);
 }
 
 /**
@@ -529,9 +812,8 @@ static void do_fnfunc(fn_function_t fncode)
 {
   switch (fncode) {
   case FN_FNLOCK: {
-    // Fn lock LED
-    is_fn_locked ^= 0x1;
-    if (is_fn_locked) {
+    // Fn lock LED, the layer itself is toggled by the report generator
+    if (kb_layers_is_on(&kb_reporter.layers, KB_LAYER_FNLOCK)) {
       LED_FNLK_ON;
     } else {
       LED_FNLK_OFF;
@@ -605,78 +887,75 @@ static void led_task(void *arg)
 }
 
 /**
- * Check the trackpoint PS2 input within a short time
- * @param poll_us poll time in microsecond
+ * PS2 reader task. Forward the trackpoint packets to the mouse task so that
+ * a burst of PS2 traffic never stalls the matrix scan.
  */
-static void poll_trackpoint(uint poll_us)
+static void ps2_task(void *arg)
 {
-  if (uart1_fd < 0) {
-    vTaskDelay(poll_us / 1000 / portTICK_PERIOD_MS);
-    return;
+  (void)arg;
+
+  while (1) {
+    fd_set rfds;
+    FD_ZERO(&rfds);
+    FD_SET(uart1_fd, &rfds);
+
+    // wait for PS2 input...
+    int s = select(uart1_fd + 1, &rfds, NULL, NULL, NULL);
+
+    if (s < 0) {
+      ESP_LOGE(TAG, "Select failed: errno %d. Exit...", errno);
+      close(uart1_fd);
+      uart1_fd = -1;
+      vTaskDelete(NULL);
+    } else if (s == 0) {
+      continue;
+    }
+
+    flush_power_state(PM_KB_TP_ACTIVE);
+    if (is_ble_connected && !is_usb_connected && pm_should_wait()) {
+      keepalive_start();
+    }
+
+    // forward all the PS2 packets
+    ps2_packet_t pkt;
+    while (kb_ps2_read_packet(&kb_hal, &pkt)) {
+      // the mouse task merges what piles up, so only drop on overflow
+      xQueueSend(ps2_queue, &pkt, 0);
+    }
   }
+}
 
-  // expire time for select()
-  struct timeval mouse_tv = {
-    .tv_sec = 0,
-    .tv_usec = poll_us,
-  };
+/**
+ * Mouse task
+ */
+static void mouse_task(void *arg)
+{
+  (void)arg;
 
+  while (1) {
+    poll_trackpoint(portMAX_DELAY);
+  }
+}
+
+/**
+ * Wait for trackpoint packets and send them as one mouse report
+ * @param wait ticks to wait for the first packet
+ */
+static void poll_trackpoint(TickType_t wait)
+{
   static uint lasttime = 0;
-  static bool is_midkey = false, is_pan = true;
 
   int8_t buttons = 0, dx = 0, dy = 0;
-  int8_t pan_x = 0, pan_y = 0;
   bool is_recv = false;
 
-  fd_set rfds;
-  FD_ZERO(&rfds);
-  FD_SET(uart1_fd, &rfds);
-
-  // wait for PS2 input...
-  int s = select(uart1_fd + 1, &rfds, NULL, NULL, &mouse_tv);
-
-  if (s < 0) {
-    ESP_LOGE(TAG, "Select failed: errno %d. Exit...", errno);
-    close(uart1_fd);
-    uart1_fd = -1;
-  } else if (s != 0) {
-    flush_power_state(PM_KB_TP_ACTIVE);
-    if (is_ble_connected && !is_usb_connected && pm_should_wait()) {
-      wakeup_time = esp_timer_get_time();
-    }
-
-    // parse all the PS2 packets
-    while (1) {
-      char mousebuf[3];
-      int nrrd = uart_read_bytes(UART_NUM_1, mousebuf, 3, 5);
-      if (nrrd > 0) {
-        if (nrrd < 3) {
-          // read the remaining bytes
-          int nrrd2 = uart_read_bytes(UART_NUM_1, &mousebuf[nrrd], 3-nrrd, 3);
-          nrrd += nrrd2;
-        }
-        if (nrrd == 3) {
-          // printf("recv: %02x %02x %02x\n", mousebuf[0], mousebuf[1], mousebuf[2]);
-          buttons |= mousebuf[0];
-          dx += mousebuf[1], dy -= mousebuf[2];
-          is_recv = true;
-        } else {
-          // printf("Only receive %d chars: ", nrrd);
-          // for (int nr = 0; nr < nrrd; nr++) {
-          //   printf("%02x ", mousebuf[nr]);
-          // }
-          // printf("\n");
-
-          // discard the dirty data
-          buttons = dx = dy = 0;
-          is_recv = false;
-          uart_flush_input(UART_NUM_1);
-          break;
-        }
-      } else {
-        break;
-      }
-    }
+  // merge all the pending PS2 packets
+  ps2_packet_t pkt;
+  while (xQueueReceive(ps2_queue, &pkt, wait) == pdTRUE) {
+    // printf("recv: %02x %02x %02x\n", pkt.data[0], pkt.data[1], pkt.data[2]);
+    buttons |= pkt.data[0];
+    dx += pkt.data[1], dy -= pkt.data[2];
+    is_recv = true;
+    wait = 0;
   }
 
   // suppress the first small motion
@@ -689,88 +968,444 @@ static void poll_trackpoint(uint poll_us)
   //   lasttime = currtime;
   // }
 
-  buttons &= 0b00000111;
   if (is_recv) {
-#ifndef USE_FN_TRACKPOINT_PAN
-    // mid key detection
-    if (buttons & 0b00000100) {
-      is_midkey = true;
-      // printf("midkey press\n");
-      if (dx != 0 || dy != 0) {
-        // middle key for pan
-        pan_x = dx > 0 ? 1 : dx < 0 ? -1 : 0;
-        pan_y = dy < 0 ? 1 : dy > 0 ? -1 : 0;
-        dx = dy = 0;
-        is_pan = true;
-        // printf("midkey pan\n");
-      }
-    } else {
-      if (is_midkey && !is_pan) {
-        // printf("send mid key\n");
-        if (is_usb_connected) {
-          tinyusb_hid_mouse_report(0b00000100, 0,0,0,0);
-          vTaskDelay(20);
-          tinyusb_hid_mouse_report(0, 0,0,0,0);
-          vTaskDelay(20);
-        } else if (is_ble_connected) {
-          esp_hidd_send_mouse_value(0b00000100, 0,0,0,0);
-          vTaskDelay(20);
-          esp_hidd_send_mouse_value(0, 0,0,0,0);
-          vTaskDelay(20);
-        }
-      }
-      is_midkey = is_pan = false;
-
-      #ifdef SCALE_TRACKPOINT_SPEED
-      // Scale the trackpoint mouse since it may be too slow...
-      if (dx > MOUSE_SCALE_MIN) dx += (dx-MOUSE_SCALE_MIN) * 2;
-      else if (dx < -MOUSE_SCALE_MIN) dx += (dx+MOUSE_SCALE_MIN) * 2;
-      if (dy > MOUSE_SCALE_MIN) dy += (dy-MOUSE_SCALE_MIN) * 2;
-      else if (dy < -MOUSE_SCALE_MIN) dy += (dy+MOUSE_SCALE_MIN) * 2;
-      #endif
-    }
+    kb_mouse_report(&kb_mouse, buttons, dx, dy, BUTTON_FN_STATE == 0);
 
-    if (is_usb_connected) {
-      tinyusb_hid_mouse_report(buttons & 0b00000011, dx, dy, pan_y, pan_x);
-    } else if (is_ble_connected) {
-      esp_hidd_send_mouse_value(buttons & 0b00000011, dx, dy, pan_y, pan_x);
+    if (is_backlight_on) {
+      BACKLIGHT_ON;
+      backlight_start_time = currtime;
     }
 
-#else
+    // printf("Mouse %3d, %3d; Buttons 0x%02x\n", dx, dy, buttons);
+    lasttime = currtime;
+  }
+}
+
+
+/**
+ * Scan timer callback, wake up the keyboard task
+ * @param arg keyboard task handle
+ */
+static void scan_timer_cb(void *arg)
+{
+  xTaskNotifyGive((TaskHandle_t)arg);
+}
+
+/**
+ * Keepalive timer callback, let the report task send the keepalive
+ * @param arg unused
+ */
+static void keepalive_timer_cb(void *arg)
+{
+  (void)arg;
+  is_keepalive_due = true;
+  if (report_task_handle != NULL) {
+    xTaskNotifyGive(report_task_handle);
+  }
+}
+
+/**
+ * Start the keepalive after asking the host for a shorter connection
+ * interval. It runs on the interval in effect, until confirmed.
+ */
+static void keepalive_start(void)
+{
+  uint period_us;
+
+  xSemaphoreTake(keepalive_mutex, portMAX_DELAY);
+  portENTER_CRITICAL(&keepalive_lock);
+  if (keepalive.is_active) {
+    portEXIT_CRITICAL(&keepalive_lock);
+    xSemaphoreGive(keepalive_mutex);
+    return;
+  }
+  keepalive.is_active = true;
+  keepalive.start_us = esp_timer_get_time();
+  keepalive.nr_sent = 0;
+  keepalive.nr_burst_est = 0;
+  keepalive.burst_us = keepalive.start_us;
+  period_us = keepalive.period_us;
+  portEXIT_CRITICAL(&keepalive_lock);
+
+  esp_timer_start_periodic(keepalive_timer, period_us);
+  xSemaphoreGive(keepalive_mutex);
+}
+
+/**
+ * Stop the keepalive and report what it sent against an estimate of what
+ * the former dummy burst, two reports on every scan, would have sent in the
+ * same time. The burst is gone, so the estimate assumes every scan period
+ * elapsed while scanning sent two reports.
+ * @param reason for the log
+ */
+static void keepalive_stop(const char *reason)
+{
+  kb_keepalive_t ka;
+
+  xSemaphoreTake(keepalive_mutex, portMAX_DELAY);
+  portENTER_CRITICAL(&keepalive_lock);
+  ka = keepalive;
+  keepalive.is_active = false;
+  portEXIT_CRITICAL(&keepalive_lock);
+
+  if (!ka.is_active) {
+    xSemaphoreGive(keepalive_mutex);
+    return;
+  }
+  esp_timer_stop(keepalive_timer);
+  is_keepalive_due = false;
+  xSemaphoreGive(keepalive_mutex);
+  ESP_LOGI(TAG, "keepalive %s after %u ms: %u notifications, dummy burst est. %u",
+    reason, ((uint)esp_timer_get_time() - ka.start_us) / 1000,
+    ka.nr_sent, ka.nr_burst_est);
+}
+
+/**
+ * Run by the report task on every pass. On each connection event without
+ * a keyboard report, the current key state is sent again.
+ */
+static void keepalive_tick(void)
+{
+  uint currtime = esp_timer_get_time();
+  bool is_due = is_keepalive_due;
+  uint start_us;
+  uint period_us;
+
+  portENTER_CRITICAL(&keepalive_lock);
+  if (!keepalive.is_active) {
+    portEXIT_CRITICAL(&keepalive_lock);
+    return;
+  }
+  // Estimate the former dummy burst: the task used to be woken once per
+  // scan, and the burst sent two reports. Nothing is counted while the scan
+  // timer is stopped.
+  if (scan_period_us == 0) {
+    keepalive.burst_us = currtime;
+  } else {
+    uint nr_scans = (currtime - keepalive.burst_us) / scan_period_us;
+    keepalive.nr_burst_est += nr_scans * 2;
+    keepalive.burst_us += nr_scans * scan_period_us;
+  }
+  start_us = keepalive.start_us;
+  period_us = keepalive.period_us;
+  portEXIT_CRITICAL(&keepalive_lock);
+
+  if (!is_ble_connected || is_usb_connected) {
+    keepalive_stop("disconnected");
+    return;
+  }
+  if (currtime - start_us >= KB_KEEPALIVE_TIMEOUT_US) {
+    keepalive_stop("timed out");
+    return;
+  }
+  if (!is_due) {
+    return;
+  }
+  is_keepalive_due = false;
+  if (currtime - last_keyboard_report_us >= period_us
+    && kb_reporter_resend(&kb_reporter)) {
+    portENTER_CRITICAL(&keepalive_lock);
+    keepalive.nr_sent++;
+    portEXIT_CRITICAL(&keepalive_lock);
+  }
+}
+
+/**
+ * (Re)start the scan timer if the period changes
+ * @param period_us scan period in microsecond
+ * @return true if the timer is (re)started
+ */
+static bool scan_timer_start(uint period_us)
+{
+  if (period_us == scan_period_us) {
+    return false;
+  }
+  if (scan_period_us != 0) {
+    esp_timer_stop(scan_timer);
+  }
+  esp_timer_start_periodic(scan_timer, period_us);
+  scan_period_us = period_us;
+  is_scan_restarted = true;
+
+  portENTER_CRITICAL(&scan_stats_lock);
+  memset(&scan_stats, 0, sizeof(scan_stats));
+  scan_stats.period_us = period_us;
+  scan_jitter_sum_us = 0;
+  portEXIT_CRITICAL(&scan_stats_lock);
+  return true;
+}
+
+/**
+ * Stop the scan timer, e.g. while probing the idle matrix
+ */
+static void scan_timer_stop(void)
+{
+  if (scan_period_us != 0) {
+    esp_timer_stop(scan_timer);
+    scan_period_us = 0;
+  }
+}
+
+/**
+ * Account one scan in the jitter statistics
+ * @param now_us start time of this scan
+ * @param period_us nominal scan period
+ * @param scan_us time spent in this scan
+ */
+static void scan_stats_update(uint now_us, uint period_us, uint scan_us)
+{
+  if (is_scan_restarted) {
+    // no previous scan to compare with
+    is_scan_restarted = false;
+    last_scan_us = now_us;
+    return;
+  }
+
+  int jitter = (int)(now_us - last_scan_us - period_us);
+  last_scan_us = now_us;
+
+  portENTER_CRITICAL(&scan_stats_lock);
+  if (scan_stats.nr_scans == 0 || jitter < scan_stats.min_jitter_us) {
+    scan_stats.min_jitter_us = jitter;
+  }
+  if (scan_stats.nr_scans == 0 || jitter > scan_stats.max_jitter_us) {
+    scan_stats.max_jitter_us = jitter;
+  }
+  if (scan_us > scan_stats.max_scan_us) {
+    scan_stats.max_scan_us = scan_us;
+  }
+  scan_jitter_sum_us += jitter < 0 ? -jitter : jitter;
+  scan_stats.nr_scans++;
+  portEXIT_CRITICAL(&scan_stats_lock);
+}
+
+#ifdef USE_SCAN_STATS_LOG
+/**
+ * Log the scan timing statistics every KB_SCAN_STATS_LOG_US
+ * @param now_us current time
+ */
+static void scan_stats_log(uint now_us)
+{
+  kb_scan_stats_t stats;
+
+  if (now_us - scan_stats_log_us < KB_SCAN_STATS_LOG_US) {
+    return;
+  }
+  scan_stats_log_us = now_us;
+
+  kb_get_scan_stats(&stats);
+  if (stats.nr_scans == 0) {
+    return;
+  }
+  ESP_LOGI(TAG, "scan period %u us, %u scans: jitter %d ~ %d us, avg %u us, "
+    "longest scan %u us", stats.period_us, stats.nr_scans,
+    stats.min_jitter_us, stats.max_jitter_us, stats.avg_abs_jitter_us,
+    stats.max_scan_us);
+  // the time spent logging is not the jitter of the timer
+  is_scan_restarted = true;
+}
+#endif
+
+/**
+ * Sample one packed row mask per column, with the calibrated dwell
+ * @param col_rows output, rows of each column
+ */
+static void scan_matrix(uint32_t col_rows[KB_NR_COLS])
+{
+  uint32_t dwell_cycles;
+
+  portENTER_CRITICAL(&scan_stats_lock);
+  dwell_cycles = settle_calib.dwell_ns * esp_rom_get_cpu_ticks_per_us() / 1000;
+  portEXIT_CRITICAL(&scan_stats_lock);
+
+  // Column i holds the rows of column i-1, which is what the scan codes in
+  // keymap-*.c are based on.
+  for (int i = 0; i < KB_NR_COLS; i++) {
+    kb_set_column_scan((i + KB_NR_COLS - 1) % KB_NR_COLS);
+    matrix_delay_cycles(dwell_cycles);
+    col_rows[i] = matrix_read_rows();
+  }
+}
 
-    if (BUTTON_FN_STATE == 0) {
-      // panning
-      pan_x = dx > 0 ? 1 : dx < 0 ? -1 : 0;
-      pan_y = dy < 0 ? 1 : dy > 0 ? -1 : 0;
-      dx = dy = 0;
+/**
+ * Whether the keyboard state goes out as the NKRO report. The host may
+ * only understand the 6KRO report in boot protocol.
+ */
+static bool is_nkro_active(void)
+{
+#ifdef USE_NKRO
+  if (is_usb_connected) {
+    return !tinyusb_hid_is_boot_protocol();
+  } else if (is_ble_connected) {
+    return esp_hidd_is_nkro_ready();
+  }
+#endif
+  return false;
+}
+
+/**
+ * Send the keyboard report to the connected host
+ * @param is_nkro NKRO or 6KRO report
+ * @param buf report
+ */
+static void send_keyboard_report(bool is_nkro, uint8_t *buf)
+{
+  if (is_usb_connected) {
+    if (is_nkro) {
+      tinyusb_hid_nkro_report(buf);
     } else {
-      #ifdef SCALE_TRACKPOINT_SPEED
-      // Scale the trackpoint mouse since it may be too slow...
-      if (dx > MOUSE_SCALE_MIN) dx += (dx-MOUSE_SCALE_MIN) * 2;
-      else if (dx < -MOUSE_SCALE_MIN) dx += (dx+MOUSE_SCALE_MIN) * 2;
-      if (dy > MOUSE_SCALE_MIN) dy += (dy-MOUSE_SCALE_MIN) * 2;
-      else if (dy < -MOUSE_SCALE_MIN) dy += (dy+MOUSE_SCALE_MIN) * 2;
-      #endif
+      tinyusb_hid_keyboard_report(buf);
     }
+  } else if (is_ble_connected) {
+    if (is_nkro) {
+      esp_hidd_send_nkro_value(buf);
+    } else {
+      esp_hidd_send_keyboard_value(buf);
+    }
+  }
+}
 
-    if (is_usb_connected) {
-      tinyusb_hid_mouse_report(buttons, dx, dy, pan_y, pan_x);
-    } else if (is_ble_connected) {
-      esp_hidd_send_mouse_value(buttons, dx, dy, pan_y, pan_x);
+/**
+ * Matrix sampler: the rows of each column and the Fn button
+ */
+static void hal_read_matrix(void *ctx, uint32_t col_rows[KB_NR_COLS])
+{
+  (void)ctx;
+  scan_matrix(col_rows);
+  // rows not on the FPC of this model are left floating
+  for (int i = 0; i < KB_NR_COLS; i++) {
+    col_rows[i] &= model_row_mask;
+  }
+  if (matrix_read_fn()) {
+    col_rows[0] |= KB_FN_MASK;
+  }
+}
+
+static uint32_t hal_now_us(void *ctx)
+{
+  (void)ctx;
+  return esp_timer_get_time();
+}
+
+static void hal_delay_ms(void *ctx, uint32_t ms)
+{
+  (void)ctx;
+  vTaskDelay(ms / portTICK_PERIOD_MS);
+}
+
+static int hal_ps2_read(void *ctx, uint8_t *buf, int len, uint32_t timeout_ms)
+{
+  (void)ctx;
+  return uart_read_bytes(UART_NUM_1, buf, len, timeout_ms / portTICK_PERIOD_MS);
+}
+
+static void hal_ps2_flush(void *ctx)
+{
+  (void)ctx;
+  uart_flush_input(UART_NUM_1);
+}
+
+static bool hal_is_nkro(void *ctx)
+{
+  (void)ctx;
+  return is_nkro_active();
+}
+
+static bool hal_is_keyboard_ready(void *ctx)
+{
+  (void)ctx;
+  if (is_usb_connected) {
+    return tinyusb_hid_is_ready();
+  } else if (is_ble_connected) {
+    return esp_hidd_is_keyboard_ready();
+  }
+  return true;
+}
+
+static void hal_send_keyboard(void *ctx, bool is_nkro, uint8_t *report)
+{
+  (void)ctx;
+  send_keyboard_report(is_nkro, report);
+  last_keyboard_report_us = esp_timer_get_time();
+}
+
+static void hal_send_consumer(void *ctx, uint16_t usage)
+{
+  (void)ctx;
+  if (is_usb_connected) {
+    tinyusb_hid_consumer_report(usage);
+  } else if (is_ble_connected) {
+    esp_hidd_send_consumer_value(usage);
+  }
+}
+
+static void hal_send_mouse(void *ctx, uint8_t buttons, int8_t dx, int8_t dy,
+  int8_t vert, int8_t hori)
+{
+  (void)ctx;
+  if (is_usb_connected) {
+    tinyusb_hid_mouse_report(buttons, dx, dy, vert, hori);
+  } else if (is_ble_connected) {
+    esp_hidd_send_mouse_value(buttons, dx, dy, vert, hori);
+  }
+}
+
+/**
+ * Manage LED since Win10 won't report it.
+ */
+static void hal_lock_key(void *ctx, uint8_t hidkey)
+{
+  (void)ctx;
+  if (hidkey == KEY_CAPSLOCK) {
+    if (is_caplk_on) {
+      LED_CAPLK_OFF;
+      is_caplk_on = false;
+    } else  {
+      LED_CAPLK_ON;
+      is_caplk_on = true;
     }
-#endif
+  } else if (hidkey == KEY_NUMLOCK) {
+    if (is_numlk_on) {
+      LED_NUMLK_OFF;
+      is_numlk_on = false;
+    } else {
+      LED_NUMLK_ON;
+      is_numlk_on = true;
+    }
+  }
+}
 
-    if (is_backlight_on) {
-      BACKLIGHT_ON;
-      backlight_start_time = currtime;
+static void hal_do_fnfunc(void *ctx, fn_function_t fncode)
+{
+  (void)ctx;
+  do_fnfunc(fncode);
+}
+
+/**
+ * Report task. Apply the key events one by one so that every press and
+ * release reaches the host as a report of its own. The reports are queued
+ * in kb_core and sent as fast as the host takes them: the task is woken
+ * up once per scan and whenever a report has been sent.
+ */
+static void report_task(void *arg)
+{
+  (void)arg;
+
+  while (1) {
+    // woken up by the scanner or kb_report_complete_cb()
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    // a stalled host holds the events back in the ring
+    kb_event_t ev;
+    while (kb_reporter_is_ready(&kb_reporter) && kb_event_pop(&kb_events, &ev)) {
+      kb_reporter_apply(&kb_reporter, &ev);
     }
+    kb_reporter_tick(&kb_reporter, esp_timer_get_time());
 
-    // printf("Mouse %3d, %3d; Pan %3d, %3d; Buttons 0x%02x\n", dx, dy, pan_x, pan_y, buttons);
-    lasttime = currtime;
+    keepalive_tick();
   }
 }
 
-
 /****************************************************************
  * 
  *  Public functions
@@ -788,113 +1423,95 @@ void keyboard_task(void *arg)
   init_trackpad();
   init_matrix_keyboard();
   init_pm();
+  matrix_probe_init();
+  kb_probe_init(&kb_probe);
+  kb_scanner_init(&kb_scanner, &kb_hal, &kb_events, KB_DEBOUNCE_ALGO, KB_DEBOUNCE_US);
+  if (!keymap_store_load(&kb_keymaps[0])) {
+#ifdef KB_KEYMAP_HEADER
+    memcpy(&kb_keymaps[0], &kb_default_keymap, sizeof(kb_keymaps[0]));
+#else
+    kb_keymap_build(&kb_keymaps[0]);
+#endif
+  }
+  kb_reporter_init(&kb_reporter, &kb_hal, &kb_keymaps[0]);
+  kb_combos_build(&kb_combos);
+  kb_reporter_set_combos(&kb_reporter, &kb_combos, 0);
+  kb_reporter_set_unicode(&kb_reporter, KB_UNICODE_MODE);
+  if (!kb_leader_init(&kb_leader)) {
+    ESP_LOGE(TAG, "LEADER_ITEMS of the %s keymap are not sorted",
+      keymap_get_model()->name);
+  }
+  kb_reporter_set_leader(&kb_reporter, &kb_leader, 0);
+  kb_mouse_init(&kb_mouse, &kb_hal);
+
+  const esp_timer_create_args_t scan_timer_args = {
+    .callback = scan_timer_cb,
+    .arg = xTaskGetCurrentTaskHandle(),
+    .name = "kb_scan"
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&scan_timer_args, &scan_timer));
+
+  const esp_timer_create_args_t keepalive_timer_args = {
+    .callback = keepalive_timer_cb,
+    .name = "kb_keepalive"
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&keepalive_timer_args, &keepalive_timer));
+  keepalive_mutex = xSemaphoreCreateMutex();
+
   xTaskCreate(&led_task,  "led_task", 4096, NULL, configMAX_PRIORITIES, NULL);
+  xTaskCreate(&report_task,  "report_task", 4096, NULL, configMAX_PRIORITIES - 2, &report_task_handle);
+  if (uart1_fd >= 0) {
+    ps2_queue = xQueueCreate(16, sizeof(ps2_packet_t));
+    xTaskCreate(&ps2_task,  "ps2_task", 4096, NULL, configMAX_PRIORITIES - 3, NULL);
+    xTaskCreate(&mouse_task,  "mouse_task", 4096, NULL, configMAX_PRIORITIES - 4, NULL);
+  }
   ESP_LOGI(TAG, "Init finish");
 
   bool last_is_key_pressed = false;
-  uint64_t lasthid = 0;
-  uint16_t lasthotkey = 0;
-  fn_function_t lastfnfunc = FN_NOP;
-  // int lasti = -1, lastj = -1;
 
   while (1) {
     // Poll here and do not bother using semaphores...
     if (!is_usb_connected && !is_ble_connected) {
+      scan_timer_stop();
       vTaskDelay(2000);
       flush_power_state(PM_IDLE_LONG_TIME);
       continue;
     }
 
-    bool is_key_pressed = false;
-    uint64_t hid = 0;
-    uint8_t *hidbuf = (uint8_t*)&hid;
-    int nr_hidkey = 0;
-    uint16_t hotkey = 0;
-    fn_function_t fnfunc = FN_NOP;
-
-    // int thisi = -1, thisj = -1;
-    bool has_phantom_key = false;
-    uint32_t rows_connected = 0;
-    for (int i = 0; i < 8; i++) {
-      uint32_t rows_cur_col = 0; // rows connected with the current col
-      for (int j = 0; j < 18; j++) {
-        if (gpio_get_level(rowscan_pins[j]) == 0) {
-          rows_cur_col |= 1 << j;
-          // thisi = i; thisj = j;
-          int hidkey = search_hid_key(i, j);
-          if (hidkey > 0) {
-            if (BUTTON_FN_STATE != 0) {
-              // normal keyboard usage
-              if (hidkey >= KEY_LEFTCTRL && hidkey <= KEY_RIGHTMETA) {
-                hidbuf[0] |= 1u << (hidkey & 0x07);
-              } else if (is_fn_locked && hidkey >= KEY_F1 && hidkey <= KEY_F12) {
-                fn_keytable_t *fnitem = search_fn(i, j);
-                if (fnitem != NULL) {
-                  is_key_pressed = true;
-                  hotkey = fnitem->hidcode;
-                  fnfunc = fnitem->fncode;
-                  hid = 0;  // clear keyboard key
-                }
-              } else if (nr_hidkey < 6) {
-                hidbuf[2+nr_hidkey] = hidkey;
-                nr_hidkey++;
-                is_key_pressed = true;
-                hotkey = 0; // clear hotkey
-              }
-            } else {
-              if (is_fn_locked && hidkey >= KEY_F1 && hidkey <= KEY_F12) {
-                if (!is_key_pressed) {
-                  hidbuf[2] = hidkey;
-                  is_key_pressed = true;
-                  hotkey = 0;
-                }
-              } else {
-                // hotkey
-                fn_keytable_t *fnitem = search_fn(i, j);
-                if (fnitem != NULL) {
-                  is_key_pressed = true;
-                  hotkey = fnitem->hidcode;
-                  fnfunc = fnitem->fncode;
-                  hid = 0;  // clear keyboard key
-                }
-              }
-            }
-          }
-        }
+    if (kb_probe_start(&kb_probe, pm_is_idle_probe(), last_is_key_pressed)) {
+      // Nobody is typing: only cycle the column select with the row
+      // interrupts armed, and go back to full-rate scanning on the first edge.
+      // Only the selected column raises an edge, and the sweep after each
+      // dwell catches the other columns within the dwell.
+      uint dwell_us = get_kb_probe_dwell_us();
+      scan_timer_stop();
+      matrix_probe_arm();
+      do {
+        kb_set_column_scan(kb_probe_next_col(&kb_probe));
+      } while (kb_probe_step(&kb_probe,
+        matrix_probe_wait(dwell_us) || kb_probe_sweep(&kb_hal),
+        pm_is_idle_probe() && (is_usb_connected || is_ble_connected)));
+      matrix_probe_disarm();
+      if (kb_probe.is_woken) {
+        flush_power_state(PM_KB_ACTIVE);
       }
-
-      // rows that are connected by both current col and previous cols, which
-      // lead to "phantom keys" if more than one.
-      uint32_t rows_connected_again = rows_cur_col & rows_connected;
-
-      // If and only if less than two bits is 1, the following expr will be 0
-      if (rows_connected_again & (rows_connected_again - 1))
-        has_phantom_key = true;
-      rows_connected |= rows_cur_col;
-      kb_set_column_scan(i);
-
-      // static int nrtry = 0;
-      // int lasttime = esp_timer_get_time();
-      poll_trackpoint(get_kb_scan_interval_us());
-      // int curtime = esp_timer_get_time();
-      // if (nrtry < 5) {
-      //   nrtry++;
-      //   printf("pend time %d\n", curtime-lasttime);
-      // }
     }
-    if (has_phantom_key){
-      hotkey = lasthotkey;
-      fnfunc = lastfnfunc;
-      hid = lasthid;
-      is_key_pressed = last_is_key_pressed;
+
+    // wait for the scan timer, but scan at once when it is just started
+    if (!scan_timer_start(get_kb_scan_period_us())) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
     }
+    uint scan_start_us = esp_timer_get_time();
+
+    bool is_key_pressed = kb_scanner_scan(&kb_scanner);
+    xTaskNotifyGive(report_task_handle);
 
     uint currtime = esp_timer_get_time();
 
     if (is_key_pressed) {
       flush_power_state(PM_KB_ACTIVE);
       if (is_ble_connected && !is_usb_connected && pm_should_wait()) {
-        wakeup_time = currtime;
+        keepalive_start();
       }
 
       if (is_backlight_on) {
@@ -906,71 +1523,47 @@ void keyboard_task(void *arg)
     }
     last_is_key_pressed = is_key_pressed;
 
-    if (hid != lasthid) {
-      // printf("%02x %02x %02x %02x %02x %02x %02x %02x\n",
-      //   hidbuf[0], hidbuf[1], hidbuf[2], hidbuf[3], 
-      //   hidbuf[4], hidbuf[5], hidbuf[6], hidbuf[7]
-      // );
-      if (is_usb_connected) {
-        tinyusb_hid_keyboard_report(hidbuf);
-      } else if (is_ble_connected) {
-        esp_hidd_send_keyboard_value(hidbuf);
-      }
+    scan_stats_update(scan_start_us, scan_period_us,
+      (uint)esp_timer_get_time() - scan_start_us);
+#ifdef USE_SCAN_STATS_LOG
+    scan_stats_log(currtime);
+#endif
+  }
+}
 
-      // Manage LED since Win10 won't report it.
-      if (hidbuf[2] == KEY_CAPSLOCK) {
-        if (is_caplk_on) {
-          LED_CAPLK_OFF;
-          is_caplk_on = false;
-        } else  {
-          LED_CAPLK_ON;
-          is_caplk_on = true;
-        }
-      } else if (hidbuf[2] == KEY_NUMLOCK) {
-        if (is_numlk_on) {
-          LED_NUMLK_OFF;
-          is_numlk_on = false;
-        } else {
-          LED_NUMLK_ON;
-          is_numlk_on = true;
-        }
-      }
-    }
-    lasthid = hid;
-
-    if (hotkey != lasthotkey) {
-      // printf("%04x\n", hotkey);
-      if (is_usb_connected) {
-        tinyusb_hid_consumer_report(hotkey);
-      } else if (is_ble_connected) {
-        esp_hidd_send_consumer_value(hotkey);
-      }
-    }
-    lasthotkey = hotkey;
+void kb_get_scan_stats(kb_scan_stats_t *stats)
+{
+  portENTER_CRITICAL(&scan_stats_lock);
+  *stats = scan_stats;
+  if (scan_stats.nr_scans != 0) {
+    stats->avg_abs_jitter_us = scan_jitter_sum_us / scan_stats.nr_scans;
+  }
+  portEXIT_CRITICAL(&scan_stats_lock);
+}
 
-    if (fnfunc != lastfnfunc) {
-      do_fnfunc(fnfunc);
-    }
-    lastfnfunc = fnfunc;
-
-    if (is_ble_connected
-     && !is_usb_connected
-     && currtime - wakeup_time < wakeup_period_us
-    ) {
-      LED_F1_ON;
-      // send dummy data to wake it up
-      hid = 0;
-      esp_hidd_send_keyboard_value(hidbuf);
-      esp_hidd_send_mouse_value(0, 0,0,0,0);
-    } else {
-      LED_F1_OFF;
-    }
+void kb_get_settle_calib(kb_settle_calib_t *calib)
+{
+  portENTER_CRITICAL(&scan_stats_lock);
+  *calib = settle_calib;
+  portEXIT_CRITICAL(&scan_stats_lock);
+}
 
-    // if (lasti != thisi && lastj != thisj && thisi != -1 && thisj != -1) {
-    //   printf("%2d, %2d\n", thisi, thisj);
-    // }
-    // lasti = thisi;
-    // lastj = thisj;
-  }
+void kb_get_model_info(kb_model_info_t *info)
+{
+  *info = model_info;
 }
 
+bool kb_set_keymap(const kb_keymap_t *km, bool is_release_all)
+{
+  if (report_task_handle == NULL || kb_reporter_is_swap_pending(&kb_reporter)) {
+    return false;
+  }
+
+  // the report task only changes the keymap in use through a pending swap
+  kb_keymap_t *next = kb_reporter.layers.keymap == &kb_keymaps[0]
+    ? &kb_keymaps[1] : &kb_keymaps[0];
+  memcpy(next, km, sizeof(*next));
+  kb_reporter_swap_keymap(&kb_reporter, next, is_release_all);
+  xTaskNotifyGive(report_task_handle);
+  return true;
+}
@@ -0,0 +1,123 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MY_KEYBOARD_H
+#define MY_KEYBOARD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "keymap.h"
+#include "layer.h"
+
+/****************************************************************
+ * 
+ *  Typedefs
+ * 
+ ****************************************************************/
+
+/**
+ * Matrix scan timing statistics since the scan period last changed.
+ * Jitter is the deviation of the time between two scans from the period.
+ */
+typedef struct {
+  uint32_t period_us;         // Nominal scan period
+  uint32_t nr_scans;          // Number of scans measured
+  int32_t min_jitter_us;      // Earliest scan relative to the period
+  int32_t max_jitter_us;      // Latest scan relative to the period
+  uint32_t avg_abs_jitter_us; // Mean absolute jitter
+  uint32_t max_scan_us;       // Longest time spent in one scan
+} kb_scan_stats_t;
+
+/**
+ * Settle calibration, done at boot. Every row of the model is discharged
+ * and the rise of its pull-up timed, which is how long a row left low by
+ * the previous column takes to read released. The dwell after each column
+ * change is twice the slowest row.
+ */
+typedef struct {
+  uint32_t rise_ns[KB_NR_ROWS];         // Slowest rise of each row, 0 if not measured
+  uint32_t dwell_ns;                    // Dwell in use before sampling a column
+} kb_settle_calib_t;
+
+/**
+ * Keyboard model detected at boot from the pull-up rise time of rows 16
+ * and 17, which only reach the FPC of a keyboard with the numpad. The
+ * keymap in use only follows it with USE_MODEL_DETECT.
+ */
+typedef struct {
+  uint8_t nr_rows;          // Rows on the FPC, 16 or 18
+  uint32_t rise_ns[2];      // Rise time of rows 16 and 17, 0 if a key held on it
+  const char *keymap_name;  // Name of the keymap model in use
+} kb_model_info_t;
+
+/****************************************************************
+ * 
+ *  Public interface
+ * 
+ ****************************************************************/
+
+/**
+ * Keyboard task
+ */
+void keyboard_task(void *arg);
+
+/**
+ * Get the matrix scan timing statistics
+ * @param stats output
+ */
+void kb_get_scan_stats(kb_scan_stats_t *stats);
+
+/**
+ * Get the settle calibration results
+ * @param calib output
+ */
+void kb_get_settle_calib(kb_settle_calib_t *calib);
+
+/**
+ * Replace the keymap in use without stopping the scan. The keymap is
+ * copied into the buffer not in use, and the report task swaps it in
+ * between two key events once no key is held.
+ * @param km keymap
+ * @param is_release_all swap at once, releasing the keys held
+ * @return false before the keyboard task is up, or while the previous
+ *   swap is still pending
+ */
+bool kb_set_keymap(const kb_keymap_t *km, bool is_release_all);
+
+/**
+ * Get the keyboard model detected at boot
+ * @param info output
+ */
+void kb_get_model_info(kb_model_info_t *info);
+
+/**
+ * The BLE connection parameters are updated, from
+ * ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT
+ * @param conn_int connection interval, x 1.25ms
+ */
+void kb_ble_conn_params_cb(uint16_t conn_int);
+
+/**
+ * A report has reached the host, from ESP_HIDD_EVENT_BLE_REPORT_SENT_EVT
+ * or the TinyUSB report complete callback
+ */
+void kb_report_complete_cb(void);
+
+#endif
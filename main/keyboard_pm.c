@@ -48,7 +48,8 @@ static kb_pm_state_t pm_cfg[] = {
     .kb_int_us = 25000,   // *8 = 160ms per scan
     .ble_int_cnt = 800,   // *1.25 = 1000ms BLE connection interval
     .duration_us = -1,
-    .is_sleep = true
+    .is_sleep = true,
+    .is_probe = true
   },
   // keyboard idle for a short time. 26mA with BLE
   [PM_IDLE_SHORT_TIME] = {
@@ -281,7 +282,22 @@ unsigned get_kb_scan_interval_us(void)
   return pm_cfg[curr_pm_state].kb_int_us * 5 / 6;
 }
 
+unsigned get_kb_scan_period_us(void)
+{
+  return pm_cfg[curr_pm_state].kb_int_us * 8;
+}
+
+unsigned get_kb_probe_dwell_us(void)
+{
+  return get_kb_scan_interval_us();
+}
+
 bool pm_should_wait(void)
 {
   return is_pm_increase_rapid;
 }
+
+bool pm_is_idle_probe(void)
+{
+  return pm_cfg[curr_pm_state].is_probe;
+}
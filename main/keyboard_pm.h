@@ -38,6 +38,7 @@ typedef struct {
   uint32_t ble_int_cnt; // 4/5 of BLE connection interval
   uint32_t duration_us; // Time in microsecond of this state
   bool is_sleep;        // Enable auto light-sleep in esp-idf
+  bool is_probe;        // Wait for row edges instead of scanning when idle
 } kb_pm_state_t;
 
 /**
@@ -74,9 +75,29 @@ void flush_power_state(kb_pm_t new_pm_state);
  */
 unsigned get_kb_scan_interval_us(void);
 
+/**
+ * Get the period of a full matrix scan
+ * @return scan period in microseconds
+ */
+unsigned get_kb_scan_period_us(void);
+
+/**
+ * Get the time to probe each column for in the idle probe mode, the scan
+ * interval of the idle state. The sweep after each dwell bounds the
+ * first-key latency to it, see probe.h.
+ * @return dwell in microseconds
+ */
+unsigned get_kb_probe_dwell_us(void);
+
 /**
  * Wait for a while ifr the BLE connection interval decreases rapidly.
  */
 bool pm_should_wait(void);
 
+/**
+ * Whether the matrix should be probed with row interrupts instead of
+ * being fully scanned while no key is pressed
+ */
+bool pm_is_idle_probe(void);
+
 #endif
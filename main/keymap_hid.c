@@ -0,0 +1,160 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "keymap_hid.h"
+#include "keyboard.h"
+#include "keymap_store.h"
+#include "keymap_blob.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+/****************************************************************
+ * 
+ *  Private Varibles
+ * 
+ ****************************************************************/
+
+static const char *TAG = "keymap_hid";
+
+// command, payload length, then the payload
+#define KEYMAP_HID_HDR_LEN 2
+
+// staged keymap blob, aligned for kb_keymap_blob_check()
+static uint32_t keymap_blob[(KB_KEYMAP_BLOB_SIZE + 3) / 4];
+static size_t keymap_blob_len;
+
+// KEYMAP_HID_BUSY hands the staged blob over to the save task
+static volatile uint8_t keymap_status = KEYMAP_HID_OK;
+
+static TaskHandle_t keymap_task_handle = NULL;
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+/**
+ * Append a chunk to the staged blob
+ * @return false if the chunk is cut short or overflows the blob
+ */
+static bool keymap_load(const uint8_t *buf, uint16_t len)
+{
+  uint8_t nr = buf[1];
+  if (nr > len - KEYMAP_HID_HDR_LEN || keymap_blob_len + nr > KB_KEYMAP_BLOB_SIZE) {
+    ESP_LOGW(TAG, "%u of %u bytes staged, cannot add %u",
+      (unsigned)keymap_blob_len, (unsigned)KB_KEYMAP_BLOB_SIZE, nr);
+    return false;
+  }
+  memcpy((uint8_t *)keymap_blob + keymap_blob_len, &buf[KEYMAP_HID_HDR_LEN], nr);
+  keymap_blob_len += nr;
+  return true;
+}
+
+/**
+ * Store the staged blob and swap it in
+ */
+static bool keymap_save(void)
+{
+  const kb_keymap_t *km = kb_keymap_blob_check(keymap_blob, keymap_blob_len);
+  esp_err_t err = keymap_store_write(keymap_blob, keymap_blob_len);
+  keymap_blob_len = 0;
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "not saved: %s", err == ESP_ERR_INVALID_ARG
+      ? "not a valid keymap for this model" : esp_err_to_name(err));
+    return false;
+  }
+
+  if (kb_set_keymap(km, false)) {
+    ESP_LOGI(TAG, "saved, used once no key is held");
+  } else {
+    ESP_LOGI(TAG, "saved, used from the next boot");
+  }
+  return true;
+}
+
+static void keymap_task(void *arg)
+{
+  (void)arg;
+
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    keymap_status = keymap_save() ? KEYMAP_HID_OK : KEYMAP_HID_ERROR;
+  }
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+void init_keymap_hid(void)
+{
+  if (xTaskCreate(keymap_task, "keymap_task", 4096, NULL, 1,
+      &keymap_task_handle) != pdPASS) {
+    ESP_LOGW(TAG, "No keymap upload");
+  }
+}
+
+void kb_keymap_set_report_cb(const uint8_t *buf, uint16_t len)
+{
+  if (keymap_status == KEYMAP_HID_BUSY || len < KEYMAP_HID_HDR_LEN) {
+    return;
+  }
+
+  switch (buf[0]) {
+  case KEYMAP_HID_LOAD:
+    keymap_status = keymap_load(buf, len) ? KEYMAP_HID_OK : KEYMAP_HID_ERROR;
+    break;
+  case KEYMAP_HID_SAVE:
+    if (keymap_task_handle == NULL) {
+      keymap_status = KEYMAP_HID_ERROR;
+      break;
+    }
+    keymap_status = KEYMAP_HID_BUSY;
+    xTaskNotifyGive(keymap_task_handle);
+    break;
+  case KEYMAP_HID_CLEAR:
+    keymap_blob_len = 0;
+    keymap_status = KEYMAP_HID_OK;
+    break;
+  default:
+    keymap_status = KEYMAP_HID_ERROR;
+    break;
+  }
+}
+
+uint16_t kb_keymap_get_report_cb(uint8_t *buf, uint16_t len)
+{
+  uint8_t status = keymap_status;
+  // the save task empties the staged blob while busy
+  size_t staged = status == KEYMAP_HID_BUSY ? 0 : keymap_blob_len;
+  uint8_t report[3] = { status, staged & 0xff, staged >> 8 };
+
+  if (len < sizeof(report)) {
+    return 0;
+  }
+  memcpy(buf, report, sizeof(report));
+  return sizeof(report);
+}
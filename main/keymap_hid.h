@@ -0,0 +1,75 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Keymap upload over USB
+ *
+ * A vendor-defined feature report on the keyboard interface, REPORT_ID_KEYMAP,
+ * carries a keymap blob made by tools/keymapc in chunks. It needs no endpoint
+ * of its own, the host sends it with SET_REPORT on the control pipe, e.g.
+ * through tools/keymapc/keymap_upload.py.
+ *
+ * SET_REPORT: command, payload length, payload
+ *   KEYMAP_HID_LOAD    append the payload to the staged blob
+ *   KEYMAP_HID_SAVE    check the staged blob, write it to the keymap
+ *                      partition and use it at once
+ *   KEYMAP_HID_CLEAR   drop the staged blob
+ * GET_REPORT: status, staged length (2 bytes, little-endian)
+ *
+ * A save takes the flash for a while and is done by a task of its own, the
+ * status stays KEYMAP_HID_BUSY until it is over. The blob only holds the
+ * layer planes, see keymap_store.h.
+ */
+#ifndef MY_KEYMAP_HID_H
+#define MY_KEYMAP_HID_H
+
+#include <stdint.h>
+
+// SET_REPORT commands
+#define KEYMAP_HID_LOAD   1
+#define KEYMAP_HID_SAVE   2
+#define KEYMAP_HID_CLEAR  3
+
+// GET_REPORT status
+#define KEYMAP_HID_OK     0
+#define KEYMAP_HID_BUSY   1   // saving, loads and clears are ignored
+#define KEYMAP_HID_ERROR  2   // a chunk or the blob was refused
+
+/**
+ * Start the task saving the uploaded keymaps
+ */
+void init_keymap_hid(void);
+
+/**
+ * A keymap feature report is received, from the TinyUSB task
+ * @param buf report without its ID
+ * @param len report length
+ */
+void kb_keymap_set_report_cb(const uint8_t *buf, uint16_t len);
+
+/**
+ * The host reads the keymap feature report, from the TinyUSB task
+ * @param buf output, without the report ID
+ * @param len room in buf
+ * @return the report length
+ */
+uint16_t kb_keymap_get_report_cb(uint8_t *buf, uint16_t len);
+
+#endif
@@ -0,0 +1,124 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "keymap_store.h"
+#include "keymap_blob.h"
+
+#include "esp_log.h"
+#include "esp_partition.h"
+
+/****************************************************************
+ * 
+ *  Private Varibles
+ * 
+ ****************************************************************/
+
+#define KEYMAP_PARTITION_LABEL "keymap"
+
+static const char *TAG = "keymap";
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+static const esp_partition_t *find_partition(void)
+{
+  return esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+    ESP_PARTITION_SUBTYPE_ANY, KEYMAP_PARTITION_LABEL);
+}
+
+/**
+ * Whether the blob is made for the keyboard model in use, whose macros,
+ * texts, combos and leader sequences its planes refer to
+ */
+static bool is_model_blob(const kb_keymap_blob_hdr_t *hdr)
+{
+  return kb_keymap_blob_is_for_model(hdr, keymap_get_model()->name);
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+bool keymap_store_load(kb_keymap_t *km)
+{
+  const esp_partition_t *part = find_partition();
+  if (part == NULL) {
+    ESP_LOGI(TAG, "No keymap partition, use the built-in keymap");
+    return false;
+  }
+  if (part->size < KB_KEYMAP_BLOB_SIZE) {
+    ESP_LOGW(TAG, "Keymap partition too small");
+    return false;
+  }
+
+  const void *blob;
+  spi_flash_mmap_handle_t handle;
+  esp_err_t err = esp_partition_mmap(part, 0, KB_KEYMAP_BLOB_SIZE,
+    SPI_FLASH_MMAP_DATA, &blob, &handle);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to map the keymap partition: %s", esp_err_to_name(err));
+    return false;
+  }
+
+  const kb_keymap_blob_hdr_t *hdr = blob;
+  const kb_keymap_t *planes = kb_keymap_blob_check(blob, KB_KEYMAP_BLOB_SIZE);
+  bool is_loaded = false;
+  if (planes == NULL) {
+    ESP_LOGI(TAG, "No valid keymap blob, use the built-in keymap");
+  } else if (!is_model_blob(hdr)) {
+    ESP_LOGW(TAG, "Keymap \"%.*s\" is not for the %s, use the built-in keymap",
+      KB_KEYMAP_BLOB_NAME_LEN, hdr->name, keymap_get_model()->name);
+  } else {
+    ESP_LOGI(TAG, "Keymap \"%.*s\" from flash", KB_KEYMAP_BLOB_NAME_LEN, hdr->name);
+    memcpy(km, planes, sizeof(*km));
+    is_loaded = true;
+  }
+  spi_flash_munmap(handle);
+  return is_loaded;
+}
+
+esp_err_t keymap_store_write(const void *blob, size_t len)
+{
+  if (kb_keymap_blob_check(blob, len) == NULL || !is_model_blob(blob)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  const esp_partition_t *part = find_partition();
+  if (part == NULL) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  if (part->size < KB_KEYMAP_BLOB_SIZE) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  size_t erase_size = (KB_KEYMAP_BLOB_SIZE + SPI_FLASH_SEC_SIZE - 1)
+    & ~(SPI_FLASH_SEC_SIZE - 1);
+  esp_err_t err = esp_partition_erase_range(part, 0, erase_size);
+  if (err == ESP_OK) {
+    err = esp_partition_write(part, 0, blob, KB_KEYMAP_BLOB_SIZE);
+  }
+  return err;
+}
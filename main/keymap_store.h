@@ -0,0 +1,56 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Keymap blob in the "keymap" flash partition, see keymap_blob.h.
+ *
+ * The blob only holds the layer planes. The macros, texts, combos and
+ * leader sequences stay the compiled-in ones of the keyboard model, and
+ * the planes refer to them by index, so a blob is only loaded on the model
+ * named in its header, e.g. "e580".
+ */
+#ifndef MY_KEYMAP_STORE_H
+#define MY_KEYMAP_STORE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "layer.h"
+
+/**
+ * Read the planes from the keymap partition. They are copied so that the
+ * partition can be rewritten while the keymap is in use.
+ * @param km output
+ * @return false if the partition is missing or holds no valid blob for
+ *   the keyboard model in use, in which case the compiled-in keymap is used
+ */
+bool keymap_store_load(kb_keymap_t *km);
+
+/**
+ * Replace the blob in the keymap partition, used from the next boot
+ * @param blob blob, checked before the partition is touched
+ * @param len blob length
+ * @return ESP_ERR_INVALID_ARG if the blob is not valid or is made for
+ *   another model, ESP_ERR_NOT_FOUND without the partition, or the flash
+ *   error
+ */
+esp_err_t keymap_store_write(const void *blob, size_t len);
+
+#endif
@@ -0,0 +1,230 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Read the whole row port through GPIO_IN/GPIO_IN1 instead of calling
+ * gpio_get_level() for every row. The row pins are scattered over both
+ * banks, so they are remapped into a packed mask with a permutation
+ * computed once at init.
+ */
+
+#include "matrix.h"
+#include "pin_cfg.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "soc/soc.h"
+#include "soc/gpio_reg.h"
+#include "soc/gpio_struct.h"
+#include "hal/gpio_ll.h"
+#include "esp_cpu.h"
+
+/****************************************************************
+ * 
+ *  Private Varibles
+ * 
+ ****************************************************************/
+
+// keyboard pin array
+static const uint rowscan_pins[KB_NR_ROWS] = {
+  KB_ROW_0, KB_ROW_1, KB_ROW_2, KB_ROW_3, KB_ROW_4, KB_ROW_5, KB_ROW_6, KB_ROW_7,
+  KB_ROW_8, KB_ROW_9, KB_ROW_10, KB_ROW_11, KB_ROW_12, KB_ROW_13, KB_ROW_14, KB_ROW_15,
+  KB_ROW_16, KB_ROW_17,
+};
+
+// row j comes from bit row_shift[j] of GPIO_IN (row_bank[j] == 0) or GPIO_IN1
+static uint8_t row_bank[KB_NR_ROWS];
+static uint8_t row_shift[KB_NR_ROWS];
+
+// GPIO_OUT bits to set for each column, all the select pins are in bank 0
+static uint32_t colsel_bits[KB_NR_COLS];
+static uint32_t colsel_mask;
+
+// given by the row ISR in the idle probe mode
+static SemaphoreHandle_t row_edge_sem = NULL;
+
+// keeps the rise timing of matrix_probe_row_rise() free of interrupts
+static portMUX_TYPE row_rise_lock = portMUX_INITIALIZER_UNLOCKED;
+
+_Static_assert(KB_COLSEL_0 < 32 && KB_COLSEL_1 < 32 && KB_COLSEL_2 < 32,
+  "column select pins must be in GPIO_OUT");
+_Static_assert(BUTTON_FN >= 32, "Fn button is sampled from GPIO_IN1");
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+/**
+ * Row interrupt handler. The rows are level triggered so that they can
+ * also wake up the light sleep, thus mask them all on the first one.
+ */
+static void IRAM_ATTR row_isr_handler(void *arg)
+{
+  (void)arg;
+  BaseType_t need_yield = pdFALSE;
+
+  for (int i = 0; i < KB_NR_ROWS; i++) {
+    gpio_ll_intr_disable(&GPIO, rowscan_pins[i]);
+  }
+  xSemaphoreGiveFromISR(row_edge_sem, &need_yield);
+  portYIELD_FROM_ISR(need_yield);
+}
+
+/****************************************************************
+ * 
+ *  Public functions
+ * 
+ ****************************************************************/
+
+void matrix_init(void)
+{
+  GPIO_INIT_OUT_PULLUP(KB_COLSEL_0);
+  GPIO_INIT_OUT_PULLUP(KB_COLSEL_1);
+  GPIO_INIT_OUT_PULLUP(KB_COLSEL_2);
+
+  for (int i = 0; i < KB_NR_ROWS; i++) {
+    GPIO_INIT_IN_PULLUP(rowscan_pins[i]);
+    // only driven by matrix_probe_row_rise()
+    gpio_set_drive_capability(rowscan_pins[i], GPIO_DRIVE_CAP_0);
+    row_bank[i] = rowscan_pins[i] / 32;
+    row_shift[i] = rowscan_pins[i] % 32;
+  }
+
+  colsel_mask = (1u << KB_COLSEL_0) | (1u << KB_COLSEL_1) | (1u << KB_COLSEL_2);
+  for (int n = 0; n < KB_NR_COLS; n++) {
+    colsel_bits[n] = ((n & 0b001) ? (1u << KB_COLSEL_0) : 0)
+                   | ((n & 0b010) ? (1u << KB_COLSEL_1) : 0)
+                   | ((n & 0b100) ? (1u << KB_COLSEL_2) : 0);
+  }
+}
+
+void kb_set_column_scan(int n)
+{
+  uint32_t bits = colsel_bits[n & (KB_NR_COLS - 1)];
+  REG_WRITE(GPIO_OUT_W1TC_REG, colsel_mask & ~bits);
+  REG_WRITE(GPIO_OUT_W1TS_REG, bits);
+}
+
+uint32_t matrix_read_rows(void)
+{
+  // rows are active low
+  const uint32_t in[2] = {
+    ~REG_READ(GPIO_IN_REG),
+    ~REG_READ(GPIO_IN1_REG),
+  };
+
+  uint32_t rows = 0;
+  for (int j = 0; j < KB_NR_ROWS; j++) {
+    rows |= ((in[row_bank[j]] >> row_shift[j]) & 1u) << j;
+  }
+  return rows;
+}
+
+void matrix_delay_cycles(uint32_t cycles)
+{
+  uint32_t start = esp_cpu_get_ccount();
+  while (esp_cpu_get_ccount() - start < cycles) {
+  }
+}
+
+bool matrix_read_fn(void)
+{
+  return (REG_READ(GPIO_IN1_REG) & (1u << (BUTTON_FN - 32))) == 0;
+}
+
+bool matrix_probe_row_rise(int row, uint32_t timeout_cycles, uint32_t *p_cycles)
+{
+  const uint pin = rowscan_pins[row];
+  const uint32_t in_reg = row_bank[row] ? GPIO_IN1_REG : GPIO_IN_REG;
+  const uint32_t bit = 1u << row_shift[row];
+  uint32_t cycles;
+
+  // The 74HC138 always drives seven columns high and has no enable pin on
+  // a GPIO to release them, so a key held on the row would short the
+  // discharge to a column. Only discharge a row that no column reaches.
+  for (int n = 0; n < KB_NR_COLS; n++) {
+    kb_set_column_scan(n);
+    matrix_delay_cycles(timeout_cycles);
+    if ((matrix_read_rows() >> row) & 1) {
+      return false;
+    }
+  }
+
+  // discharge the row, the pull-up stays on
+  gpio_ll_set_level(&GPIO, pin, 0);
+  gpio_ll_output_enable(&GPIO, pin);
+  matrix_delay_cycles(timeout_cycles);
+
+  portENTER_CRITICAL(&row_rise_lock);
+  gpio_ll_output_disable(&GPIO, pin);
+  uint32_t start = esp_cpu_get_ccount();
+  do {
+    cycles = esp_cpu_get_ccount() - start;
+  } while ((REG_READ(in_reg) & bit) == 0 && cycles < timeout_cycles);
+  portEXIT_CRITICAL(&row_rise_lock);
+
+  *p_cycles = cycles < timeout_cycles ? cycles : timeout_cycles;
+  return true;
+}
+
+void matrix_probe_init(void)
+{
+  row_edge_sem = xSemaphoreCreateBinary();
+
+  for (int i = 0; i < KB_NR_ROWS; i++) {
+    gpio_intr_disable(rowscan_pins[i]);
+    gpio_isr_handler_add(rowscan_pins[i], row_isr_handler, NULL);
+
+    // keep the rows sensing during light sleep
+    gpio_sleep_set_direction(rowscan_pins[i], GPIO_MODE_INPUT);
+    gpio_sleep_set_pull_mode(rowscan_pins[i], GPIO_PULLUP_ONLY);
+  }
+
+  // and keep the column selected
+  gpio_sleep_set_direction(KB_COLSEL_0, GPIO_MODE_OUTPUT);
+  gpio_sleep_set_direction(KB_COLSEL_1, GPIO_MODE_OUTPUT);
+  gpio_sleep_set_direction(KB_COLSEL_2, GPIO_MODE_OUTPUT);
+}
+
+void matrix_probe_arm(void)
+{
+  // drop any stale edge
+  xSemaphoreTake(row_edge_sem, 0);
+
+  for (int i = 0; i < KB_NR_ROWS; i++) {
+    gpio_wakeup_enable(rowscan_pins[i], GPIO_INTR_LOW_LEVEL);
+    gpio_intr_enable(rowscan_pins[i]);
+  }
+}
+
+void matrix_probe_disarm(void)
+{
+  for (int i = 0; i < KB_NR_ROWS; i++) {
+    gpio_intr_disable(rowscan_pins[i]);
+    gpio_wakeup_disable(rowscan_pins[i]);
+  }
+}
+
+bool matrix_probe_wait(uint32_t timeout_us)
+{
+  return xSemaphoreTake(row_edge_sem, timeout_us / 1000 / portTICK_PERIOD_MS) == pdTRUE;
+}
@@ -0,0 +1,99 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Register-level keyboard matrix sampling
+ */
+#ifndef MY_MATRIX_H
+#define MY_MATRIX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "keymap.h"
+
+/**
+ * Initialize the row/column GPIOs and precompute the row permutation
+ */
+void matrix_init(void);
+
+/**
+ * Set keyboard column scan.
+ * @param n column number 0~7
+ */
+void kb_set_column_scan(int n);
+
+/**
+ * Sample all the rows of the currently selected column at once
+ * @return packed row mask
+ */
+uint32_t matrix_read_rows(void);
+
+/**
+ * Busy wait for the rows to settle, finer than esp_rom_delay_us()
+ * @param cycles CPU cycles
+ */
+void matrix_delay_cycles(uint32_t cycles);
+
+/**
+ * Sample the Fn button
+ * @return true if pressed
+ */
+bool matrix_read_fn(void);
+
+/**
+ * Time the pull-up rise of a row after discharging it. A row wired through
+ * the FPC carries the trace and its switches, and rises measurably slower
+ * than an open pad. Call right after matrix_init(). The row is only
+ * discharged, with the weakest drive, when it reads high with every
+ * column selected, so that it never fights a column through a held key.
+ * @param row row number 0~17
+ * @param timeout_cycles CPU cycles to give up after, also the time each
+ *   column is given to settle
+ * @param p_cycles output, CPU cycles until the row reads high,
+ *   timeout_cycles at most
+ * @return false if a held key connects the row to a column, which is then
+ *   wired, and nothing is timed
+ */
+bool matrix_probe_row_rise(int row, uint32_t timeout_cycles, uint32_t *p_cycles);
+
+/**
+ * Register the row interrupt handlers. Call after the GPIO ISR service is
+ * installed, i.e. after init_pm().
+ */
+void matrix_probe_init(void);
+
+/**
+ * Arm the row interrupts (and light-sleep wakeup) for the idle probe mode
+ */
+void matrix_probe_arm(void);
+
+/**
+ * Disarm the row interrupts
+ */
+void matrix_probe_disarm(void);
+
+/**
+ * Wait for a row edge on the currently selected column
+ * @param timeout_us timeout in microsecond
+ * @return true if a row went low within the timeout
+ */
+bool matrix_probe_wait(uint32_t timeout_us);
+
+#endif
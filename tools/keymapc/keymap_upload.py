@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+#
+# This file is part of esp32s3-keyboard.
+#
+# Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn>
+# (Institute of Computing Technology, Chinese Academy of Sciences)
+#
+# esp32s3-keyboard is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# esp32s3-keyboard is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+
+"""
+Upload a keymap blob made by keymapc to a running keyboard over USB, through
+the keymap feature report of its keyboard interface (see main/keymap_hid.h).
+Linux only, it talks to the hidraw node of that interface:
+
+    keymap_upload.py /dev/hidraw3 build-keymapc/keymaps/e580.bin
+"""
+
+import fcntl
+import os
+import sys
+import time
+
+REPORT_ID_KEYMAP = 5
+REPORT_LEN = 31             # TUSB_HID_KEYMAP_REPORT_LEN, without the ID
+CHUNK_LEN = REPORT_LEN - 2  # command and length first
+
+KEYMAP_HID_LOAD = 1
+KEYMAP_HID_SAVE = 2
+KEYMAP_HID_CLEAR = 3
+
+KEYMAP_HID_OK = 0
+KEYMAP_HID_BUSY = 1
+
+SAVE_TIMEOUT_S = 5
+
+
+def hidioc(nr, length):
+    # _IOC(_IOC_READ | _IOC_WRITE, 'H', nr, length)
+    return 3 << 30 | length << 16 | ord('H') << 8 | nr
+
+
+def set_feature(fd, cmd, data=b''):
+    report = bytes([REPORT_ID_KEYMAP, cmd, len(data)]) + data
+    report = bytearray(report.ljust(REPORT_LEN + 1, b'\0'))
+    fcntl.ioctl(fd, hidioc(0x06, len(report)), report)
+
+
+def get_status(fd):
+    report = bytearray(REPORT_LEN + 1)
+    report[0] = REPORT_ID_KEYMAP
+    fcntl.ioctl(fd, hidioc(0x07, len(report)), report)
+    return report[1], report[2] | report[3] << 8
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit("usage: keymap_upload.py /dev/hidrawN keymap.bin")
+    with open(sys.argv[2], 'rb') as f:
+        blob = f.read()
+
+    fd = os.open(sys.argv[1], os.O_RDWR)
+    try:
+        set_feature(fd, KEYMAP_HID_CLEAR)
+        for i in range(0, len(blob), CHUNK_LEN):
+            set_feature(fd, KEYMAP_HID_LOAD, blob[i:i + CHUNK_LEN])
+        status, staged = get_status(fd)
+        if status != KEYMAP_HID_OK or staged != len(blob):
+            sys.exit("refused after %d of %d bytes" % (staged, len(blob)))
+
+        set_feature(fd, KEYMAP_HID_SAVE)
+        deadline = time.monotonic() + SAVE_TIMEOUT_S
+        status, _ = get_status(fd)
+        while status == KEYMAP_HID_BUSY and time.monotonic() < deadline:
+            time.sleep(0.05)
+            status, _ = get_status(fd)
+    finally:
+        os.close(fd)
+
+    if status != KEYMAP_HID_OK:
+        sys.exit("not saved, see the keyboard log")
+    print("saved")
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,617 @@
+/**
+ * This file is part of esp32s3-keyboard.
+ *
+ * Copyright (C) 2020-2021 Yuquan He <heyuquan20b at ict dot ac dot cn> 
+ * (Institute of Computing Technology, Chinese Academy of Sciences)
+ *
+ * esp32s3-keyboard is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * esp32s3-keyboard is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with esp32s3-keyboard. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * keymapc: keymap compiler
+ *
+ * Compiles a keymap description into the kb_keymap_t planes, checked for
+ * scan codes mapped twice, positions out of the matrix and unmapped
+ * positions, and writes them as a keymap blob and/or a C header with the
+ * planes as a const initializer. See keymaps/e580.kmap for the format.
+ *
+ * The key, consumer, Fn function and layer names are read from keymap.h,
+ * so they always match the firmware.
+ */
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "keymap.h"
+#include "layer.h"
+#include "keymap_blob.h"
+}
+
+#ifndef KEYMAP_H
+#define KEYMAP_H "keymap.h"
+#endif
+
+namespace {
+
+/****************************************************************
+ * 
+ *  Typedefs
+ * 
+ ****************************************************************/
+
+/**
+ * One mapping of the description
+ */
+struct Entry {
+  int layer;
+  int col, row;
+  kb_action_t action;
+  int line;
+};
+
+/**
+ * The whole description
+ */
+struct Keymap {
+  std::string name;
+  std::vector<Entry> entries;
+  bool unused[KB_NR_COLS][KB_NR_ROWS] = {};
+  bool has_layer[KB_NR_LAYERS] = {};
+};
+
+/****************************************************************
+ * 
+ *  Private functions
+ * 
+ ****************************************************************/
+
+std::string g_path;     // file being read, for the messages
+int g_nr_errors = 0;
+int g_nr_warnings = 0;
+
+/**
+ * Report a problem of the description
+ * @param line line number, 0 for the whole file
+ */
+void report(const char *kind, int line, const std::string &msg)
+{
+  if (line > 0) {
+    std::fprintf(stderr, "%s:%d: %s: %s\n", g_path.c_str(), line, kind, msg.c_str());
+  } else {
+    std::fprintf(stderr, "%s: %s: %s\n", g_path.c_str(), kind, msg.c_str());
+  }
+}
+
+void error(int line, const std::string &msg)
+{
+  report("error", line, msg);
+  g_nr_errors++;
+}
+
+void warning(int line, const std::string &msg)
+{
+  report("warning", line, msg);
+  g_nr_warnings++;
+}
+
+std::string pos(int col, int row)
+{
+  return std::to_string(col) + " " + std::to_string(row);
+}
+
+std::string upper(std::string s)
+{
+  for (char &c : s) {
+    c = std::toupper(static_cast<unsigned char>(c));
+  }
+  return s;
+}
+
+bool parse_int(const std::string &s, long *value)
+{
+  char *end;
+  if (s.empty()) {
+    return false;
+  }
+  *value = std::strtol(s.c_str(), &end, 0);
+  return *end == '\0';
+}
+
+/**
+ * Read the #define'd numbers and the enumerators of keymap.h
+ * @param path path of keymap.h
+ * @param symbols output, name -> value
+ * @return false if the file cannot be read
+ */
+bool load_symbols(const std::string &path, std::map<std::string, long> *symbols)
+{
+  std::ifstream in(path);
+  if (!in) {
+    return false;
+  }
+
+  std::string line;
+  bool is_in_enum = false;
+  long next = 0;
+  while (std::getline(in, line)) {
+    line = line.substr(0, line.find("//"));
+    size_t c = line.find("/*");
+    if (c != std::string::npos) {
+      line = line.substr(0, c);
+    }
+    std::istringstream ss(line);
+    std::string word;
+    ss >> word;
+
+    if (word == "#define") {
+      std::string name, value;
+      long v;
+      ss >> name >> value;
+      if (parse_int(value, &v)) {
+        (*symbols)[name] = v;
+      }
+    } else if (word == "enum" || word == "typedef") {
+      is_in_enum = line.find("enum") != std::string::npos;
+      next = 0;
+    } else if (is_in_enum && word.size() > 0 && word[0] == '}') {
+      is_in_enum = false;
+    } else if (is_in_enum && word.size() > 0
+      && (std::isalpha(static_cast<unsigned char>(word[0])) || word[0] == '_')
+    ) {
+      // NAME, or NAME = value,
+      std::string name = word.substr(0, word.find_first_of("=,"));
+      size_t eq = line.find('=');
+      if (eq != std::string::npos) {
+        std::string value = line.substr(eq + 1);
+        value = value.substr(0, value.find(','));
+        value.erase(0, value.find_first_not_of(" \t"));
+        value.erase(value.find_last_not_of(" \t") + 1);
+        long v;
+        if (parse_int(value, &v)) {
+          next = v;
+        }
+      }
+      (*symbols)[name] = next++;
+    }
+  }
+  return true;
+}
+
+class Parser {
+ public:
+  explicit Parser(const std::map<std::string, long> &symbols) : symbols_(symbols) {}
+
+  /**
+   * Parse a layer: base, fn, user0, ... or KB_LAYER_*, or its number
+   * @return -1 if unknown
+   */
+  int layer(const std::string &s) const
+  {
+    long v;
+    if (parse_int(s, &v)) {
+      return v >= 0 && v < KB_NR_LAYERS ? v : -1;
+    }
+    std::string name = upper(s);
+    if (name.compare(0, 9, "KB_LAYER_") != 0) {
+      name = "KB_LAYER_" + name;
+    }
+    auto it = symbols_.find(name);
+    return it != symbols_.end() && it->second < KB_NR_LAYERS ? it->second : -1;
+  }
+
+  /**
+   * Parse an action, see keymaps/e580.kmap
+   * @param s action text, without blanks
+   * @param line line number for the messages
+   * @param act output
+   * @return false if it is not an action
+   */
+  bool action(const std::string &s, int line, kb_action_t *act) const
+  {
+    std::string name = s;
+    std::vector<std::string> args;
+    size_t open = s.find('(');
+    if (open != std::string::npos) {
+      if (s.back() != ')') {
+        error(line, "missing ')' in '" + s + "'");
+        return false;
+      }
+      name = s.substr(0, open);
+      std::string arg;
+      std::istringstream ss(s.substr(open + 1, s.size() - open - 2));
+      while (std::getline(ss, arg, ',')) {
+        args.push_back(arg);
+      }
+    }
+    name = upper(name);
+
+    long v;
+    if (args.empty()) {
+      if (name == "TRNS") {
+        *act = ACT_TRNS;
+      } else if (name == "NONE") {
+        *act = ACT_NONE;
+      } else if (name == "LEADER") {
+        *act = ACT_LEADER;
+      } else if (parse_int(s, &v) && v >= 0 && v <= 0xffff) {
+        *act = v;
+      } else if (name.compare(0, 13, "KEY_CONSUMER_") == 0) {
+        if (!symbol(name, line, 0xfff, &v)) {
+          return false;
+        }
+        *act = ACT_CONSUMER(v);
+      } else if (name.compare(0, 4, "KEY_") == 0) {
+        if (!symbol(name, line, 0xff, &v)) {
+          return false;
+        }
+        *act = ACT_KEY(v);
+      } else if (name.compare(0, 3, "FN_") == 0) {
+        if (!symbol(name, line, 0xfff, &v)) {
+          return false;
+        }
+        *act = ACT_FN(v);
+      } else {
+        error(line, "unknown action '" + s + "'");
+        return false;
+      }
+      return true;
+    }
+
+    int l = layer(args[0]);
+    long key;
+    if (args.size() == 1 && (name == "MO" || name == "TG" || name == "OS")) {
+      if (l < 0) {
+        error(line, "unknown layer '" + args[0] + "'");
+        return false;
+      }
+      *act = name == "MO" ? ACT_MO(l) : name == "TG" ? ACT_TG(l) : ACT_OS(l);
+    } else if (args.size() == 1 && name == "CONSUMER" && parse_int(args[0], &v) && v <= 0xfff) {
+      *act = ACT_CONSUMER(v);
+    } else if (args.size() == 1 && name == "MACRO" && parse_int(args[0], &v) && v <= 0xfff) {
+      *act = ACT_MACRO(v);
+    } else if (args.size() == 1 && name == "TEXT" && parse_int(args[0], &v) && v <= 0xfff) {
+      *act = ACT_TEXT(v);
+    } else if (args.size() == 2 && name == "MT") {
+      if (!symbol(upper(args[0]), line, 0xff, &v) || v < KEY_LEFTCTRL || v > KEY_RIGHTMETA) {
+        error(line, "'" + args[0] + "' is not a modifier key");
+        return false;
+      }
+      if (!symbol(upper(args[1]), line, 0xff, &key)) {
+        return false;
+      }
+      *act = ACT_MT(v - KEY_LEFTCTRL, key);
+    } else if (args.size() == 2 && name == "LT") {
+      if (l < 0 || l > 0x0f) {
+        error(line, "unknown layer '" + args[0] + "'");
+        return false;
+      }
+      if (!symbol(upper(args[1]), line, 0xff, &key)) {
+        return false;
+      }
+      *act = ACT_LT(l, key);
+    } else {
+      error(line, "unknown action '" + s + "'");
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  bool symbol(const std::string &name, int line, long max, long *value) const
+  {
+    auto it = symbols_.find(name);
+    if (it == symbols_.end() || it->second < 0 || it->second > max) {
+      error(line, "unknown name '" + name + "'");
+      return false;
+    }
+    *value = it->second;
+    return true;
+  }
+
+  const std::map<std::string, long> &symbols_;
+};
+
+/**
+ * Read a keymap description. Errors are reported as they are found.
+ * @param path description
+ * @param parser names of keymap.h
+ * @param km output
+ * @return false if the file cannot be read
+ */
+bool read_keymap(const std::string &path, const Parser &parser, Keymap *km)
+{
+  std::ifstream in(path);
+  if (!in) {
+    return false;
+  }
+
+  std::string text;
+  int nr_line = 0;
+  int layer = -1;
+  while (std::getline(in, text)) {
+    nr_line++;
+    std::istringstream ss(text.substr(0, text.find('#')));
+    std::vector<std::string> words;
+    for (std::string w; ss >> w; ) {
+      words.push_back(w);
+    }
+    if (words.empty()) {
+      continue;
+    }
+
+    long col, row;
+    if (words[0] == "name" && words.size() == 2) {
+      km->name = words[1];
+      if (km->name.size() > KB_KEYMAP_BLOB_NAME_LEN) {
+        warning(nr_line, "name truncated to " + std::to_string(KB_KEYMAP_BLOB_NAME_LEN) + " characters");
+      }
+    } else if (words[0] == "layer" && words.size() == 2) {
+      layer = parser.layer(words[1]);
+      if (layer < 0) {
+        error(nr_line, "unknown layer '" + words[1] + "'");
+      } else {
+        km->has_layer[layer] = true;
+      }
+    } else if (words[0] == "unused" && words.size() >= 3 && parse_int(words[1], &col)) {
+      for (size_t i = 2; i < words.size(); i++) {
+        if (!parse_int(words[i], &row)) {
+          error(nr_line, "cannot parse '" + text + "'");
+        } else if (col < 0 || col >= KB_NR_COLS || row < 0 || row >= KB_NR_ROWS) {
+          error(nr_line, "position " + pos(col, row) + " is outside the matrix");
+        } else {
+          km->unused[col][row] = true;
+        }
+      }
+    } else if (words.size() >= 3 && parse_int(words[0], &col) && parse_int(words[1], &row)) {
+      // the action may be written with blanks, e.g. MT(KEY_LEFTSHIFT, KEY_A)
+      std::string act_text;
+      for (size_t i = 2; i < words.size(); i++) {
+        act_text += words[i];
+      }
+      kb_action_t act;
+      if (layer < 0) {
+        error(nr_line, "key before any 'layer'");
+      } else if (col < 0 || col >= KB_NR_COLS || row < 0 || row >= KB_NR_ROWS) {
+        error(nr_line, "position " + pos(col, row) + " is outside the "
+          + std::to_string(KB_NR_COLS) + "x" + std::to_string(KB_NR_ROWS) + " matrix");
+      } else if (parser.action(act_text, nr_line, &act)) {
+        km->entries.push_back({layer, static_cast<int>(col), static_cast<int>(row), act, nr_line});
+      }
+    } else {
+      error(nr_line, "cannot parse '" + text + "'");
+    }
+  }
+  return true;
+}
+
+bool is_fkey(kb_action_t act)
+{
+  return ACT_KIND(act) == ACT_KIND_KEY && ACT_ARG(act) >= KEY_F1 && ACT_ARG(act) <= KEY_F12;
+}
+
+/**
+ * Check the description and build the planes the way kb_keymap_build()
+ * does: Fn + a key without a Fn function does nothing, Fn lock turns the
+ * F-keys into their Fn functions and Fn gives them back. Entries given
+ * for those layers override what is derived.
+ * @param km description
+ * @param out output
+ */
+void compile(const Keymap &km, kb_keymap_t *out)
+{
+  int first[KB_NR_LAYERS][KB_NR_COLS][KB_NR_ROWS] = {};  // line of the first mapping
+
+  std::memset(out, 0, sizeof(*out));
+  for (const Entry &e : km.entries) {
+    if (!kb_action_is_valid(e.action)) {
+      char hex[8];
+      std::snprintf(hex, sizeof(hex), "0x%04x", e.action);
+      error(e.line, "action " + std::string(hex) + " at " + pos(e.col, e.row)
+        + " is not valid, e.g. a usage past 0xff or a layer that does not exist");
+    }
+    int &prev = first[e.layer][e.col][e.row];
+    if (prev != 0) {
+      error(e.line, "scan code " + pos(e.col, e.row) + " is already mapped at line "
+        + std::to_string(prev));
+    } else {
+      prev = e.line;
+    }
+  }
+
+  const auto &base = out->plane[KB_LAYER_BASE];
+  for (const Entry &e : km.entries) {
+    if (e.layer == KB_LAYER_BASE) {
+      out->plane[KB_LAYER_BASE][e.col][e.row] = e.action;
+    }
+  }
+  for (int i = 0; i < KB_NR_COLS; i++) {
+    for (int j = 0; j < KB_NR_ROWS; j++) {
+      out->plane[KB_LAYER_FN][i][j] = ACT_NONE;
+    }
+  }
+  for (const Entry &e : km.entries) {
+    if (e.layer != KB_LAYER_FN) {
+      continue;
+    }
+    out->plane[KB_LAYER_FN][e.col][e.row] = e.action;
+    if (is_fkey(base[e.col][e.row])) {
+      out->plane[KB_LAYER_FNLOCK][e.col][e.row] = e.action;
+    }
+    if (base[e.col][e.row] == ACT_TRNS) {
+      warning(e.line, "Fn key at " + pos(e.col, e.row) + " has no key in the base layer");
+    }
+  }
+  for (int i = 0; i < KB_NR_COLS; i++) {
+    for (int j = 0; j < KB_NR_ROWS; j++) {
+      if (is_fkey(base[i][j])) {
+        out->plane[KB_LAYER_FN_FNLOCK][i][j] = base[i][j];
+      }
+    }
+  }
+  for (const Entry &e : km.entries) {
+    if (e.layer != KB_LAYER_BASE && e.layer != KB_LAYER_FN) {
+      out->plane[e.layer][e.col][e.row] = e.action;
+    }
+  }
+
+  // the same usage on two keys is legal, but rarely meant
+  std::map<kb_action_t, const Entry*> usages;
+  for (const Entry &e : km.entries) {
+    if (e.layer != KB_LAYER_BASE || ACT_KIND(e.action) != ACT_KIND_KEY) {
+      continue;
+    }
+    auto it = usages.find(e.action);
+    if (it != usages.end()) {
+      warning(e.line, "key at " + pos(e.col, e.row) + " sends the same usage as line "
+        + std::to_string(it->second->line));
+    } else {
+      usages[e.action] = &e;
+    }
+  }
+
+  for (int i = 0; i < KB_NR_COLS; i++) {
+    std::string rows;
+    for (int j = 0; j < KB_NR_ROWS; j++) {
+      if (base[i][j] == ACT_TRNS && !km.unused[i][j]) {
+        rows += " " + std::to_string(j);
+      }
+    }
+    if (!rows.empty()) {
+      warning(0, "column " + std::to_string(i) + " rows" + rows
+        + " are unmapped, mark them 'unused' if they are not wired");
+    }
+  }
+}
+
+bool write_blob(const std::string &path, const kb_keymap_t &km, const std::string &name)
+{
+  std::vector<uint8_t> buf(KB_KEYMAP_BLOB_SIZE);
+  size_t len = kb_keymap_blob_build(&km, name.c_str(), buf.data(), buf.size());
+  std::ofstream out(path, std::ios::binary);
+  out.write(reinterpret_cast<const char*>(buf.data()), len);
+  return len != 0 && out.good();
+}
+
+bool write_header(const std::string &path, const kb_keymap_t &km,
+  const std::string &name, const std::string &src)
+{
+  std::FILE *fp = std::fopen(path.c_str(), "w");
+  if (fp == NULL) {
+    return false;
+  }
+
+  std::fprintf(fp, "/**\n * Generated by keymapc from %s, do not edit\n */\n", src.c_str());
+  std::fprintf(fp, "#ifndef MY_KEYMAP_DEFAULT_H\n#define MY_KEYMAP_DEFAULT_H\n\n");
+  std::fprintf(fp, "#include \"layer.h\"\n\n");
+  std::fprintf(fp, "#define KB_DEFAULT_KEYMAP_NAME \"%s\"\n\n", name.c_str());
+  std::fprintf(fp, "static const kb_keymap_t kb_default_keymap = {\n  .plane = {\n");
+  for (int l = 0; l < KB_NR_LAYERS; l++) {
+    std::fprintf(fp, "    [%d] = {\n", l);
+    for (int i = 0; i < KB_NR_COLS; i++) {
+      std::fprintf(fp, "      [%d] = {", i);
+      for (int j = 0; j < KB_NR_ROWS; j++) {
+        std::fprintf(fp, "%s0x%04x", j == 0 ? " " : ", ", km.plane[l][i][j]);
+      }
+      std::fprintf(fp, " },\n");
+    }
+    std::fprintf(fp, "    },\n");
+  }
+  std::fprintf(fp, "  },\n};\n\n#endif\n");
+  return std::fclose(fp) == 0;
+}
+
+void usage(const char *argv0)
+{
+  std::fprintf(stderr,
+    "usage: %s [--strict] [--keymap-h keymap.h] [-o blob.bin] [-c header.h] input.kmap\n"
+    "  --strict   treat warnings as errors\n"
+    "  -o         write the keymap blob, for the keymap partition\n"
+    "  -c         write a C header with the planes as kb_default_keymap\n",
+    argv0);
+}
+
+}  // namespace
+
+/****************************************************************
+ * 
+ *  Main
+ * 
+ ****************************************************************/
+
+int main(int argc, char **argv)
+{
+  std::string keymap_h = KEYMAP_H;
+  std::string input, blob_path, header_path;
+  bool is_strict = false;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--strict") {
+      is_strict = true;
+    } else if (arg == "--keymap-h" && i + 1 < argc) {
+      keymap_h = argv[++i];
+    } else if (arg == "-o" && i + 1 < argc) {
+      blob_path = argv[++i];
+    } else if (arg == "-c" && i + 1 < argc) {
+      header_path = argv[++i];
+    } else if (arg[0] != '-' && input.empty()) {
+      input = arg;
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (input.empty()) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::map<std::string, long> symbols;
+  if (!load_symbols(keymap_h, &symbols)) {
+    std::fprintf(stderr, "%s: cannot read %s\n", argv[0], keymap_h.c_str());
+    return 1;
+  }
+  Parser parser(symbols);
+
+  Keymap km;
+  g_path = input;
+  if (!read_keymap(input, parser, &km)) {
+    std::fprintf(stderr, "%s: cannot read %s\n", argv[0], input.c_str());
+    return 1;
+  }
+  kb_keymap_t planes;
+  compile(km, &planes);
+
+  if (g_nr_errors != 0 || (is_strict && g_nr_warnings != 0)) {
+    std::fprintf(stderr, "%s: %d errors, %d warnings\n", input.c_str(), g_nr_errors, g_nr_warnings);
+    return 1;
+  }
+  if (!blob_path.empty() && !write_blob(blob_path, planes, km.name)) {
+    std::fprintf(stderr, "%s: cannot write %s\n", argv[0], blob_path.c_str());
+    return 1;
+  }
+  if (!header_path.empty() && !write_header(header_path, planes, km.name, input)) {
+    std::fprintf(stderr, "%s: cannot write %s\n", argv[0], header_path.c_str());
+    return 1;
+  }
+  return 0;
+}
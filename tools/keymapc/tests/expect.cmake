@@ -0,0 +1,16 @@
+# Run keymapc on a test keymap and check its exit status and messages:
+#
+#   cmake -DKEYMAPC=<keymapc> -DKMAP=<input.kmap> [-DARGS=--strict]
+#         -DEXPECT_RESULT=<status> -DEXPECT_OUTPUT=<regex> -P expect.cmake
+
+execute_process(COMMAND ${KEYMAPC} ${ARGS} ${KMAP}
+                RESULT_VARIABLE result
+                OUTPUT_VARIABLE output
+                ERROR_VARIABLE output)
+
+if(NOT result STREQUAL EXPECT_RESULT)
+    message(FATAL_ERROR "keymapc exited with ${result}, not ${EXPECT_RESULT}:\n${output}")
+endif()
+if(NOT output MATCHES "${EXPECT_OUTPUT}")
+    message(FATAL_ERROR "keymapc said nothing matching '${EXPECT_OUTPUT}':\n${output}")
+endif()